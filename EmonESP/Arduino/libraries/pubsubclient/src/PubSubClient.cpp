@@ -9,6 +9,7 @@
 
 PubSubClient::PubSubClient() {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     this->_client = NULL;
     this->stream = NULL;
     setCallback(NULL);
@@ -16,24 +17,28 @@ PubSubClient::PubSubClient() {
 
 PubSubClient::PubSubClient(Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setClient(client);
     this->stream = NULL;
 }
 
 PubSubClient::PubSubClient(IPAddress addr, uint16_t port, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(addr, port);
     setClient(client);
     this->stream = NULL;
 }
 PubSubClient::PubSubClient(IPAddress addr, uint16_t port, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(addr,port);
     setClient(client);
     setStream(stream);
 }
 PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(addr, port);
     setCallback(callback);
     setClient(client);
@@ -41,6 +46,7 @@ PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATUR
 }
 PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(addr,port);
     setCallback(callback);
     setClient(client);
@@ -49,18 +55,21 @@ PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATUR
 
 PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(ip, port);
     setClient(client);
     this->stream = NULL;
 }
 PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(ip,port);
     setClient(client);
     setStream(stream);
 }
 PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(ip, port);
     setCallback(callback);
     setClient(client);
@@ -68,6 +77,7 @@ PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE,
 }
 PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(ip,port);
     setCallback(callback);
     setClient(client);
@@ -76,18 +86,21 @@ PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE,
 
 PubSubClient::PubSubClient(const char* domain, uint16_t port, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(domain,port);
     setClient(client);
     this->stream = NULL;
 }
 PubSubClient::PubSubClient(const char* domain, uint16_t port, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(domain,port);
     setClient(client);
     setStream(stream);
 }
 PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(domain,port);
     setCallback(callback);
     setClient(client);
@@ -95,12 +108,22 @@ PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGN
 }
 PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
     setServer(domain,port);
     setCallback(callback);
     setClient(client);
     setStream(stream);
 }
 
+PubSubClient::~PubSubClient() {
+    if (bufferOwned) {
+        free(buffer);
+    }
+#if MQTT_QOS1_QUEUE_SIZE > 0
+    free(qosPacket);
+#endif
+}
+
 boolean PubSubClient::connect(const char *id) {
     return connect(id,NULL,NULL,0,0,0,0);
 }
@@ -117,6 +140,12 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
     if (!connected()) {
         int result = 0;
 
+        if (buffer == NULL) {
+            // The constructor could not allocate the buffer
+            _state = MQTT_CONNECT_FAILED;
+            return false;
+        }
+
         if (domain != NULL) {
             result = _client->connect(this->domain, this->port);
         } else {
@@ -135,6 +164,23 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
             uint8_t d[7] = {0x00,0x04,'M','Q','T','T',MQTT_VERSION};
 #define MQTT_HEADER_VERSION_LENGTH 7
 #endif
+            // Protocol, flags, keepalive and the strings must fit the buffer
+            size_t needed = length+MQTT_HEADER_VERSION_LENGTH+3+2+strlen(id);
+            if (willTopic) {
+                needed += 2+strlen(willTopic)+2+strlen(willMessage);
+            }
+            if (user != NULL) {
+                needed += 2+strlen(user);
+                if (pass != NULL) {
+                    needed += 2+strlen(pass);
+                }
+            }
+            if (needed > bufferSize) {
+                _state = MQTT_CONNECT_FAILED;
+                _client->stop();
+                return false;
+            }
+
             for (j = 0;j<MQTT_HEADER_VERSION_LENGTH;j++) {
                 buffer[length++] = d[j];
             }
@@ -191,6 +237,8 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
                     lastInActivity = millis();
                     pingOutstanding = false;
                     _state = MQTT_CONNECTED;
+                    // Unacknowledged QoS 1 messages go out again
+                    qosResend();
                     return true;
                 } else {
                     _state = buffer[3];
@@ -231,6 +279,7 @@ boolean PubSubClient::readByte(uint8_t * result, uint16_t * index){
 
 uint16_t PubSubClient::readPacket(uint8_t* lengthLength) {
     uint16_t len = 0;
+    chunked = false;
     if(!readByte(buffer, &len)) return 0;
     bool isPublish = (buffer[0]&0xF0) == MQTTPUBLISH;
     uint32_t multiplier = 1;
@@ -257,6 +306,9 @@ uint16_t PubSubClient::readPacket(uint8_t* lengthLength) {
             // skip message id
             skip += 2;
         }
+        if (this->chunkCallback && len-2+length > bufferSize) {
+            return readChunks(*lengthLength,length);
+        }
     }
 
     for (uint16_t i = start;i<length;i++) {
@@ -266,19 +318,80 @@ uint16_t PubSubClient::readPacket(uint8_t* lengthLength) {
                 this->stream->write(digit);
             }
         }
-        if (len < MQTT_MAX_PACKET_SIZE) {
+        if (len < bufferSize) {
             buffer[len] = digit;
         }
         len++;
     }
 
-    if (!this->stream && len > MQTT_MAX_PACKET_SIZE) {
+    if (!this->stream && len > bufferSize) {
         len = 0; // This will cause the packet to be ignored.
     }
 
     return len;
 }
 
+// Reads the rest of a PUBLISH too long for the buffer, whose header and topic
+// length are in. The topic and packet id are kept, the payload is handed to
+// chunkCallback in pieces that fill the rest of the buffer. Returns the packet
+// length, or 0 if the topic does not fit or the packet could not be read
+uint16_t PubSubClient::readChunks(uint8_t llen, uint16_t length) {
+    uint16_t len = llen+3;
+    uint16_t tl = (buffer[llen+1]<<8)+buffer[llen+2];
+    uint16_t idLength = (buffer[0]&MQTTQOS1) ? 2 : 0;
+    if (length < 2+tl+idLength) {
+        return 0;
+    }
+    uint16_t total = length-2-tl-idLength;
+    // Room for the topic, packet id and at least one byte of payload
+    boolean fits = len+tl+idLength < bufferSize;
+    uint8_t digit;
+
+    for (uint16_t i = 0;i<tl+idLength;i++) {
+        if(!readByte(&digit)) return 0;
+        if (fits) {
+            buffer[len] = digit;
+        }
+        len++;
+    }
+    if (fits && idLength) {
+        chunkedMsgId = (buffer[llen+3+tl]<<8)+buffer[llen+4+tl];
+    }
+
+    // As in loop(), the topic moves one byte to the front to end it with \0
+    char *topic = (char*) buffer+llen+2;
+    uint8_t *chunk = buffer+llen+3+tl;
+    uint16_t chunkSize = bufferSize-(llen+3+tl);
+    if (fits) {
+        memmove(buffer+llen+2,buffer+llen+3,tl);
+        buffer[llen+2+tl] = 0;
+    }
+
+    uint16_t offset = 0;
+    while (offset < total) {
+        uint16_t n = (total-offset < chunkSize) ? total-offset : chunkSize;
+        for (uint16_t i = 0;i<n;i++) {
+            if(!readByte(&digit)) return 0;
+            if (this->stream) {
+                this->stream->write(digit);
+            }
+            if (fits) {
+                chunk[i] = digit;
+            }
+        }
+        if (fits) {
+            chunkCallback(topic,chunk,n,offset,total);
+        }
+        offset += n;
+    }
+
+    if (!fits) {
+        return 0; // Dropped, as for an oversized packet without the callback
+    }
+    chunked = true;
+    return len+total;
+}
+
 boolean PubSubClient::loop() {
     if (connected()) {
         unsigned long t = millis();
@@ -305,7 +418,17 @@ boolean PubSubClient::loop() {
                 lastInActivity = t;
                 uint8_t type = buffer[0]&0xF0;
                 if (type == MQTTPUBLISH) {
-                    if (callback) {
+                    if (chunked) {
+                        // The payload went to chunkCallback in readPacket()
+                        if ((buffer[0]&0x06) == MQTTQOS1) {
+                            buffer[0] = MQTTPUBACK;
+                            buffer[1] = 2;
+                            buffer[2] = (chunkedMsgId >> 8);
+                            buffer[3] = (chunkedMsgId & 0xFF);
+                            _client->write(buffer,4);
+                            lastOutActivity = t;
+                        }
+                    } else if (callback) {
                         uint16_t tl = (buffer[llen+1]<<8)+buffer[llen+2]; /* topic length in bytes */
                         memmove(buffer+llen+2,buffer+llen+3,tl); /* move topic inside buffer 1 byte to front */
                         buffer[llen+2+tl] = 0; /* end the topic as a 'C' string with \x00 */
@@ -334,6 +457,8 @@ boolean PubSubClient::loop() {
                     _client->write(buffer,2);
                 } else if (type == MQTTPINGRESP) {
                     pingOutstanding = false;
+                } else if (type == MQTTPUBACK) {
+                    qosAck((buffer[llen+1]<<8)+buffer[llen+2]);
                 }
             }
         }
@@ -356,7 +481,7 @@ boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigne
 
 boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
     if (connected()) {
-        if (MQTT_MAX_PACKET_SIZE < 5 + 2+strlen(topic) + plength) {
+        if (bufferSize < 5 + 2+strlen(topic) + plength) {
             // Too long
             return false;
         }
@@ -376,6 +501,25 @@ boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigne
     return false;
 }
 
+boolean PubSubClient::publish(const char* topic, const char* payload, boolean retained, uint8_t qos) {
+    return publish(topic,(const uint8_t*)payload,strlen(payload),retained,qos);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained, uint8_t qos) {
+    if (qos == 0) {
+        return publish(topic,payload,plength,retained);
+    }
+    if (qos != 1 || qosBegin(topic,plength,retained) < 0) {
+        return false;
+    }
+#if MQTT_QOS1_QUEUE_SIZE > 0
+    uint8_t slot = qosStreaming;
+    memcpy(qosSlot(slot)+qosLength[slot],payload,plength);
+    qosLength[slot] += plength;
+#endif
+    return qosCommit();
+}
+
 boolean PubSubClient::publish_P(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
     uint8_t llen = 0;
     uint8_t digit;
@@ -421,12 +565,226 @@ boolean PubSubClient::publish_P(const char* topic, const uint8_t* payload, unsig
     return rc == tlen + 4 + plength;
 }
 
-boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
+boolean PubSubClient::beginPublish(const char* topic, unsigned int plength, boolean retained) {
+    if (connected()) {
+        if (bufferSize < MQTT_MAX_HEADER_SIZE + 2+strlen(topic)) {
+            // Topic too long for the buffer
+            return false;
+        }
+        // Send the header and variable length field
+        uint16_t length = MQTT_MAX_HEADER_SIZE;
+        length = writeString(topic,buffer,length);
+        uint8_t header = MQTTPUBLISH;
+        if (retained) {
+            header |= 1;
+        }
+        size_t hlen = buildHeader(header, buffer, plength+length-MQTT_MAX_HEADER_SIZE);
+        uint16_t rc = _client->write(buffer+(MQTT_MAX_HEADER_SIZE-hlen),length-(MQTT_MAX_HEADER_SIZE-hlen));
+        lastOutActivity = millis();
+        return (rc == (length-(MQTT_MAX_HEADER_SIZE-hlen)));
+    }
+    return false;
+}
+
+boolean PubSubClient::beginPublish(const char* topic, unsigned int plength, boolean retained, uint8_t qos) {
+    if (qos == 0) {
+        return beginPublish(topic,plength,retained);
+    }
+    return qos == 1 && qosBegin(topic,plength,retained) >= 0;
+}
+
+int PubSubClient::endPublish() {
+    if (qosStreaming >= 0) {
+        return qosCommit() ? 1 : 0;
+    }
+    return 1;
+}
+
+size_t PubSubClient::write(uint8_t data) {
+    return write(&data,1);
+}
+
+size_t PubSubClient::write(const uint8_t *buffer, size_t size) {
+#if MQTT_QOS1_QUEUE_SIZE > 0
+    if (qosStreaming >= 0) {
+        // QoS 1 payload goes into its queue slot, up to the length given
+        // to beginPublish()
+        uint8_t slot = qosStreaming;
+        if (qosLength[slot] + size > qosEnd) {
+            size = qosEnd - qosLength[slot];
+        }
+        memcpy(qosSlot(slot)+qosLength[slot],buffer,size);
+        qosLength[slot] += size;
+        return size;
+    }
+#endif
+    lastOutActivity = millis();
+    return _client->write(buffer,size);
+}
+
+#if MQTT_QOS1_QUEUE_SIZE > 0
+#define QOS_SENT 0x01
+#define QOS_ACKED 0x02
+
+// Next packet id that is not in use by a queued message
+uint16_t PubSubClient::qosNextMsgId() {
+    for (;;) {
+        nextMsgId++;
+        if (nextMsgId == 0) {
+            nextMsgId = 1;
+        }
+        uint8_t i;
+        for (i=0;i<qosCount;i++) {
+            if (qosMsgId[(qosHead+i)%MQTT_QOS1_QUEUE_SIZE] == nextMsgId) {
+                break;
+            }
+        }
+        if (i == qosCount) {
+            return nextMsgId;
+        }
+    }
+}
+
+// Reserves the next queue slot and writes the packet header, topic and packet
+// id into it. Returns the slot, or -1 if the queue is full or the packet too
+// long. It never waits for PUBACKs to free a slot: the caller decides what to
+// do with a message that does not fit
+int16_t PubSubClient::qosBegin(const char* topic, unsigned int plength, boolean retained) {
+    if (qosCount == 0 && qosSlotSize != bufferSize) {
+        // Slots as large as the buffer, resized only while none is in use
+        free(qosPacket);
+        qosPacket = (uint8_t*) malloc((size_t)MQTT_QOS1_QUEUE_SIZE*bufferSize);
+        qosSlotSize = (qosPacket != NULL) ? bufferSize : 0;
+    }
+    if (qosSlotSize < MQTT_MAX_HEADER_SIZE + 2+strlen(topic) + 2 + plength) {
+        // Too long
+        return -1;
+    }
+    if (qosCount == MQTT_QOS1_QUEUE_SIZE) {
+        return -1;
+    }
+
+    uint8_t slot = (qosHead+qosCount)%MQTT_QOS1_QUEUE_SIZE;
+    uint8_t* buf = qosSlot(slot);
+    uint16_t length = MQTT_MAX_HEADER_SIZE;
+    length = writeString(topic,buf,length);
+    uint16_t msgId = qosNextMsgId();
+    buf[length++] = (msgId >> 8);
+    buf[length++] = (msgId & 0xFF);
+
+    uint8_t header = MQTTPUBLISH|MQTTQOS1;
+    if (retained) {
+        header |= 1;
+    }
+    size_t hlen = buildHeader(header,buf,length-MQTT_MAX_HEADER_SIZE+plength);
+    qosStart[slot] = MQTT_MAX_HEADER_SIZE-hlen;
+    qosLength[slot] = length;
+    qosMsgId[slot] = msgId;
+    qosFlags[slot] = 0;
+    qosStreaming = slot;
+    qosEnd = length+plength;
+    return slot;
+}
+
+// Adds the slot filled since qosBegin() to the queue. A slot with less
+// payload than announced would not be a valid packet: it is dropped
+boolean PubSubClient::qosCommit() {
+    uint8_t slot = qosStreaming;
+    qosStreaming = -1;
+    if (qosLength[slot] != qosEnd) {
+        return false;
+    }
+    qosCount++;
+    qosSend();
+    return true;
+}
+
+// Sends queued messages while the in-flight window has room
+void PubSubClient::qosSend() {
+    if (!connected()) {
+        return;
+    }
+    for (uint8_t i=0;i<qosCount && qosInflight<MQTT_MAX_INFLIGHT;i++) {
+        uint8_t slot = (qosHead+i)%MQTT_QOS1_QUEUE_SIZE;
+        if (qosFlags[slot] & (QOS_SENT|QOS_ACKED)) {
+            continue;
+        }
+        uint8_t* buf = qosSlot(slot)+qosStart[slot];
+        uint16_t length = qosLength[slot]-qosStart[slot];
+        if (_client->write(buf,length) != length) {
+            return;
+        }
+        lastOutActivity = millis();
+        qosFlags[slot] |= QOS_SENT;
+        qosInflight++;
+    }
+}
+
+void PubSubClient::qosAck(uint16_t msgId) {
+    for (uint8_t i=0;i<qosCount;i++) {
+        uint8_t slot = (qosHead+i)%MQTT_QOS1_QUEUE_SIZE;
+        if (qosMsgId[slot] == msgId && (qosFlags[slot] & QOS_SENT)) {
+            qosFlags[slot] = QOS_ACKED;
+            qosInflight--;
+            acked++;
+            break;
+        }
+    }
+    // Free acknowledged messages from the front, the rest keep their order
+    while (qosCount > 0 && (qosFlags[qosHead] & QOS_ACKED)) {
+        qosHead = (qosHead+1)%MQTT_QOS1_QUEUE_SIZE;
+        qosCount--;
+    }
+    qosSend();
+}
+
+// After a reconnect: everything not acknowledged is sent again, with the DUP
+// flag on the messages that were already sent once
+void PubSubClient::qosResend() {
+    for (uint8_t i=0;i<qosCount;i++) {
+        uint8_t slot = (qosHead+i)%MQTT_QOS1_QUEUE_SIZE;
+        if (qosFlags[slot] & QOS_SENT) {
+            qosSlot(slot)[qosStart[slot]] |= 0x08;
+            qosFlags[slot] &= ~QOS_SENT;
+            resent++;
+        }
+    }
+    qosInflight = 0;
+    qosSend();
+}
+#else
+// Built without a queue: QoS 1 messages are refused
+int16_t PubSubClient::qosBegin(const char*, unsigned int, boolean) {
+    return -1;
+}
+
+boolean PubSubClient::qosCommit() {
+    qosStreaming = -1;
+    return false;
+}
+
+void PubSubClient::qosAck(uint16_t) {
+}
+
+void PubSubClient::qosResend() {
+}
+#endif
+
+uint8_t PubSubClient::queued() {
+    return qosCount;
+}
+
+uint8_t PubSubClient::inflight() {
+    return qosInflight;
+}
+
+// Writes the fixed header ending at buf[MQTT_MAX_HEADER_SIZE-1] and
+// returns its size
+size_t PubSubClient::buildHeader(uint8_t header, uint8_t* buf, uint16_t length) {
     uint8_t lenBuf[4];
     uint8_t llen = 0;
     uint8_t digit;
     uint8_t pos = 0;
-    uint16_t rc;
     uint16_t len = length;
     do {
         digit = len % 128;
@@ -440,8 +798,14 @@ boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
 
     buf[4-llen] = header;
     for (int i=0;i<llen;i++) {
-        buf[5-llen+i] = lenBuf[i];
+        buf[MQTT_MAX_HEADER_SIZE-llen+i] = lenBuf[i];
     }
+    return llen+1; // Full header size is variable length bit plus the 1-byte fixed header
+}
+
+boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
+    uint16_t rc;
+    uint8_t llen = buildHeader(header, buf, length) - 1;
 
 #ifdef MQTT_MAX_TRANSFER_SIZE
     uint8_t* writeBuf = buf+(4-llen);
@@ -471,7 +835,7 @@ boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
     if (qos < 0 || qos > 1) {
         return false;
     }
-    if (MQTT_MAX_PACKET_SIZE < 9 + strlen(topic)) {
+    if (bufferSize < 9 + strlen(topic)) {
         // Too long
         return false;
     }
@@ -492,7 +856,7 @@ boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
 }
 
 boolean PubSubClient::unsubscribe(const char* topic) {
-    if (MQTT_MAX_PACKET_SIZE < 9 + strlen(topic)) {
+    if (bufferSize < 9 + strlen(topic)) {
         // Too long
         return false;
     }
@@ -583,6 +947,42 @@ PubSubClient& PubSubClient::setStream(Stream& stream){
     return *this;
 }
 
+PubSubClient& PubSubClient::setChunkCallback(MQTT_CHUNK_CALLBACK_SIGNATURE) {
+    this->chunkCallback = chunkCallback;
+    return *this;
+}
+
+boolean PubSubClient::setBufferSize(uint16_t size) {
+    if (size < MQTT_MIN_BUFFER_SIZE) {
+        return false;
+    }
+    uint8_t* newBuffer = (uint8_t*) (bufferOwned ? realloc(buffer,size) : malloc(size));
+    if (newBuffer == NULL) {
+        return false;
+    }
+    buffer = newBuffer;
+    bufferSize = size;
+    bufferOwned = true;
+    return true;
+}
+
+boolean PubSubClient::setBuffer(uint8_t* buf, uint16_t size) {
+    if (buf == NULL || size < MQTT_MIN_BUFFER_SIZE) {
+        return false;
+    }
+    if (bufferOwned) {
+        free(buffer);
+    }
+    buffer = buf;
+    bufferSize = size;
+    bufferOwned = false;
+    return true;
+}
+
+uint16_t PubSubClient::getBufferSize() {
+    return bufferSize;
+}
+
 int PubSubClient::state() {
     return this->_state;
 }
@@ -21,7 +21,8 @@
 #define MQTT_VERSION MQTT_VERSION_3_1_1
 #endif
 
-// MQTT_MAX_PACKET_SIZE : Maximum packet size
+// MQTT_MAX_PACKET_SIZE : Maximum packet size. Default size of the packet
+//  buffer, which can be changed at runtime with setBufferSize() or setBuffer()
 #ifndef MQTT_MAX_PACKET_SIZE
 #define MQTT_MAX_PACKET_SIZE 128
 #endif
@@ -36,6 +37,21 @@
 #define MQTT_SOCKET_TIMEOUT 15
 #endif
 
+// MQTT_MAX_INFLIGHT : QoS 1 messages sent and not yet acknowledged.
+//  Publishing does not wait for each PUBACK, up to this many are pipelined
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 4
+#endif
+
+// MQTT_QOS1_QUEUE_SIZE : QoS 1 messages kept until acknowledged, in flight or
+//  waiting for the window or a connection. Each one takes the size of the
+//  packet buffer, allocated from the heap on the first QoS 1 publish, so keep
+//  it small on an ESP8266. Set to 0 to leave the queue, and QoS 1 publishing,
+//  out of the build
+#ifndef MQTT_QOS1_QUEUE_SIZE
+#define MQTT_QOS1_QUEUE_SIZE 8
+#endif
+
 // MQTT_MAX_TRANSFER_SIZE : limit how much data is passed to the network client
 //  in each write call. Needed for the Arduino Wifi Shield. Leave undefined to
 //  pass the entire MQTT packet in each write call.
@@ -73,27 +89,65 @@
 #define MQTTQOS1        (1 << 1)
 #define MQTTQOS2        (2 << 1)
 
+// Maximum size of fixed header and variable length size header
+#define MQTT_MAX_HEADER_SIZE 5
+
+// Smallest buffer: readPacket() stores the fixed header and, of a PUBLISH,
+// the topic length before it checks any size
+#define MQTT_MIN_BUFFER_SIZE (MQTT_MAX_HEADER_SIZE + 2)
+
 #ifdef ESP8266
 #include <functional>
 #define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+#define MQTT_CHUNK_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int, unsigned int, unsigned int)> chunkCallback
 #else
 #define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+#define MQTT_CHUNK_CALLBACK_SIGNATURE void (*chunkCallback)(char*, uint8_t*, unsigned int, unsigned int, unsigned int)
 #endif
 
-class PubSubClient {
+class PubSubClient : public Print {
 private:
    Client* _client;
-   uint8_t buffer[MQTT_MAX_PACKET_SIZE];
+   uint8_t* buffer = NULL;
+   uint16_t bufferSize = 0;
+   boolean bufferOwned = false;                // allocated by setBufferSize()
    uint16_t nextMsgId;
    unsigned long lastOutActivity;
    unsigned long lastInActivity;
    bool pingOutstanding;
    MQTT_CALLBACK_SIGNATURE;
+   MQTT_CHUNK_CALLBACK_SIGNATURE = NULL;
+   boolean chunked = false;                    // last PUBLISH went to chunkCallback
+   uint16_t chunkedMsgId = 0;
    uint16_t readPacket(uint8_t*);
+   uint16_t readChunks(uint8_t llen, uint16_t length);
    boolean readByte(uint8_t * result);
    boolean readByte(uint8_t * result, uint16_t * index);
    boolean write(uint8_t header, uint8_t* buf, uint16_t length);
+   size_t buildHeader(uint8_t header, uint8_t* buf, uint16_t length);
    uint16_t writeString(const char* string, uint8_t* buf, uint16_t pos);
+#if MQTT_QOS1_QUEUE_SIZE > 0
+   // QoS 1 queue, oldest first; each slot holds a complete PUBLISH packet.
+   // The slots are allocated when first needed, as large as the buffer
+   uint8_t* qosPacket = NULL;
+   uint16_t qosSlotSize = 0;
+   uint8_t* qosSlot(uint8_t slot) { return qosPacket+(size_t)slot*qosSlotSize; }
+   uint16_t qosLength[MQTT_QOS1_QUEUE_SIZE];
+   uint16_t qosMsgId[MQTT_QOS1_QUEUE_SIZE];
+   uint8_t qosStart[MQTT_QOS1_QUEUE_SIZE];     // offset of the fixed header
+   uint8_t qosFlags[MQTT_QOS1_QUEUE_SIZE];
+   uint8_t qosHead = 0;
+   uint16_t qosNextMsgId();
+   void qosSend();
+#endif
+   uint8_t qosCount = 0;
+   uint8_t qosInflight = 0;
+   int16_t qosStreaming = -1;                  // slot being filled by write()
+   uint16_t qosEnd = 0;                        // its length once the payload is in
+   int16_t qosBegin(const char* topic, unsigned int plength, boolean retained);
+   boolean qosCommit();
+   void qosAck(uint16_t msgId);
+   void qosResend();
    IPAddress ip;
    const char* domain;
    uint16_t port;
@@ -114,6 +168,7 @@ public:
    PubSubClient(const char*, uint16_t, Client& client, Stream&);
    PubSubClient(const char*, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client);
    PubSubClient(const char*, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client, Stream&);
+   ~PubSubClient();
 
    PubSubClient& setServer(IPAddress ip, uint16_t port);
    PubSubClient& setServer(uint8_t * ip, uint16_t port);
@@ -121,6 +176,25 @@ public:
    PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
    PubSubClient& setClient(Client& client);
    PubSubClient& setStream(Stream& stream);
+   // Incoming PUBLISH packets too long for the buffer are handed to the chunk
+   // callback a buffer's worth at a time instead of being dropped:
+   //   chunkCallback(topic, chunk, length, offset, total)
+   // where offset is the position of the chunk in the payload of total bytes
+   PubSubClient& setChunkCallback(MQTT_CHUNK_CALLBACK_SIGNATURE);
+
+   // Replace the packet buffer, MQTT_MAX_PACKET_SIZE bytes from the heap by
+   // default, with one of size bytes from the heap. It limits publish(),
+   // incoming packets and QoS 1 messages; QoS 0 beginPublish() payloads are
+   // not limited by it. QoS 1 queue slots take the new size the next time
+   // the queue is empty.
+   // Returns false, keeping the current buffer, if it cannot be allocated.
+   // If the constructor could not allocate the default buffer,
+   // getBufferSize() is 0 and connect() fails with MQTT_CONNECT_FAILED
+   boolean setBufferSize(uint16_t size);
+   // As above with a buffer owned by the caller, e.g. a static array on
+   // boards with little heap. It must outlive the client
+   boolean setBuffer(uint8_t* buf, uint16_t size);
+   uint16_t getBufferSize();
 
    boolean connect(const char* id);
    boolean connect(const char* id, const char* user, const char* pass);
@@ -132,12 +206,44 @@ public:
    boolean publish(const char* topic, const uint8_t * payload, unsigned int plength);
    boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
    boolean publish_P(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
+   // Publish at QoS 0 or 1. A QoS 1 message is queued until the server
+   // acknowledges it, and sent again after a reconnect if it was not.
+   // Returns false at once if the queue is full or the message does not fit
+   // a slot; queued() tells how much room is left
+   boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained, uint8_t qos);
+   boolean publish(const char* topic, const char* payload, boolean retained, uint8_t qos);
+   // Start to publish a message.
+   // This API:
+   //   beginPublish(...)
+   //   one or more calls to write(...)
+   //   endPublish()
+   // Allows for arbitrarily large payloads to be sent without them having to be copied into
+   // a new buffer and held in memory at one time
+   // Returns 1 if the message was started successfully, 0 if there was an error
+   boolean beginPublish(const char* topic, unsigned int plength, boolean retained);
+   // As above at QoS 0 or 1. A QoS 1 packet must fit the buffer size
+   boolean beginPublish(const char* topic, unsigned int plength, boolean retained, uint8_t qos);
+   // Finish off this publish message (started with beginPublish)
+   // Returns 1 if the packet was sent successfully, 0 if there was an error.
+   // A QoS 1 message with less payload written than announced is dropped
+   int endPublish();
+   // Write a single byte of payload (only to be used with beginPublish/endPublish)
+   virtual size_t write(uint8_t);
+   // Write size bytes from buffer into the payload (only to be used with beginPublish/endPublish)
+   // Returns the number of bytes written
+   virtual size_t write(const uint8_t *buffer, size_t size);
    boolean subscribe(const char* topic);
    boolean subscribe(const char* topic, uint8_t qos);
    boolean unsubscribe(const char* topic);
    boolean loop();
    boolean connected();
    int state();
+   // QoS 1 messages queued, and how many of them are in flight
+   uint8_t queued();
+   uint8_t inflight();
+   // QoS 1 statistics
+   unsigned long acked = 0;        // PUBACKs matched to a queued message
+   unsigned long resent = 0;       // messages sent again after a reconnect
 };
 
 
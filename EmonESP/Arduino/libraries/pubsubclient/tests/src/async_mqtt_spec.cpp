@@ -0,0 +1,173 @@
+#include "async_mqtt.h"
+#include "ESPAsyncTCP.h"
+#include "BDDTest.h"
+#include "trace.h"
+
+// EmonESP's event driven client (EmonESP/src/async_mqtt.cpp) against a
+// stand-in AsyncClient: the spec feeds the TCP callbacks by hand
+
+bool callback_called = false;
+char lastTopic[1024];
+unsigned int lastLength;
+
+void reset_callback() {
+    callback_called = false;
+    lastTopic[0] = '\0';
+    lastLength = 0;
+}
+
+void callback(char* topic, byte* payload, unsigned int length) {
+    callback_called = true;
+    strcpy(lastTopic,topic);
+    lastLength = length;
+}
+
+// Runs CONNECT/CONNACK; the CONNECT goes out from onConnect()
+bool connect(MqttAsyncClient& client) {
+    client.setServer("localhost",1883);
+    client.setCallback(callback);
+    client.connect("client_test1",NULL,NULL);
+    byte connect[] = {0x10,0x18,0x0,0x4,0x4d,0x51,0x54,0x54,0x4,0x2,0x0,0xf,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31};
+    AsyncClient::last()->expect(connect,26);
+    client.onConnect();
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    client.onData(connack,4);
+    return client.connected();
+}
+
+int test_receive_callback() {
+    IT("receives a callback message");
+    reset_callback();
+
+    MqttAsyncClient client;
+    IS_TRUE(connect(client));
+
+    byte publish[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    client.onData(publish,16);
+
+    IS_TRUE(callback_called);
+    IS_TRUE(strcmp(lastTopic,"topic")==0);
+    IS_TRUE(lastLength == 7);
+
+    IS_FALSE(AsyncClient::last()->error());
+
+    END_IT
+}
+
+int test_receive_qos1() {
+    IT("receives a QoS 1 message and acknowledges it");
+    reset_callback();
+
+    MqttAsyncClient client;
+    IS_TRUE(connect(client));
+
+    byte puback[] = {0x40,0x2,0x12,0x34};
+    AsyncClient::last()->expect(puback,4);
+
+    byte publish[] = {0x32,0x10,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x12,0x34,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    client.onData(publish,18);
+
+    IS_TRUE(callback_called);
+    IS_TRUE(strcmp(lastTopic,"topic")==0);
+    IS_TRUE(lastLength == 7);
+
+    IS_FALSE(AsyncClient::last()->error());
+
+    END_IT
+}
+
+int test_receive_oversized_topic_length() {
+    IT("drops a message whose topic length runs past the packet");
+    reset_callback();
+
+    MqttAsyncClient client;
+    IS_TRUE(connect(client));
+    uint16_t sent = AsyncClient::last()->sent();
+
+    // Topic length 0xFFFE: 2 + tl + 2 wraps to 2 in 16 bits
+    byte qos1[] = {0x32,0x4,0xff,0xfe,0x12,0x34};
+    client.onData(qos1,6);
+    // Topic length 0x7E: the packet id would sit at rx[128..129]
+    byte qos1Short[] = {0x32,0x4,0x0,0x7e,0x12,0x34};
+    client.onData(qos1Short,6);
+    byte qos0[] = {0x30,0x4,0xff,0xff,0x61,0x62};
+    client.onData(qos0,6);
+
+    IS_FALSE(callback_called);
+    // No PUBACK for a message that was not delivered
+    IS_TRUE(AsyncClient::last()->sent() == sent);
+
+    // The next packet is parsed as usual
+    byte publish[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    client.onData(publish,16);
+    IS_TRUE(callback_called);
+    IS_TRUE(strcmp(lastTopic,"topic")==0);
+
+    IS_FALSE(AsyncClient::last()->error());
+
+    END_IT
+}
+
+int test_publish_qos1() {
+    IT("publishes at QoS 1 and frees the slot on PUBACK");
+
+    MqttAsyncClient client;
+    IS_TRUE(connect(client));
+
+    byte publish[] = {0x32,0x10,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0,0x2,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    AsyncClient::last()->expect(publish,18);
+
+    IS_TRUE(client.publish("topic","payload",false,1));
+    IS_TRUE(client.queued() == 1);
+    IS_TRUE(client.inflight() == 1);
+
+    byte puback[] = {0x40,0x2,0x0,0x2};
+    client.onData(puback,4);
+    IS_TRUE(client.queued() == 0);
+    IS_TRUE(client.inflight() == 0);
+    IS_TRUE(client.acked == 1);
+
+    IS_FALSE(AsyncClient::last()->error());
+
+    END_IT
+}
+
+int test_publish_qos1_short_write() {
+    IT("drops a streamed QoS 1 message shorter than announced");
+
+    MqttAsyncClient client;
+    IS_TRUE(connect(client));
+    uint16_t sent = AsyncClient::last()->sent();
+
+    IS_TRUE(client.beginPublish("topic",7,false,1));
+    IS_TRUE(client.write((const uint8_t*)"pay",3) == 3);
+    IS_TRUE(client.endPublish() == 0);
+    IS_TRUE(client.queued() == 0);
+    IS_TRUE(AsyncClient::last()->sent() == sent);
+
+    // Nor does a longer write overrun the announced length
+    IS_TRUE(client.beginPublish("topic",3,false,1));
+    IS_TRUE(client.write((const uint8_t*)"payload",7) == 3);
+    byte publish[] = {0x32,0xc,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0,0x3,0x70,0x61,0x79};
+    AsyncClient::last()->expect(publish,14);
+    IS_TRUE(client.endPublish() == 1);
+    IS_TRUE(client.queued() == 1);
+
+    IS_FALSE(AsyncClient::last()->error());
+
+    END_IT
+}
+
+int main()
+{
+    SUITE("Async receive");
+    test_receive_callback();
+    test_receive_qos1();
+    test_receive_oversized_topic_length();
+
+    SUITE("Async QoS 1");
+    test_publish_qos1();
+    test_publish_qos1_short_write();
+
+    FINISH
+}
@@ -0,0 +1,390 @@
+#include "PubSubClient.h"
+#include "ShimClient.h"
+#include "Buffer.h"
+#include "BDDTest.h"
+#include "trace.h"
+
+
+byte server[] = { 172, 16, 0, 2 };
+
+bool callback_called = false;
+char lastTopic[1024];
+char lastPayload[1024];
+unsigned int lastLength;
+
+int chunks;
+bool chunk_error;
+
+void reset_callback() {
+    callback_called = false;
+    lastTopic[0] = '\0';
+    lastPayload[0] = '\0';
+    lastLength = 0;
+    chunks = 0;
+    chunk_error = false;
+}
+
+void callback(char* topic, byte* payload, unsigned int length) {
+    callback_called = true;
+    strcpy(lastTopic,topic);
+    memcpy(lastPayload,payload,length);
+    lastLength = length;
+}
+
+// Reassembles the payload; chunks must arrive in order
+void chunk_callback(char* topic, byte* chunk, unsigned int length, unsigned int offset, unsigned int total) {
+    if (offset != lastLength || offset + length > total) {
+        chunk_error = true;
+    }
+    strcpy(lastTopic,topic);
+    memcpy(lastPayload+offset,chunk,length);
+    lastLength = offset + length;
+    chunks++;
+}
+
+// PUBLISH "topic" with a payload of length bytes 'a'..'z', at QoS 1 with
+// packet id 0x1234 if qos1. Returns the packet length
+int publish_packet(byte* packet, int length, bool qos1) {
+    int remaining = 2 + 5 + (qos1 ? 2 : 0) + length;
+    int pos = 0;
+    packet[pos++] = qos1 ? 0x32 : 0x30;
+    packet[pos++] = (remaining % 128) | (remaining > 127 ? 0x80 : 0);
+    if (remaining > 127) {
+        packet[pos++] = remaining / 128;
+    }
+    packet[pos++] = 0x0;
+    packet[pos++] = 0x5;
+    memcpy(packet+pos,"topic",5);
+    pos += 5;
+    if (qos1) {
+        packet[pos++] = 0x12;
+        packet[pos++] = 0x34;
+    }
+    for (int i = 0; i < length; i++) {
+        packet[pos++] = 'a' + i % 26;
+    }
+    return pos;
+}
+
+int test_default_size() {
+    IT("allocates MQTT_MAX_PACKET_SIZE bytes by default");
+    ShimClient shimClient;
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_TRUE(client.getBufferSize() == MQTT_MAX_PACKET_SIZE);
+
+    END_IT
+}
+
+int test_reject_small_size() {
+    IT("keeps the buffer when the new size is too small");
+    ShimClient shimClient;
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_FALSE(client.setBufferSize(2));
+    IS_TRUE(client.getBufferSize() == MQTT_MAX_PACKET_SIZE);
+
+    // A PUBLISH puts 5 header and 2 topic length bytes in the buffer
+    // before any size check
+    IS_FALSE(client.setBufferSize(MQTT_MAX_HEADER_SIZE));
+    IS_FALSE(client.setBufferSize(6));
+    IS_TRUE(client.getBufferSize() == MQTT_MAX_PACKET_SIZE);
+
+    byte buf[6];
+    IS_FALSE(client.setBuffer(buf,sizeof(buf)));
+    IS_FALSE(client.setBuffer(NULL,64));
+    IS_TRUE(client.getBufferSize() == MQTT_MAX_PACKET_SIZE);
+
+    IS_TRUE(client.setBufferSize(7));
+    IS_TRUE(client.getBufferSize() == 7);
+
+    END_IT
+}
+
+int test_connect_too_long() {
+    IT("fails to connect when CONNECT does not fit the buffer");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_TRUE(client.setBufferSize(24));
+    int rc = client.connect((char*)"client_test1");
+    IS_FALSE(rc);
+    IS_TRUE(client.state() == MQTT_CONNECT_FAILED);
+    IS_TRUE(shimClient.received() == 0);
+
+    END_IT
+}
+
+int test_publish_larger_buffer() {
+    IT("publishes a message longer than the default buffer after setBufferSize");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_TRUE(client.setBufferSize(512));
+    IS_TRUE(client.getBufferSize() == 512);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[300];
+    memset(payload,'x',sizeof(payload));
+
+    // Remaining length 307: 0xb3 0x02
+    byte publish[310] = {0x30,0xb3,0x2,0x0,0x5,0x74,0x6f,0x70,0x69,0x63};
+    memcpy(publish+10,payload,300);
+    shimClient.expect(publish,310);
+
+    rc = client.publish((char*)"topic",payload,300);
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_smaller_buffer() {
+    IT("limits publish to a smaller buffer");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_TRUE(client.setBufferSize(32));
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[21];
+    memset(payload,'x',sizeof(payload));
+
+    rc = client.publish((char*)"topic",payload,21);
+    IS_FALSE(rc);
+    rc = client.publish((char*)"topic",payload,20);
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_buffer_size() {
+    IT("sizes QoS 1 queue slots to the buffer");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[300];
+    memset(payload,'x',sizeof(payload));
+
+    rc = client.publish((char*)"topic",payload,sizeof(payload),false,1);
+    IS_FALSE(rc);
+
+    IS_TRUE(client.setBufferSize(512));
+    rc = client.publish((char*)"topic",payload,sizeof(payload),false,1);
+    IS_TRUE(rc);
+    IS_TRUE(client.queued() == 1);
+    // CONNECT, then the PUBLISH with a remaining length of 309
+    IS_TRUE(shimClient.received() == 26 + 312);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_caller_buffer() {
+    IT("uses a buffer provided by the caller");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    byte buf[64];
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_TRUE(client.setBuffer(buf,sizeof(buf)));
+    IS_TRUE(client.getBufferSize() == 64);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    shimClient.expect(publish,16);
+
+    rc = client.publish((char*)"topic",(char*)"payload");
+    IS_TRUE(rc);
+    IS_TRUE(memcmp(buf+3,publish,16) == 0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_chunks() {
+    IT("hands an oversized message to the chunk callback");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setChunkCallback(chunk_callback);
+    IS_TRUE(client.setBufferSize(32));
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte packet[128];
+    int length = publish_packet(packet,100,false);
+    shimClient.respond(packet,length);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    IS_FALSE(callback_called);
+    IS_FALSE(chunk_error);
+    // 32 byte buffer less header and topic: 23 bytes per chunk
+    IS_TRUE(chunks == 5);
+    IS_TRUE(strcmp(lastTopic,"topic") == 0);
+    IS_TRUE(lastLength == 100);
+    IS_TRUE(memcmp(lastPayload,packet+length-100,100) == 0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_chunks_qos1() {
+    IT("acknowledges an oversized qos1 message handed to the chunk callback");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setChunkCallback(chunk_callback);
+    IS_TRUE(client.setBufferSize(32));
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte packet[256];
+    int length = publish_packet(packet,200,true);
+    shimClient.respond(packet,length);
+
+    byte puback[] = {0x40,0x2,0x12,0x34};
+    shimClient.expect(puback,4);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    IS_FALSE(chunk_error);
+    IS_TRUE(strcmp(lastTopic,"topic") == 0);
+    IS_TRUE(lastLength == 200);
+    IS_TRUE(memcmp(lastPayload,packet+length-200,200) == 0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_small_with_chunk_callback() {
+    IT("uses the normal callback for messages that fit");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setChunkCallback(chunk_callback);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte packet[128];
+    int length = publish_packet(packet,7,false);
+    shimClient.respond(packet,length);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    IS_TRUE(callback_called);
+    IS_TRUE(chunks == 0);
+    IS_TRUE(strcmp(lastTopic,"topic") == 0);
+    IS_TRUE(lastLength == 7);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_chunks_topic_too_long() {
+    IT("drops an oversized message whose topic does not fit");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setChunkCallback(chunk_callback);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+    IS_TRUE(client.setBufferSize(8));
+
+    // The next packet is still read from the start
+    byte packet[128];
+    int length = publish_packet(packet,50,false);
+    shimClient.respond(packet,length);
+    byte pingreq[] = {0xc0,0x0};
+    shimClient.respond(pingreq,2);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_TRUE(chunks == 0);
+    IS_FALSE(callback_called);
+
+    byte pingresp[] = {0xd0,0x0};
+    shimClient.expect(pingresp,2);
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int main()
+{
+    SUITE("Buffer");
+    test_default_size();
+    test_reject_small_size();
+    test_connect_too_long();
+    test_publish_larger_buffer();
+    test_publish_smaller_buffer();
+    test_publish_qos1_buffer_size();
+    test_caller_buffer();
+    test_receive_chunks();
+    test_receive_chunks_qos1();
+    test_receive_small_with_chunk_callback();
+    test_receive_chunks_topic_too_long();
+
+    FINISH
+}
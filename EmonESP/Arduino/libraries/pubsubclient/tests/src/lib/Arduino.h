@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include "Print.h"
 
 
 extern "C"{
@@ -15,8 +16,17 @@ extern "C"{
     extern void setup( void ) ;
     extern void loop( void ) ;
     uint32_t millis( void );
+    uint32_t micros( void );
+    size_t strlcpy(char* dst, const char* src, size_t size);
 }
 
+// The rest of the core that the EmonESP sources under test use
+#include "WString.h"
+#include "Esp.h"
+#include "HardwareSerial.h"
+
+template<typename T> T min(T a, T b) { return a < b ? a : b; }
+
 #define PROGMEM
 #define pgm_read_byte_near(x) *(x)
 
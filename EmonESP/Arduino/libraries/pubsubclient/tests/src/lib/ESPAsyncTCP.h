@@ -0,0 +1,69 @@
+#ifndef espasynctcp_h
+#define espasynctcp_h
+
+// Stand-in for ESPAsyncTCP's AsyncClient: connect() succeeds at once,
+// the test delivers the callbacks itself and write() checks the bytes
+// against the expected ones, as ShimClient does. The client under test
+// creates its own AsyncClient; the test reaches it through last()
+
+#include "Arduino.h"
+#include "Buffer.h"
+
+class AsyncClient;
+
+typedef void (*AcConnectHandler)(void*, AsyncClient*);
+typedef void (*AcDataHandler)(void*, AsyncClient*, void* data, size_t len);
+typedef void (*AcAckHandler)(void*, AsyncClient*, size_t len, uint32_t time);
+
+class AsyncClient {
+private:
+    Buffer* expectBuffer;
+    bool _connected;
+    bool _error;
+    uint16_t _sent;
+
+public:
+    AsyncClient() {
+        expectBuffer = new Buffer();
+        _connected = false;
+        _error = false;
+        _sent = 0;
+        last() = this;
+    }
+
+    static AsyncClient*& last() {
+        static AsyncClient* client = NULL;
+        return client;
+    }
+
+    void onConnect(AcConnectHandler, void*) {}
+    void onData(AcDataHandler, void*) {}
+    void onDisconnect(AcConnectHandler, void*) {}
+    void onAck(AcAckHandler, void*) {}
+
+    bool connect(const char*, uint16_t) { _connected = true; return true; }
+    void close(bool now = false) { _connected = false; }
+    bool connected() { return _connected; }
+    bool freeable() { return !_connected; }
+    bool canSend() { return _connected; }
+    size_t space() { return 1024; }
+
+    size_t write(const char* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            if (!expectBuffer->available() || expectBuffer->next() != (uint8_t)data[i]) {
+                _error = true;
+            }
+        }
+        _sent += size;
+        return size;
+    }
+
+    AsyncClient* expect(uint8_t* buf, size_t size) {
+        expectBuffer->add(buf, size);
+        return this;
+    }
+    uint16_t sent() { return _sent; }
+    bool error() { return _error; }
+};
+
+#endif
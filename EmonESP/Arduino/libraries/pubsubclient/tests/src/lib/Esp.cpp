@@ -0,0 +1,51 @@
+#include "Arduino.h"
+#include "trace.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+EspClass ESP;
+HardwareSerial Serial;
+
+extern "C" {
+    uint32_t micros(void) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+
+    size_t strlcpy(char* dst, const char* src, size_t size) {
+        size_t len = strlen(src);
+        if (size > 0) {
+            size_t n = len < size - 1 ? len : size - 1;
+            memcpy(dst, src, n);
+            dst[n] = 0;
+        }
+        return len;
+    }
+}
+
+void HardwareSerial::print(const char* s) {
+    TRACE(s);
+}
+
+void HardwareSerial::print(int n) {
+    TRACE(n);
+}
+
+void HardwareSerial::println(const char* s) {
+    TRACE(s << "\n");
+}
+
+void HardwareSerial::println(int n) {
+    TRACE(n << "\n");
+}
+
+void HardwareSerial::printf(const char* format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    TRACE(buf);
+}
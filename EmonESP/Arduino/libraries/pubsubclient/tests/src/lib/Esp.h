@@ -0,0 +1,14 @@
+#ifndef esp_h
+#define esp_h
+
+#include <stdint.h>
+
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return 30000; }
+    uint32_t getChipId() { return 1234; }
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef hardwareserial_h
+#define hardwareserial_h
+
+// Debug output, printed only with TRACE set as in trace.h
+
+class HardwareSerial {
+public:
+    void print(const char* s);
+    void print(int n);
+    void println(const char* s = "");
+    void println(int n);
+    void printf(const char* format, ...);
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef Print_h
+#define Print_h
+
+class Print {
+    public:
+        virtual size_t write(uint8_t) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size) {
+            size_t n = 0;
+            while (size--) {
+                n += write(*buffer++);
+            }
+            return n;
+        }
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef wstring_h
+#define wstring_h
+
+// The little of Arduino's String that EmonESP's mqtt.cpp uses
+
+#include <string>
+
+class String {
+private:
+    std::string s;
+
+public:
+    String(const char* cstr = "") : s(cstr) {}
+    const char* c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    bool operator==(const char* cstr) const { return s == cstr; }
+    bool operator!=(const char* cstr) const { return s != cstr; }
+};
+
+#endif
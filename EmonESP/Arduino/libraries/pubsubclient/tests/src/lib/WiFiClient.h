@@ -0,0 +1,10 @@
+#ifndef wificlient_h
+#define wificlient_h
+
+// EmonESP's mqtt.cpp gives PubSubClient a WiFiClient: the shim stands in
+
+#include "ShimClient.h"
+
+typedef ShimClient WiFiClient;
+
+#endif
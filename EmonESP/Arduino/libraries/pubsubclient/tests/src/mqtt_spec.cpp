@@ -0,0 +1,97 @@
+#include "PubSubClient.h"
+#include "WiFiClient.h"
+#include "BDDTest.h"
+#include "trace.h"
+
+#include "mqtt.h"
+#include "config.h"
+#include "record.h"
+
+// EmonESP's mqtt.cpp on PubSubClient and the shim client: how a record
+// is published at QoS 1
+
+String mqtt_server = "localhost";
+String mqtt_topic = "emon/emonesp";
+String mqtt_user = "";
+String mqtt_pass = "";
+String mqtt_feed_prefix = "";
+String mqtt_format = MQTT_FORMAT_KEYS;
+
+void supervisor_init(Supervisor& sv, const char* name, uint8_t threshold) {}
+boolean supervisor_allow(Supervisor& sv) { return true; }
+void supervisor_success(Supervisor& sv) {}
+void supervisor_failure(Supervisor& sv) {}
+
+extern WiFiClient espClient;
+extern PubSubClient mqttclient;
+
+bool connect() {
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    espClient.respond(connack,4);
+    mqtt_topic_setup();
+    mqtt_loop();
+    return mqtt_connected();
+}
+
+void puback(uint16_t msgId) {
+    byte ack[] = {0x40,0x02,(byte)(msgId >> 8),(byte)(msgId & 0xFF)};
+    espClient.respond(ack,4);
+    mqtt_loop();
+}
+
+int test_publish_more_keys_than_slots() {
+    IT("publishes a record with more keys than QoS 1 slots in parts, never at QoS 0");
+
+    IS_TRUE(connect());
+
+    // 10 keys and freeram: 11 messages for 8 slots
+    Record rec;
+    IS_TRUE(record_parse(rec,"K0:0,K1:1,K2:2,K3:3,K4:4,K5:5,K6:6,K7:7,K8:8,K9:9"));
+    IS_TRUE(rec.count + 1 > MQTT_QOS1_QUEUE_SIZE);
+    unsigned long time = 1000;
+
+    IS_TRUE(mqtt_ready(rec,time));
+    IS_FALSE(mqtt_publish(rec,time));
+    IS_TRUE(mqtt_queued() == MQTT_QOS1_QUEUE_SIZE);
+    IS_TRUE(mqtt_inflight() == MQTT_MAX_INFLIGHT);
+    IS_TRUE(mqtt_publish_failed == 0);
+
+    // The rest waits for free slots
+    IS_FALSE(mqtt_ready(rec,time));
+    for (uint16_t id = 2; id < 2 + MQTT_MAX_INFLIGHT; id++) {
+        puback(id);
+    }
+    IS_TRUE(mqtt_queued() == MQTT_QOS1_QUEUE_SIZE - MQTT_MAX_INFLIGHT);
+
+    // 3 messages left, 4 slots free
+    IS_TRUE(mqtt_ready(rec,time));
+    IS_TRUE(mqtt_publish(rec,time));
+    IS_TRUE(mqtt_queued() == 11 - MQTT_MAX_INFLIGHT);
+    IS_TRUE(mqtt_publish_failed == 0);
+
+    // Every message was queued at QoS 1, each once
+    for (uint16_t id = 2 + MQTT_MAX_INFLIGHT; id < 2 + 11; id++) {
+        puback(id);
+    }
+    IS_TRUE(mqtt_queued() == 0);
+    IS_TRUE(mqtt_acked() == 11);
+
+    // A different record starts from its first key
+    Record next;
+    IS_TRUE(record_parse(next,"K0:0"));
+    IS_TRUE(mqtt_ready(next,time + 1));
+    IS_TRUE(mqtt_publish(next,time + 1));
+    IS_TRUE(mqtt_queued() == 2);
+
+    IS_FALSE(espClient.error());
+
+    END_IT
+}
+
+int main()
+{
+    SUITE("EmonESP MQTT");
+    test_publish_more_keys_than_slots();
+
+    FINISH
+}
@@ -0,0 +1,215 @@
+// Publish throughput benchmark
+//
+// Pushes a synthetic EcoHouse sample stream through PubSubClient into a
+// client that only counts bytes, so changes to the publish path can be
+// measured without a broker:
+//
+//   $ make bench
+//   $ bin/publish_bench [keys per sweep] [sweeps]
+//
+// Each sweep is published the four ways EmonESP can:
+//   keys     one message per key on <base>/<key>, plus freeram
+//   json     {"p1":1234.56,...} on <base>, streamed with beginPublish()
+//   compact  p1:1234.56,... on <base>, streamed with beginPublish()
+//   cbor     the json map in CBOR, with EmonESP's encoder (src/cbor.cpp)
+
+#include "PubSubClient.h"
+#include "Client.h"
+#include "IPAddress.h"
+#include "cbor.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BASE_TOPIC "emon/emonesp"
+#define MAX_KEYS   32
+#define SAMPLES    64      // distinct sweeps, formatted before timing
+
+byte server[] = { 172, 16, 0, 2 };
+
+// Accepts every connection, answers CONNECT with a CONNACK and
+// throws away and counts everything else written to it
+class CountingClient : public Client {
+public:
+    unsigned long bytes;
+    unsigned long writes;
+
+    CountingClient() : bytes(0), writes(0), _connected(false), _pending(0) {}
+
+    virtual int connect(IPAddress ip, uint16_t port) { return accept(); }
+    virtual int connect(const char *host, uint16_t port) { return accept(); }
+    virtual size_t write(uint8_t b) { return write(&b, 1); }
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        bytes += size;
+        writes++;
+        return size;
+    }
+    virtual int available() { return _pending; }
+    virtual int read() {
+        static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+        if (_pending == 0) return -1;
+        return connack[sizeof(connack) - _pending--];
+    }
+    virtual int read(uint8_t *buf, size_t size) {
+        size_t n = 0;
+        while (n < size && _pending > 0) buf[n++] = read();
+        return n;
+    }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+    virtual void stop() { _connected = false; }
+    virtual uint8_t connected() { return _connected; }
+    virtual operator bool() { return _connected; }
+
+    void reset() { bytes = 0; writes = 0; }
+
+private:
+    bool _connected;
+    int _pending;
+
+    int accept() {
+        _connected = true;
+        _pending = 4;
+        return 1;
+    }
+};
+
+void callback(char* topic, byte* payload, unsigned int length) {
+}
+
+struct Sweep {
+    int count;
+    char keys[MAX_KEYS][4];
+    char values[MAX_KEYS][14];
+};
+
+static double seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keys as the Nano sends them: powers first, then temperatures, with
+// new readings every sweep so values change width like real data
+static void sweep_init(Sweep& sweep, int keys, unsigned long n) {
+    sweep.count = keys;
+    for (int i = 0; i < keys; i++) {
+        long hundredths = (long)((n * 2654435761UL + i * 40503UL) % 500000UL);
+        snprintf(sweep.values[i], sizeof(sweep.values[i]), "%ld.%02ld", hundredths / 100, hundredths % 100);
+        if (i < keys * 2 / 3) {
+            snprintf(sweep.keys[i], sizeof(sweep.keys[i]), "p%d", i + 1);
+        } else {
+            snprintf(sweep.keys[i], sizeof(sweep.keys[i]), "t%d", i + 1 - keys * 2 / 3);
+        }
+    }
+}
+
+static size_t single_write(PubSubClient& client, const Sweep& sweep, bool json, bool send) {
+    const char* quote = json ? "\"" : "";
+    size_t len = 0;
+    if (json) {
+        if (send) client.write('{');
+        len++;
+    }
+    for (int i = 0; i < sweep.count; i++) {
+        const char* parts[] = { i == 0 ? "" : ",", quote, sweep.keys[i], quote, ":", sweep.values[i] };
+        for (size_t p = 0; p < sizeof(parts) / sizeof(parts[0]); p++) {
+            size_t n = strlen(parts[p]);
+            if (send && n > 0) client.write((const uint8_t*)parts[p], n);
+            len += n;
+        }
+    }
+    if (json) {
+        if (send) client.write('}');
+        len++;
+    }
+    return len;
+}
+
+static size_t cbor_write(PubSubClient& client, const Sweep& sweep, bool send) {
+    CborWriter w;
+    cbor_begin(w, send ? &client : NULL);
+    cbor_map(w, sweep.count);
+    for (int i = 0; i < sweep.count; i++) {
+        cbor_text(w, sweep.keys[i]);
+        cbor_number(w, sweep.values[i]);
+    }
+    return w.length;
+}
+
+enum { MODE_KEYS, MODE_JSON, MODE_COMPACT, MODE_CBOR };
+
+static int publish_sweep(PubSubClient& client, const Sweep& sweep, int mode, char* topic, size_t base) {
+    if (mode == MODE_KEYS) {
+        for (int i = 0; i < sweep.count; i++) {
+            strcpy(topic + base, sweep.keys[i]);
+            client.publish(topic, sweep.values[i]);
+        }
+        strcpy(topic + base, "freeram");
+        client.publish(topic, "21000");
+        return sweep.count + 1;
+    }
+
+    topic[base - 1] = '\0';
+    if (mode == MODE_CBOR) {
+        client.beginPublish(topic, cbor_write(client, sweep, false), false);
+        cbor_write(client, sweep, true);
+        client.endPublish();
+        topic[base - 1] = '/';
+        return 1;
+    }
+
+    bool json = mode == MODE_JSON;
+    client.beginPublish(topic, single_write(client, sweep, json, false), false);
+    single_write(client, sweep, json, true);
+    client.endPublish();
+    topic[base - 1] = '/';
+    return 1;
+}
+
+static void run(const char* name, int mode, int keys, unsigned long sweeps) {
+    CountingClient net;
+    PubSubClient client(server, 1883, callback, net);
+    client.connect("bench");
+    net.reset();
+
+    static Sweep samples[SAMPLES];
+    for (int n = 0; n < SAMPLES; n++) {
+        sweep_init(samples[n], keys, n);
+    }
+
+    char topic[64] = BASE_TOPIC "/";
+    size_t base = strlen(topic);
+
+    unsigned long publishes = 0;
+    double wall = seconds(CLOCK_MONOTONIC);
+    double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+    for (unsigned long n = 0; n < sweeps; n++) {
+        publishes += publish_sweep(client, samples[n % SAMPLES], mode, topic, base);
+    }
+    cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    wall = seconds(CLOCK_MONOTONIC) - wall;
+
+    printf("%-8s %10.0f %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+           publishes / wall, sweeps / wall,
+           (double)net.bytes / sweeps, (double)net.bytes / (sweeps * keys),
+           cpu * 1e9 / publishes, cpu * 1e9 / sweeps, (double)net.writes / publishes);
+}
+
+int main(int argc, char** argv) {
+    int keys = argc > 1 ? atoi(argv[1]) : 10;
+    unsigned long sweeps = argc > 2 ? strtoul(argv[2], NULL, 10) : 200000;
+    if (keys < 1 || keys > MAX_KEYS) {
+        fprintf(stderr, "keys per sweep must be 1-%d\n", MAX_KEYS);
+        return 1;
+    }
+
+    printf("%d keys per sweep, %lu sweeps, topic " BASE_TOPIC "/<key>\n\n", keys, sweeps);
+    printf("%-8s %10s %10s %10s %10s %10s %10s %10s\n",
+           "mode", "publish/s", "sweep/s", "B/sweep", "B/key", "ns/publish", "ns/sweep", "writes/pub");
+    run("keys", MODE_KEYS, keys, sweeps);
+    run("json", MODE_JSON, keys, sweeps);
+    run("compact", MODE_COMPACT, keys, sweeps);
+    run("cbor", MODE_CBOR, keys, sweeps);
+    return 0;
+}
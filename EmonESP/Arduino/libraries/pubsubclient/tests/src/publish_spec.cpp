@@ -172,7 +172,80 @@ int test_publish_P() {
     END_IT
 }
 
+int test_publish_stream() {
+    IT("publishes using beginPublish/write/endPublish");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    shimClient.expect(publish,16);
+
+    rc = client.beginPublish((char*)"topic",7,false);
+    IS_TRUE(rc);
+    IS_TRUE(client.write((const uint8_t*)"pay",3) == 3);
+    IS_TRUE(client.write('l') == 1);
+    IS_TRUE(client.write((const uint8_t*)"oad",3) == 3);
+    rc = client.endPublish();
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_stream_too_long() {
+    IT("publishes a payload longer than the buffer using beginPublish");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[200];
+    for (int i = 0; i < 200; i++) {
+        payload[i] = i;
+    }
+
+    // Remaining length 207 needs two bytes: 0xcf 0x01
+    byte publish[210] = {0x31,0xcf,0x1,0x0,0x5,0x74,0x6f,0x70,0x69,0x63};
+    memcpy(publish+10,payload,200);
+    shimClient.expect(publish,210);
 
+    rc = client.beginPublish((char*)"topic",200,true);
+    IS_TRUE(rc);
+    IS_TRUE(client.write(payload,200) == 200);
+    rc = client.endPublish();
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_stream_not_connected() {
+    IT("beginPublish fails when not connected");
+    ShimClient shimClient;
+
+    PubSubClient client(server, 1883, callback, shimClient);
+
+    int rc = client.beginPublish((char*)"topic",7,false);
+    IS_FALSE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
 
 
 int main()
@@ -185,6 +258,9 @@ int main()
     test_publish_not_connected();
     test_publish_too_long();
     test_publish_P();
+    test_publish_stream();
+    test_publish_stream_too_long();
+    test_publish_stream_not_connected();
 
     FINISH
 }
@@ -0,0 +1,348 @@
+#include "PubSubClient.h"
+#include "ShimClient.h"
+#include "Buffer.h"
+#include "BDDTest.h"
+#include "trace.h"
+
+
+byte server[] = { 172, 16, 0, 2 };
+
+void callback(char* topic, byte* payload, unsigned int length) {
+    // handle message arrived
+}
+
+// PUBLISH "topic" = "payload" at QoS 1 with the given packet id
+void qos1_packet(byte* packet, uint16_t msgId, bool dup) {
+    byte publish[] = {0x32,0x10,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0,0x0,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    memcpy(packet,publish,18);
+    if (dup) {
+        packet[0] |= 0x08;
+    }
+    packet[9] = msgId >> 8;
+    packet[10] = msgId & 0xFF;
+}
+
+void puback(ShimClient& shimClient, uint16_t msgId) {
+    byte ack[] = {0x40,0x02,(byte)(msgId >> 8),(byte)(msgId & 0xFF)};
+    shimClient.respond(ack,4);
+}
+
+int test_publish_qos1() {
+    IT("publishes at QoS 1 and frees the message on PUBACK");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[18];
+    qos1_packet(publish,2,false);
+    shimClient.expect(publish,18);
+
+    rc = client.publish((char*)"topic",(char*)"payload",false,1);
+    IS_TRUE(rc);
+    IS_TRUE(client.queued() == 1);
+    IS_TRUE(client.inflight() == 1);
+
+    puback(shimClient,2);
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_TRUE(client.queued() == 0);
+    IS_TRUE(client.inflight() == 0);
+    IS_TRUE(client.acked == 1);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_window() {
+    IT("pipelines up to MQTT_MAX_INFLIGHT messages before waiting for PUBACK");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[18];
+    for (int i = 0; i < MQTT_MAX_INFLIGHT + 1; i++) {
+        qos1_packet(publish,2+i,false);
+        shimClient.expect(publish,18);
+    }
+
+    for (int i = 0; i < MQTT_MAX_INFLIGHT + 1; i++) {
+        rc = client.publish((char*)"topic",(char*)"payload",false,1);
+        IS_TRUE(rc);
+    }
+    IS_TRUE(client.queued() == MQTT_MAX_INFLIGHT + 1);
+    IS_TRUE(client.inflight() == MQTT_MAX_INFLIGHT);
+    // CONNECT, then only the first MQTT_MAX_INFLIGHT messages
+    IS_TRUE(shimClient.received() == 26 + 18 * MQTT_MAX_INFLIGHT);
+
+    // The first PUBACK opens the window for the last message
+    puback(shimClient,2);
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_TRUE(client.queued() == MQTT_MAX_INFLIGHT);
+    IS_TRUE(client.inflight() == MQTT_MAX_INFLIGHT);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_out_of_order() {
+    IT("keeps the queue order when PUBACKs arrive out of order");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    client.publish((char*)"topic",(char*)"payload",false,1);
+    client.publish((char*)"topic",(char*)"payload",false,1);
+
+    puback(shimClient,3);
+    client.loop();
+    IS_TRUE(client.queued() == 2);
+    IS_TRUE(client.inflight() == 1);
+
+    puback(shimClient,2);
+    client.loop();
+    IS_TRUE(client.queued() == 0);
+    IS_TRUE(client.inflight() == 0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_queue_full() {
+    IT("rejects QoS 1 messages when the queue is full");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+
+    for (int i = 0; i < MQTT_QOS1_QUEUE_SIZE; i++) {
+        int rc = client.publish((char*)"topic",(char*)"payload",false,1);
+        IS_TRUE(rc);
+    }
+    int rc = client.publish((char*)"topic",(char*)"payload",false,1);
+    IS_FALSE(rc);
+    IS_TRUE(client.queued() == MQTT_QOS1_QUEUE_SIZE);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_queue_full_connected() {
+    IT("fails at once when the queue is full instead of waiting for PUBACKs");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    for (int i = 0; i < MQTT_QOS1_QUEUE_SIZE; i++) {
+        rc = client.publish((char*)"topic",(char*)"payload",false,1);
+        IS_TRUE(rc);
+    }
+    IS_TRUE(client.inflight() == MQTT_MAX_INFLIGHT);
+
+    unsigned long start = millis();
+    rc = client.publish((char*)"topic",(char*)"payload",false,1);
+    IS_FALSE(rc);
+    IS_TRUE(millis() - start < 1000);
+    IS_TRUE(client.queued() == MQTT_QOS1_QUEUE_SIZE);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_too_long() {
+    IT("rejects QoS 1 messages that do not fit a queue slot");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+
+    byte payload[MQTT_MAX_PACKET_SIZE] = { 0 };
+    int rc = client.publish((char*)"topic",payload,MQTT_MAX_PACKET_SIZE - 11,false,1);
+    IS_FALSE(rc);
+    rc = client.publish((char*)"topic",payload,MQTT_MAX_PACKET_SIZE - 14,false,1);
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_offline() {
+    IT("queues QoS 1 messages while disconnected and sends them on connect");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+
+    int rc = client.publish((char*)"topic",(char*)"payload",false,1);
+    IS_TRUE(rc);
+    IS_TRUE(client.queued() == 1);
+    IS_TRUE(client.inflight() == 0);
+    IS_TRUE(shimClient.received() == 0);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+    rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+    IS_TRUE(client.inflight() == 1);
+    IS_TRUE(client.resent == 0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_resend() {
+    IT("resends unacknowledged messages with DUP after a reconnect");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    rc = client.publish((char*)"topic",(char*)"payload",false,1);
+    IS_TRUE(rc);
+
+    shimClient.setConnected(false);
+    IS_FALSE(client.connected());
+
+    // CONNECT, then the message again with the DUP flag and the same id
+    byte connect[] = {0x10,0x18,0x0,0x4,0x4d,0x51,0x54,0x54,0x4,0x2,0x0,0xf,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31};
+    shimClient.expect(connect,26);
+    byte publish[18];
+    qos1_packet(publish,2,true);
+    shimClient.expect(publish,18);
+
+    shimClient.respond(connack,4);
+    rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+    IS_TRUE(client.resent == 1);
+    IS_TRUE(client.inflight() == 1);
+
+    // New messages do not reuse the queued packet id
+    qos1_packet(publish,3,false);
+    shimClient.expect(publish,18);
+    rc = client.publish((char*)"topic",(char*)"payload",false,1);
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_stream() {
+    IT("publishes a streamed payload at QoS 1");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[18];
+    qos1_packet(publish,2,false);
+    shimClient.expect(publish,18);
+
+    rc = client.beginPublish((char*)"topic",7,false,1);
+    IS_TRUE(rc);
+    IS_TRUE(client.write((const uint8_t*)"pay",3) == 3);
+    IS_TRUE(client.write((const uint8_t*)"load",4) == 4);
+    rc = client.endPublish();
+    IS_TRUE(rc);
+    IS_TRUE(client.inflight() == 1);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+
+int test_publish_qos1_stream_short() {
+    IT("drops a streamed QoS 1 payload shorter than announced");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    rc = client.beginPublish((char*)"topic",7,false,1);
+    IS_TRUE(rc);
+    IS_TRUE(client.write((const uint8_t*)"pay",3) == 3);
+    rc = client.endPublish();
+    IS_FALSE(rc);
+    IS_TRUE(client.queued() == 0);
+
+    // Writes past the announced length are cut off
+    byte publish[14];
+    qos1_packet(publish,3,false);
+    publish[1] = 0xc;
+    shimClient.expect(publish,14);
+
+    rc = client.beginPublish((char*)"topic",3,false,1);
+    IS_TRUE(rc);
+    IS_TRUE(client.write((const uint8_t*)"payload",7) == 3);
+    rc = client.endPublish();
+    IS_TRUE(rc);
+    IS_TRUE(client.queued() == 1);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int main()
+{
+    SUITE("QoS 1");
+    test_publish_qos1();
+    test_publish_qos1_window();
+    test_publish_qos1_out_of_order();
+    test_publish_qos1_queue_full();
+    test_publish_qos1_queue_full_connected();
+    test_publish_qos1_too_long();
+    test_publish_qos1_offline();
+    test_publish_qos1_resend();
+    test_publish_qos1_stream();
+    test_publish_qos1_stream_short();
+
+    FINISH
+}
@@ -0,0 +1,163 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "aggregate.h"
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <ecohouse_link.h>
+
+unsigned long aggregate_samples = 0;
+unsigned long aggregate_windows = 0;
+unsigned long aggregate_untracked = 0;
+unsigned long aggregate_non_numeric = 0;
+unsigned long aggregate_truncated = 0;
+
+struct AggregateEntry {
+  char key[AGGREGATE_KEY_SIZE];
+  uint32_t count;
+  double sum;
+  float min;
+  float max;
+};
+
+static AggregateEntry table[AGGREGATE_KEYS];
+static uint8_t table_count = 0;
+
+static unsigned long window = 0;         // ms, 0 when off
+static unsigned long window_start = 0;
+
+void aggregate_setup()
+{
+  long seconds = aggregate_window.toInt();
+  window = seconds > 0 ? seconds * 1000UL : 0;
+  table_count = 0;
+}
+
+uint8_t aggregate_keys()
+{
+  return table_count;
+}
+
+static AggregateEntry* aggregate_entry(const char* key)
+{
+  for (uint8_t i = 0; i < table_count; i++) {
+    if (strcmp(table[i].key, key) == 0) {
+      return &table[i];
+    }
+  }
+  if (table_count == AGGREGATE_KEYS || strlen(key) >= AGGREGATE_KEY_SIZE) {
+    return NULL;
+  }
+  AggregateEntry* entry = &table[table_count++];
+  strlcpy(entry->key, key, sizeof(entry->key));
+  entry->count = 0;
+  entry->sum = 0;
+  return entry;
+}
+
+static void aggregate_add(const Record& rec)
+{
+  if (table_count == 0) {
+    window_start = millis();
+  }
+  aggregate_samples++;
+
+  for (uint8_t i = 0; i < rec.count; i++) {
+    char* end;
+    float value = strtod(rec.fields[i].value, &end);
+    if (end == rec.fields[i].value || *end != '\0' || !isfinite(value)) {
+      aggregate_non_numeric++;
+      continue;
+    }
+
+    AggregateEntry* entry = aggregate_entry(rec.fields[i].key);
+    if (entry == NULL) {
+      aggregate_untracked++;
+      continue;
+    }
+    if (entry->count == 0 || value < entry->min) entry->min = value;
+    if (entry->count == 0 || value > entry->max) entry->max = value;
+    entry->sum += value;
+    entry->count++;
+  }
+}
+
+// Hundredths of v, held to what ehl_format_value() takes
+static int32_t aggregate_hundredths(double v)
+{
+  v *= 100;
+  if (v >= INT32_MAX) return INT32_MAX;
+  if (v <= INT32_MIN) return INT32_MIN;
+  return (int32_t)lround(v);
+}
+
+// Fill rec with the window: all the means, then the minima, maxima and
+// counts, up to the first field that does not fit
+static void aggregate_render(Record& rec)
+{
+  static const char* const suffixes[] = { "", "_min", "_max", "_n" };
+  char key[AGGREGATE_KEY_SIZE + 4];
+  char value[16];
+
+  record_clear(rec);
+  for (uint8_t s = 0; s < 4; s++) {
+    for (uint8_t i = 0; i < table_count; i++) {
+      const AggregateEntry& entry = table[i];
+      if (s == 3) {
+        snprintf(value, sizeof(value), "%lu", (unsigned long)entry.count);
+      } else {
+        double v = s == 0 ? entry.sum / entry.count : s == 1 ? entry.min : entry.max;
+        ehl_format_value(aggregate_hundredths(v), value);
+      }
+      snprintf(key, sizeof(key), "%s%s", entry.key, suffixes[s]);
+      if (!record_add(rec, key, value)) {
+        aggregate_truncated += (4 - s) * table_count - i;
+        return;
+      }
+    }
+  }
+}
+
+boolean aggregate(Record& rec, boolean fresh)
+{
+  if (window == 0) {
+    return fresh;
+  }
+
+  if (fresh) {
+    aggregate_add(rec);
+  }
+  if (table_count == 0 || millis() - window_start < window) {
+    return false;
+  }
+
+  aggregate_render(rec);
+  table_count = 0;
+  aggregate_windows++;
+  return rec.count > 0;
+}
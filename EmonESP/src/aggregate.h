@@ -0,0 +1,82 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_AGGREGATE_H
+#define _EMONESP_AGGREGATE_H
+
+#include <Arduino.h>
+#include "record.h"
+
+// -------------------------------------------------------------------
+// Aggregation windows
+//
+// With a window set, sample sets are not forwarded one by one. The
+// count, sum, min and max of every numeric key are accumulated, and
+// once per window a single record is passed on to the sinks:
+//
+//   p1:120.50,t1:21.50,p1_min:118.00,t1_min:21.40,p1_max:123.00,
+//   t1_max:21.50,p1_n:30,t1_n:30
+//
+// The mean keeps the key name, so existing feeds carry on. The extra
+// fields come after all the means; when they do not fit in a record
+// (RECORD_MAX_FIELDS, RECORD_LINE_SIZE) the counts go first, then the
+// maxima and minima.
+//
+// The statistics are kept in a fixed table. Values that are not numbers
+// and keys that do not fit in the table are not forwarded, they are
+// counted instead.
+// -------------------------------------------------------------------
+
+#define AGGREGATE_KEYS      16
+#define AGGREGATE_KEY_SIZE  12
+
+// Sample sets folded into windows, and windows sent
+extern unsigned long aggregate_samples;
+extern unsigned long aggregate_windows;
+// Fields dropped because their key did not fit the table, because their
+// value is not a number, and aggregate fields that did not fit a record
+extern unsigned long aggregate_untracked;
+extern unsigned long aggregate_non_numeric;
+extern unsigned long aggregate_truncated;
+
+// -------------------------------------------------------------------
+// Apply the aggregate_window setting. A window in progress is dropped
+// -------------------------------------------------------------------
+extern void aggregate_setup();
+
+// -------------------------------------------------------------------
+// Call every time around loop(), with fresh set if rec holds a new
+// sample set.
+//
+// Without a window, returns fresh and leaves rec alone. Otherwise rec
+// is added to the window, and true is returned with rec replaced by
+// the aggregate when the window closes.
+// -------------------------------------------------------------------
+extern boolean aggregate(Record& rec, boolean fresh);
+
+// Keys with samples in the current window
+extern uint8_t aggregate_keys();
+
+#endif // _EMONESP_AGGREGATE_H
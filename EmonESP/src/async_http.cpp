@@ -0,0 +1,364 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "async_http.h"
+#include "http.h"
+
+#include <ESPAsyncTCP.h>
+
+struct AsyncHttpRequest {
+  String host;
+  uint16_t port;
+  String url;
+  String form;                          // POST body, empty for a GET
+  String fingerprint;
+  AsyncHttpCallback callback;
+};
+
+static AsyncHttpRequest queue[ASYNC_HTTP_QUEUE_SIZE];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+
+static AsyncClient tcp;
+static String conn_host;
+static uint16_t conn_port = 0;
+static unsigned long conn_last_used = 0;
+
+// State of the request at the head of the queue. The TCP callbacks
+// only fill these in; completion is handled in async_http_loop()
+enum { REQ_IDLE, REQ_CONNECTING, REQ_SENT, REQ_RETRY, REQ_DONE };
+static volatile uint8_t req_state = REQ_IDLE;
+static unsigned long req_start = 0;
+static String req_head;                 // request being written
+static size_t req_written = 0;          // bytes of it handed to TCP
+static boolean req_reused = false;      // sent on a kept-alive connection
+static boolean req_retried = false;
+static String response;
+static volatile int req_status = -1;
+static String req_body;
+
+static void request_send();
+static void request_finish(int status, const String& body);
+static boolean request_retry();
+
+// -------------------------------------------------------------------
+// Try to complete the response from what has arrived so far.
+// closed: the server has closed the connection
+// -------------------------------------------------------------------
+static void response_parse(boolean closed)
+{
+  int header_end = response.indexOf("\r\n\r\n");
+  if (header_end < 0) {
+    if (closed && !request_retry()) request_finish(-1, "Connection closed");
+    return;
+  }
+
+  String headers = response.substring(0, header_end);
+  headers.toLowerCase();
+  int status = response.substring(9, 12).toInt();
+  String body = response.substring(header_end + 4);
+  boolean keep = headers.startsWith("http/1.1") && headers.indexOf("connection: close") < 0;
+
+  int cl = headers.indexOf("content-length:");
+  if (cl >= 0) {
+    long length = headers.substring(cl + 15).toInt();
+    if ((long)body.length() < length) {
+      if (closed) request_finish(-1, "Truncated response");
+      return;
+    }
+    body = body.substring(0, length);
+  } else if (headers.indexOf("transfer-encoding: chunked") >= 0) {
+    if (body.indexOf("\r\n0\r\n") < 0 && !body.startsWith("0\r\n")) {
+      if (closed) request_finish(-1, "Truncated response");
+      return;
+    }
+    // Join the chunks
+    String joined;
+    int pos = 0;
+    while (true) {
+      long size = strtol(body.c_str() + pos, NULL, 16);
+      int data = body.indexOf("\r\n", pos);
+      if (size <= 0 || data < 0) break;
+      joined += body.substring(data + 2, data + 2 + size);
+      pos = data + 2 + size + 2;
+    }
+    body = joined;
+  } else if (!closed) {
+    // Body runs until the server closes
+    return;
+  } else {
+    keep = false;
+  }
+
+  if (!keep) {
+    tcp.close(true);
+  }
+  request_finish(status, body);
+}
+
+static void request_finish(int status, const String& body)
+{
+  if (req_state == REQ_DONE || req_state == REQ_IDLE) {
+    return;
+  }
+  req_status = status;
+  req_body = body;
+  req_state = REQ_DONE;
+  req_head = "";
+  conn_last_used = millis();
+}
+
+// -------------------------------------------------------------------
+// A kept-alive connection the server closed before answering: try the
+// request once more on a fresh connection, as http_get() does. The
+// reconnect is left to async_http_loop()
+// -------------------------------------------------------------------
+static boolean request_retry()
+{
+  if (!req_reused || req_retried || response.length() > 0) {
+    return false;
+  }
+  req_retried = true;
+  req_state = REQ_RETRY;
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Hand TCP as much of the request as its send buffer takes. A request
+// can be larger than the buffer: on_ack() writes the rest as the
+// server acknowledges what was sent
+// -------------------------------------------------------------------
+static void request_write()
+{
+  if (req_state != REQ_SENT || req_written >= req_head.length() || !tcp.canSend()) {
+    return;
+  }
+  size_t len = req_head.length() - req_written;
+  if (len > tcp.space()) {
+    len = tcp.space();
+  }
+  if (len > 0) {
+    req_written += tcp.write(req_head.c_str() + req_written, len);
+  }
+}
+
+static void request_send()
+{
+  const AsyncHttpRequest& req = queue[queue_head];
+  if (req.form.length() > 0) {
+    req_head = String("POST ") + req.url + " HTTP/1.1\r\nHost: " + req.host +
+               "\r\nConnection: keep-alive\r\n"
+               "Content-Type: application/x-www-form-urlencoded\r\n"
+               "Content-Length: " + req.form.length() + "\r\n\r\n" + req.form;
+  } else {
+    req_head = String("GET ") + req.url + " HTTP/1.1\r\nHost: " + req.host +
+               "\r\nConnection: keep-alive\r\n\r\n";
+  }
+  req_written = 0;
+  response = "";
+  req_state = REQ_SENT;
+  request_write();
+}
+
+static void on_connect(void*, AsyncClient* client)
+{
+#if ASYNC_TCP_SSL_ENABLED
+  const AsyncHttpRequest& req = queue[queue_head];
+  if (req.fingerprint.length() > 0) {
+    const uint8_t* fp = http_pin(req.fingerprint.c_str());
+    if (fp == NULL || ssl_match_fingerprint(client->getSSL(), fp) != SSL_OK) {
+      client->close(true);
+      request_finish(-1, "HTTPS fingerprint no match");
+      return;
+    }
+  }
+#endif
+  http_connects++;
+  request_send();
+}
+
+static void on_data(void*, AsyncClient*, void* data, size_t len)
+{
+  if (req_state != REQ_SENT) {
+    return;
+  }
+  size_t room = ASYNC_HTTP_MAX_RESPONSE - response.length();
+  if (len > room) {
+    len = room;
+  }
+  const char* p = (const char*)data;
+  response.reserve(response.length() + len);
+  for (size_t i = 0; i < len; i++) {
+    response += p[i];
+  }
+  response_parse(false);
+}
+
+static void on_ack(void*, AsyncClient*, size_t, uint32_t)
+{
+  request_write();
+}
+
+static void on_disconnect(void*, AsyncClient*)
+{
+  if (req_state == REQ_SENT) {
+    response_parse(true);
+  } else if (req_state == REQ_CONNECTING) {
+    request_finish(-1, "Connection error");
+  }
+}
+
+static void on_error(void*, AsyncClient*, int8_t error)
+{
+  if (req_state == REQ_SENT && request_retry()) {
+    return;
+  }
+  request_finish(-1, String("TCP error ") + error);
+}
+
+static void request_start()
+{
+  const AsyncHttpRequest& req = queue[queue_head];
+  req_start = millis();
+  req_status = -1;
+
+  // Reuse the connection if it is open to the same server and not idle
+  // for too long
+  if (tcp.connected() && conn_host == req.host && conn_port == req.port &&
+      millis() - conn_last_used < HTTP_IDLE_TIMEOUT) {
+    http_reused++;
+    req_reused = true;
+    request_send();
+    return;
+  }
+  req_reused = false;
+
+  if (!tcp.freeable() && !tcp.connected()) {
+    // Still closing the previous connection, try again on the next loop
+    return;
+  }
+  tcp.close(true);
+  conn_host = req.host;
+  conn_port = req.port;
+  req_state = REQ_CONNECTING;
+#if ASYNC_TCP_SSL_ENABLED
+  boolean ok = tcp.connect(req.host.c_str(), req.port, req.fingerprint.length() > 0);
+#else
+  boolean ok = tcp.connect(req.host.c_str(), req.port);
+#endif
+  if (!ok) {
+    request_finish(-1, "Connection error");
+  }
+}
+
+boolean async_http_post(const char* host, uint16_t port, const String& url, const String& form,
+                        const char* fingerprint, AsyncHttpCallback callback)
+{
+  if (queue_count == ASYNC_HTTP_QUEUE_SIZE) {
+    return false;
+  }
+
+  static boolean handlers = false;
+  if (!handlers) {
+    tcp.onConnect(on_connect);
+    tcp.onData(on_data);
+    tcp.onAck(on_ack);
+    tcp.onDisconnect(on_disconnect);
+    tcp.onError(on_error);
+    handlers = true;
+  }
+
+  AsyncHttpRequest& req = queue[(queue_head + queue_count) % ASYNC_HTTP_QUEUE_SIZE];
+  req.host = host;
+  req.port = port;
+  req.url = url;
+  req.form = form;
+  req.fingerprint = fingerprint ? fingerprint : "";
+  req.callback = callback;
+  queue_count++;
+  return true;
+}
+
+void async_http_loop()
+{
+  if (queue_count == 0) {
+    return;
+  }
+
+  if (req_state == REQ_RETRY) {
+    // Reconnect rather than reuse
+    tcp.close(true);
+    conn_host = "";
+    req_state = REQ_IDLE;
+  }
+
+  if (req_state == REQ_IDLE) {
+    request_start();
+  }
+  else if (req_state != REQ_DONE && millis() - req_start > ASYNC_HTTP_TIMEOUT) {
+    request_finish(-1, "Client Timeout");
+    tcp.close(true);
+  }
+
+  if (req_state == REQ_DONE) {
+    AsyncHttpRequest& req = queue[queue_head];
+    if (req_status > 0) {
+      http_record_latency(millis() - req_start);
+    }
+    AsyncHttpCallback callback = req.callback;
+    int status = req_status;
+    String body = req_body;
+
+    // Free the slot before the callback so it can queue the next request
+    req.url = "";
+    req.form = "";
+    queue_head = (queue_head + 1) % ASYNC_HTTP_QUEUE_SIZE;
+    queue_count--;
+    req_state = REQ_IDLE;
+    req_retried = false;
+    response = "";
+
+    if (callback) {
+      callback(status, body);
+    }
+  }
+}
+
+boolean async_http_get(const char* host, uint16_t port, const String& url,
+                       const char* fingerprint, AsyncHttpCallback callback)
+{
+  return async_http_post(host, port, url, "", fingerprint, callback);
+}
+
+uint8_t async_http_pending()
+{
+  return queue_count;
+}
+
+boolean async_http_supports_tls()
+{
+  return ASYNC_TCP_SSL_ENABLED;
+}
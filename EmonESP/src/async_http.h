@@ -0,0 +1,84 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_ASYNC_HTTP_H
+#define _EMONESP_ASYNC_HTTP_H
+
+#include <Arduino.h>
+
+// -------------------------------------------------------------------
+// Event driven HTTP client on ESPAsyncTCP
+//
+// Requests are queued and sent one at a time on a single AsyncClient
+// that is kept alive between requests. Nothing here waits on the
+// network: the response is assembled in the TCP callbacks and the
+// completion callback runs from async_http_loop(). Requests larger
+// than the TCP send buffer are written in pieces as they are
+// acknowledged, and a request the server drops on a kept-alive
+// connection is tried once more on a fresh one.
+//
+// HTTPS needs ESPAsyncTCP built with ASYNC_TCP_SSL_ENABLED; without it
+// async_http_supports_tls() is false and callers should use get_https().
+// -------------------------------------------------------------------
+
+#define ASYNC_HTTP_QUEUE_SIZE    4
+#define ASYNC_HTTP_TIMEOUT       10000    // ms for a whole request
+#define ASYNC_HTTP_MAX_RESPONSE  1024     // bytes kept of each response
+
+// status: HTTP status code, or -1 if the request failed
+// body:   response body, or a description of the failure
+typedef void (*AsyncHttpCallback)(int status, const String& body);
+
+// -------------------------------------------------------------------
+// Queue a GET request. Returns false if the queue is full.
+//
+// fingerprint: SHA1 fingerprint of the server certificate for HTTPS, or
+//              NULL for plain HTTP
+// -------------------------------------------------------------------
+extern boolean async_http_get(const char* host, uint16_t port, const String& url,
+                              const char* fingerprint, AsyncHttpCallback callback);
+
+// -------------------------------------------------------------------
+// Queue a POST of form, an application/x-www-form-urlencoded body such
+// as "data=...". Returns false if the queue is full.
+// -------------------------------------------------------------------
+extern boolean async_http_post(const char* host, uint16_t port, const String& url,
+                               const String& form, const char* fingerprint,
+                               AsyncHttpCallback callback);
+
+// -------------------------------------------------------------------
+// Start queued requests, enforce timeouts and deliver completions.
+// Must be called in the main loop function
+// -------------------------------------------------------------------
+extern void async_http_loop();
+
+// -------------------------------------------------------------------
+// Number of requests queued or in flight
+// -------------------------------------------------------------------
+extern uint8_t async_http_pending();
+
+extern boolean async_http_supports_tls();
+
+#endif // _EMONESP_ASYNC_HTTP_H
@@ -0,0 +1,698 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "mqtt.h"
+
+// Only built for -DMQTT_ASYNC=1; otherwise mqtt.cpp uses PubSubClient
+#if MQTT_ASYNC
+
+#include "async_mqtt.h"
+
+#include <ESPAsyncTCP.h>
+
+enum { RX_HEADER, RX_LENGTH, RX_BODY };
+
+MqttAsyncClient::MqttAsyncClient()
+{
+  tcp = NULL;
+  domain = NULL;
+  port = 1883;
+  callback = NULL;
+  _state = MQTT_DISCONNECTED;
+  nextMsgId = 1;
+  pingOutstanding = false;
+  txHead = txCount = 0;
+  txStreaming = 0;
+  rxState = RX_HEADER;
+#if MQTT_QOS1_QUEUE_SIZE > 0
+  qosPacket = NULL;
+  qosHead = 0;
+#endif
+  qosCount = qosInflight = 0;
+  qosStreaming = -1;
+  qosEnd = 0;
+  acked = resent = 0;
+}
+
+MqttAsyncClient& MqttAsyncClient::setServer(const char* domain, uint16_t port)
+{
+  this->domain = domain;
+  this->port = port;
+  return *this;
+}
+
+MqttAsyncClient& MqttAsyncClient::setCallback(void (*callback)(char*, uint8_t*, unsigned int))
+{
+  this->callback = callback;
+  return *this;
+}
+
+// -------------------------------------------------------------------
+// Connection
+// -------------------------------------------------------------------
+boolean MqttAsyncClient::connect(const char* id, const char* user, const char* pass)
+{
+  if (connected()) {
+    return true;
+  }
+  if (_state == MQTT_CONNECTING) {
+    return false;
+  }
+
+  if (tcp == NULL) {
+    tcp = new AsyncClient();
+    tcp->onConnect([](void* self, AsyncClient*) {
+      ((MqttAsyncClient*)self)->onConnect();
+    }, this);
+    tcp->onData([](void* self, AsyncClient*, void* data, size_t len) {
+      ((MqttAsyncClient*)self)->onData((const uint8_t*)data, len);
+    }, this);
+    tcp->onDisconnect([](void* self, AsyncClient*) {
+      ((MqttAsyncClient*)self)->onDisconnect();
+    }, this);
+    tcp->onAck([](void* self, AsyncClient*, size_t, uint32_t) {
+      ((MqttAsyncClient*)self)->onAck();
+    }, this);
+  }
+  if (!tcp->freeable() && !tcp->connected()) {
+    // Previous connection still closing
+    return false;
+  }
+
+  this->id = id;
+  this->user = user;
+  this->pass = pass;
+  txHead = txCount = 0;
+  txStreaming = 0;
+  rxState = RX_HEADER;
+  _state = MQTT_CONNECTING;
+  connectStart = millis();
+  if (!tcp->connect(domain, port)) {
+    _state = MQTT_CONNECT_FAILED;
+  }
+  return false;
+}
+
+void MqttAsyncClient::onConnect()
+{
+  // CONNECT: protocol name and level, flags, keepalive, then the strings
+  uint8_t buf[MQTT_MAX_PACKET_SIZE];
+  uint16_t length = MQTT_MAX_HEADER_SIZE;
+  const uint8_t d[7] = {0x00, 0x04, 'M', 'Q', 'T', 'T', MQTT_VERSION_3_1_1};
+  memcpy(buf + length, d, sizeof(d));
+  length += sizeof(d);
+
+  uint8_t flags = 0x02;                 // clean session
+  if (user != NULL) {
+    flags |= 0x80;
+    if (pass != NULL) {
+      flags |= 0x40;
+    }
+  }
+  buf[length++] = flags;
+  buf[length++] = MQTT_KEEPALIVE >> 8;
+  buf[length++] = MQTT_KEEPALIVE & 0xFF;
+
+  const char* strings[] = { id, user, user ? pass : NULL };
+  for (uint8_t i = 0; i < 3; i++) {
+    if (strings[i] == NULL) {
+      continue;
+    }
+    size_t n = strlen(strings[i]);
+    if (length + 2 + n > sizeof(buf)) {
+      closed(MQTT_CONNECT_FAILED);
+      tcp->close(true);
+      return;
+    }
+    buf[length++] = n >> 8;
+    buf[length++] = n & 0xFF;
+    memcpy(buf + length, strings[i], n);
+    length += n;
+  }
+
+  uint8_t hlen = writeHeader(buf, MQTTCONNECT, length - MQTT_MAX_HEADER_SIZE);
+  txPut(buf + MQTT_MAX_HEADER_SIZE - hlen, length - MQTT_MAX_HEADER_SIZE + hlen);
+  lastInActivity = millis();
+  flush();
+}
+
+void MqttAsyncClient::onDisconnect()
+{
+  if (_state == MQTT_CONNECTED) {
+    closed(MQTT_CONNECTION_LOST);
+  } else if (_state == MQTT_CONNECTING) {
+    closed(MQTT_CONNECT_FAILED);
+  }
+}
+
+void MqttAsyncClient::onAck()
+{
+  flush();
+}
+
+void MqttAsyncClient::closed(int state)
+{
+  _state = state;
+  txHead = txCount = 0;
+  txStreaming = 0;
+  rxState = RX_HEADER;
+}
+
+void MqttAsyncClient::disconnect()
+{
+  if (connected()) {
+    const uint8_t packet[2] = {MQTTDISCONNECT, 0};
+    txPut(packet, sizeof(packet));
+    flush();
+  }
+  if (tcp != NULL) {
+    tcp->close();
+  }
+  closed(MQTT_DISCONNECTED);
+}
+
+boolean MqttAsyncClient::connecting()
+{
+  return _state == MQTT_CONNECTING;
+}
+
+boolean MqttAsyncClient::connected()
+{
+  return _state == MQTT_CONNECTED && tcp != NULL && tcp->connected();
+}
+
+int MqttAsyncClient::state()
+{
+  return _state;
+}
+
+// -------------------------------------------------------------------
+// Connect and keepalive timers
+// -------------------------------------------------------------------
+boolean MqttAsyncClient::loop()
+{
+  unsigned long t = millis();
+  if (_state == MQTT_CONNECTING) {
+    if (t - connectStart >= MQTT_SOCKET_TIMEOUT * 1000UL) {
+      closed(MQTT_CONNECTION_TIMEOUT);
+      tcp->close(true);
+    }
+    return false;
+  }
+  if (!connected()) {
+    return false;
+  }
+
+  if (t - lastInActivity > MQTT_KEEPALIVE * 1000UL || t - lastOutActivity > MQTT_KEEPALIVE * 1000UL) {
+    if (pingOutstanding) {
+      closed(MQTT_CONNECTION_TIMEOUT);
+      tcp->close(true);
+      return false;
+    }
+    const uint8_t packet[2] = {MQTTPINGREQ, 0};
+    txPut(packet, sizeof(packet));
+    lastInActivity = lastOutActivity = t;
+    pingOutstanding = true;
+  }
+  flush();
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Outgoing byte queue
+// -------------------------------------------------------------------
+uint16_t MqttAsyncClient::writeHeader(uint8_t* buf, uint8_t header, uint32_t length)
+{
+  // Fixed header ending at buf[MQTT_MAX_HEADER_SIZE - 1], as PubSubClient
+  uint8_t lenBuf[4];
+  uint8_t llen = 0;
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    if (length > 0) {
+      digit |= 0x80;
+    }
+    lenBuf[llen++] = digit;
+  } while (length > 0 && llen < 4);
+
+  buf[MQTT_MAX_HEADER_SIZE - 1 - llen] = header;
+  memcpy(buf + MQTT_MAX_HEADER_SIZE - llen, lenBuf, llen);
+  return llen + 1;
+}
+
+uint16_t MqttAsyncClient::txSpace()
+{
+  return MQTT_ASYNC_TX_SIZE - txCount;
+}
+
+boolean MqttAsyncClient::txPut(const uint8_t* data, size_t len)
+{
+  if (len > txSpace()) {
+    return false;
+  }
+  for (size_t i = 0; i < len; i++) {
+    tx[(txHead + txCount) % MQTT_ASYNC_TX_SIZE] = data[i];
+    txCount++;
+  }
+  return true;
+}
+
+// Hand queued bytes to TCP as far as its window allows; the rest goes
+// from onAck() when the window opens
+void MqttAsyncClient::flush()
+{
+  if (tcp == NULL || !tcp->connected()) {
+    return;
+  }
+  while (txCount > 0 && tcp->canSend()) {
+    size_t n = min((size_t)txCount, (size_t)(MQTT_ASYNC_TX_SIZE - txHead));
+    n = min(n, tcp->space());
+    if (n == 0) {
+      break;
+    }
+    size_t written = tcp->write((const char*)tx + txHead, n);
+    if (written == 0) {
+      break;
+    }
+    txHead = (txHead + written) % MQTT_ASYNC_TX_SIZE;
+    txCount -= written;
+    lastOutActivity = millis();
+  }
+}
+
+// -------------------------------------------------------------------
+// Publish
+// -------------------------------------------------------------------
+boolean MqttAsyncClient::publish(const char* topic, const char* payload)
+{
+  return publish(topic, (const uint8_t*)payload, strlen(payload), false, 0);
+}
+
+boolean MqttAsyncClient::publish(const char* topic, const char* payload, boolean retained, uint8_t qos)
+{
+  return publish(topic, (const uint8_t*)payload, strlen(payload), retained, qos);
+}
+
+boolean MqttAsyncClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained, uint8_t qos)
+{
+  if (!beginPublish(topic, plength, retained, qos)) {
+    return false;
+  }
+  write(payload, plength);
+  return endPublish();
+}
+
+boolean MqttAsyncClient::beginPublish(const char* topic, unsigned int plength, boolean retained)
+{
+  return beginPublish(topic, plength, retained, 0);
+}
+
+boolean MqttAsyncClient::beginPublish(const char* topic, unsigned int plength, boolean retained, uint8_t qos)
+{
+  if (qos == 1) {
+    return qosBegin(topic, plength, retained) >= 0;
+  }
+  if (qos != 0 || !connected()) {
+    return false;
+  }
+
+  uint8_t buf[MQTT_MAX_HEADER_SIZE + 2];
+  size_t tlen = strlen(topic);
+  uint8_t hlen = writeHeader(buf, MQTTPUBLISH | (retained ? 1 : 0), 2 + tlen + plength);
+  if (hlen + 2 + tlen + plength > txSpace()) {
+    return false;
+  }
+  buf[MQTT_MAX_HEADER_SIZE] = tlen >> 8;
+  buf[MQTT_MAX_HEADER_SIZE + 1] = tlen & 0xFF;
+  txPut(buf + MQTT_MAX_HEADER_SIZE - hlen, hlen + 2);
+  txPut((const uint8_t*)topic, tlen);
+  txStreaming = plength;
+  return true;
+}
+
+size_t MqttAsyncClient::write(uint8_t data)
+{
+  return write(&data, 1);
+}
+
+size_t MqttAsyncClient::write(const uint8_t* buffer, size_t size)
+{
+#if MQTT_QOS1_QUEUE_SIZE > 0
+  if (qosStreaming >= 0) {
+    // Up to the payload length given to beginPublish()
+    uint8_t slot = qosStreaming;
+    if (qosLength[slot] + size > qosEnd) {
+      size = qosEnd - qosLength[slot];
+    }
+    memcpy(qosSlot(slot) + qosLength[slot], buffer, size);
+    qosLength[slot] += size;
+    return size;
+  }
+#endif
+  // Space for the whole payload was checked by beginPublish()
+  if (size > (size_t)txStreaming) {
+    size = txStreaming;
+  }
+  txPut(buffer, size);
+  txStreaming -= size;
+  return size;
+}
+
+int MqttAsyncClient::endPublish()
+{
+  if (qosStreaming >= 0) {
+    return qosCommit() ? 1 : 0;
+  }
+  txStreaming = 0;
+  flush();
+  return 1;
+}
+
+boolean MqttAsyncClient::subscribe(const char* topic, uint8_t qos)
+{
+  size_t tlen = strlen(topic);
+  if (qos > 1 || !connected() || MQTT_MAX_PACKET_SIZE < 9 + tlen) {
+    return false;
+  }
+  uint8_t buf[MQTT_MAX_PACKET_SIZE];
+  uint16_t length = MQTT_MAX_HEADER_SIZE;
+  uint16_t msgId = qosNextMsgId();
+  buf[length++] = msgId >> 8;
+  buf[length++] = msgId & 0xFF;
+  buf[length++] = tlen >> 8;
+  buf[length++] = tlen & 0xFF;
+  memcpy(buf + length, topic, tlen);
+  length += tlen;
+  buf[length++] = qos;
+  uint8_t hlen = writeHeader(buf, MQTTSUBSCRIBE | MQTTQOS1, length - MQTT_MAX_HEADER_SIZE);
+  if (!txPut(buf + MQTT_MAX_HEADER_SIZE - hlen, length - MQTT_MAX_HEADER_SIZE + hlen)) {
+    return false;
+  }
+  flush();
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Incoming packets, parsed as the bytes arrive
+// -------------------------------------------------------------------
+void MqttAsyncClient::onData(const uint8_t* data, size_t len)
+{
+  lastInActivity = millis();
+  for (size_t i = 0; i < len; i++) {
+    uint8_t b = data[i];
+    switch (rxState) {
+      case RX_HEADER:
+        rxHeader = b;
+        rxLength = 0;
+        rxMultiplier = 1;
+        rxState = RX_LENGTH;
+        break;
+
+      case RX_LENGTH:
+        rxLength += (b & 127) * rxMultiplier;
+        rxMultiplier *= 128;
+        if (b & 128) {
+          break;
+        }
+        rxPos = 0;
+        if (rxLength > 0) {
+          rxState = RX_BODY;
+          break;
+        }
+        rxState = RX_HEADER;
+        handlePacket();
+        break;
+
+      case RX_BODY:
+        if (rxPos < sizeof(rx)) {
+          rx[rxPos] = b;
+        }
+        if (++rxPos == rxLength) {
+          rxState = RX_HEADER;
+          // Packets larger than the buffer are dropped
+          if (rxLength <= sizeof(rx)) {
+            handlePacket();
+          }
+        }
+        break;
+    }
+  }
+}
+
+void MqttAsyncClient::handlePacket()
+{
+  uint8_t type = rxHeader & 0xF0;
+
+  if (_state == MQTT_CONNECTING) {
+    if (type == MQTTCONNACK && rxLength >= 2 && rx[1] == 0) {
+      _state = MQTT_CONNECTED;
+      lastInActivity = lastOutActivity = millis();
+      pingOutstanding = false;
+      nextMsgId = 1;
+      // Unacknowledged QoS 1 messages go out again
+      qosResend();
+    } else {
+      closed(type == MQTTCONNACK && rxLength >= 2 ? rx[1] : MQTT_CONNECT_FAILED);
+      tcp->close(true);
+    }
+    return;
+  }
+
+  switch (type) {
+    case MQTTPUBLISH: {
+      if (rxLength < 2) {
+        break;
+      }
+      // The topic length comes from the broker: check it against the
+      // packet before reading anything behind the topic
+      uint32_t tl = (rx[0] << 8) + rx[1];
+      boolean qos1 = (rxHeader & 0x06) == MQTTQOS1;
+      uint32_t skip = 2 + tl + (qos1 ? 2 : 0);
+      if (skip > rxLength) {
+        break;
+      }
+      uint16_t msgId = 0;
+      if (qos1) {
+        msgId = (rx[2 + tl] << 8) + rx[3 + tl];
+      }
+      // Topic as a C string at the front of the buffer
+      memmove(rx, rx + 2, tl);
+      rx[tl] = 0;
+      if (callback) {
+        callback((char*)rx, rx + skip, rxLength - skip);
+      }
+      if (msgId != 0) {
+        const uint8_t packet[4] = {MQTTPUBACK, 2, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF)};
+        txPut(packet, sizeof(packet));
+        flush();
+      }
+      break;
+    }
+    case MQTTPUBACK:
+      if (rxLength >= 2) {
+        qosAck((rx[0] << 8) + rx[1]);
+      }
+      break;
+    case MQTTPINGREQ: {
+      const uint8_t packet[2] = {MQTTPINGRESP, 0};
+      txPut(packet, sizeof(packet));
+      flush();
+      break;
+    }
+    case MQTTPINGRESP:
+      pingOutstanding = false;
+      break;
+  }
+}
+
+// -------------------------------------------------------------------
+// QoS 1 queue. Same scheme as PubSubClient, but a full queue is never
+// waited on and sending goes through the byte queue
+// -------------------------------------------------------------------
+#if MQTT_QOS1_QUEUE_SIZE > 0
+#define QOS_SENT  0x01
+#define QOS_ACKED 0x02
+
+uint16_t MqttAsyncClient::qosNextMsgId()
+{
+  for (;;) {
+    nextMsgId++;
+    if (nextMsgId == 0) {
+      nextMsgId = 1;
+    }
+    uint8_t i;
+    for (i = 0; i < qosCount; i++) {
+      if (qosMsgId[(qosHead + i) % MQTT_QOS1_QUEUE_SIZE] == nextMsgId) {
+        break;
+      }
+    }
+    if (i == qosCount) {
+      return nextMsgId;
+    }
+  }
+}
+
+int16_t MqttAsyncClient::qosBegin(const char* topic, unsigned int plength, boolean retained)
+{
+  size_t tlen = strlen(topic);
+  if (MQTT_MAX_PACKET_SIZE < MQTT_MAX_HEADER_SIZE + 2 + tlen + 2 + plength ||
+      qosCount == MQTT_QOS1_QUEUE_SIZE) {
+    return -1;
+  }
+  if (qosPacket == NULL) {
+    qosPacket = (uint8_t*)malloc((size_t)MQTT_QOS1_QUEUE_SIZE * MQTT_MAX_PACKET_SIZE);
+    if (qosPacket == NULL) {
+      return -1;
+    }
+  }
+
+  uint8_t slot = (qosHead + qosCount) % MQTT_QOS1_QUEUE_SIZE;
+  uint8_t* buf = qosSlot(slot);
+  uint16_t length = MQTT_MAX_HEADER_SIZE;
+  buf[length++] = tlen >> 8;
+  buf[length++] = tlen & 0xFF;
+  memcpy(buf + length, topic, tlen);
+  length += tlen;
+  uint16_t msgId = qosNextMsgId();
+  buf[length++] = msgId >> 8;
+  buf[length++] = msgId & 0xFF;
+
+  uint8_t hlen = writeHeader(buf, MQTTPUBLISH | MQTTQOS1 | (retained ? 1 : 0),
+                             length - MQTT_MAX_HEADER_SIZE + plength);
+  qosStart[slot] = MQTT_MAX_HEADER_SIZE - hlen;
+  qosLength[slot] = length;
+  qosMsgId[slot] = msgId;
+  qosFlags[slot] = 0;
+  qosStreaming = slot;
+  qosEnd = length + plength;
+  return slot;
+}
+
+// Adds the slot filled since qosBegin() to the queue, unless less
+// payload than announced was written: that slot is dropped
+boolean MqttAsyncClient::qosCommit()
+{
+  uint8_t slot = qosStreaming;
+  qosStreaming = -1;
+  if (qosLength[slot] != qosEnd) {
+    return false;
+  }
+  qosCount++;
+  qosSend();
+  return true;
+}
+
+void MqttAsyncClient::qosSend()
+{
+  if (!connected()) {
+    return;
+  }
+  for (uint8_t i = 0; i < qosCount && qosInflight < MQTT_MAX_INFLIGHT; i++) {
+    uint8_t slot = (qosHead + i) % MQTT_QOS1_QUEUE_SIZE;
+    if (qosFlags[slot] & (QOS_SENT | QOS_ACKED)) {
+      continue;
+    }
+    if (!txPut(qosSlot(slot) + qosStart[slot], qosLength[slot] - qosStart[slot])) {
+      break;
+    }
+    qosFlags[slot] |= QOS_SENT;
+    qosInflight++;
+  }
+  flush();
+}
+
+void MqttAsyncClient::qosAck(uint16_t msgId)
+{
+  for (uint8_t i = 0; i < qosCount; i++) {
+    uint8_t slot = (qosHead + i) % MQTT_QOS1_QUEUE_SIZE;
+    if (qosMsgId[slot] == msgId && (qosFlags[slot] & QOS_SENT)) {
+      qosFlags[slot] = QOS_ACKED;
+      qosInflight--;
+      acked++;
+      break;
+    }
+  }
+  while (qosCount > 0 && (qosFlags[qosHead] & QOS_ACKED)) {
+    qosHead = (qosHead + 1) % MQTT_QOS1_QUEUE_SIZE;
+    qosCount--;
+  }
+  qosSend();
+}
+
+void MqttAsyncClient::qosResend()
+{
+  for (uint8_t i = 0; i < qosCount; i++) {
+    uint8_t slot = (qosHead + i) % MQTT_QOS1_QUEUE_SIZE;
+    if (qosFlags[slot] & QOS_SENT) {
+      qosSlot(slot)[qosStart[slot]] |= 0x08;       // DUP
+      qosFlags[slot] &= ~QOS_SENT;
+      resent++;
+    }
+  }
+  qosInflight = 0;
+  qosSend();
+}
+#else
+// Built without a queue: QoS 1 messages are refused
+uint16_t MqttAsyncClient::qosNextMsgId()
+{
+  if (++nextMsgId == 0) {
+    nextMsgId = 1;
+  }
+  return nextMsgId;
+}
+
+int16_t MqttAsyncClient::qosBegin(const char*, unsigned int, boolean)
+{
+  return -1;
+}
+
+boolean MqttAsyncClient::qosCommit()
+{
+  qosStreaming = -1;
+  return false;
+}
+
+void MqttAsyncClient::qosAck(uint16_t)
+{
+}
+
+void MqttAsyncClient::qosResend()
+{
+}
+#endif
+
+uint8_t MqttAsyncClient::queued()
+{
+  return qosCount;
+}
+
+uint8_t MqttAsyncClient::inflight()
+{
+  return qosInflight;
+}
+
+#endif // MQTT_ASYNC
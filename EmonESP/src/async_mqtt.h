@@ -0,0 +1,154 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_ASYNC_MQTT_H
+#define _EMONESP_ASYNC_MQTT_H
+
+#include <Arduino.h>
+#include <PubSubClient.h>             // Packet types, states and sizes
+
+// -------------------------------------------------------------------
+// Event driven MQTT 3.1.1 client on ESPAsyncTCP
+//
+// Same surface as the PubSubClient calls made by mqtt.cpp, but nothing
+// waits on the network: connect() only starts the TCP connection and
+// the CONNECT/CONNACK exchange, incoming packets are parsed in the TCP
+// callbacks and outgoing packets go through a byte queue that is
+// drained as the TCP window opens. loop() runs the keepalive and
+// connect timers.
+//
+// QoS 1 messages are kept in MQTT_QOS1_QUEUE_SIZE slots of
+// MQTT_MAX_PACKET_SIZE, allocated on the first QoS 1 publish, with up
+// to MQTT_MAX_INFLIGHT in flight, and sent again after a reconnect.
+// Built with MQTT_QOS1_QUEUE_SIZE 0, QoS 1 publishes are refused.
+// -------------------------------------------------------------------
+
+#define MQTT_ASYNC_TX_SIZE 1024         // bytes queued for sending
+
+// connect() has started and the CONNACK has not arrived yet
+#define MQTT_CONNECTING -5
+
+class AsyncClient;
+
+class MqttAsyncClient : public Print {
+public:
+  MqttAsyncClient();
+
+  MqttAsyncClient& setServer(const char* domain, uint16_t port);
+  MqttAsyncClient& setCallback(void (*callback)(char*, uint8_t*, unsigned int));
+
+  // Starts connecting and returns false; connected() becomes true once
+  // the broker accepts the connection. The strings must stay valid
+  // until then
+  boolean connect(const char* id, const char* user, const char* pass);
+  void disconnect();
+  boolean connecting();
+  boolean connected();
+  int state();
+
+  boolean publish(const char* topic, const char* payload);
+  boolean publish(const char* topic, const char* payload, boolean retained, uint8_t qos);
+  boolean publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained, uint8_t qos);
+  boolean beginPublish(const char* topic, unsigned int plength, boolean retained);
+  boolean beginPublish(const char* topic, unsigned int plength, boolean retained, uint8_t qos);
+  int endPublish();
+  virtual size_t write(uint8_t data);
+  virtual size_t write(const uint8_t* buffer, size_t size);
+
+  boolean subscribe(const char* topic, uint8_t qos);
+
+  // Timers; call every time around loop()
+  boolean loop();
+
+  uint8_t queued();
+  uint8_t inflight();
+  unsigned long acked;
+  unsigned long resent;
+
+  // Called from the TCP callbacks
+  void onConnect();
+  void onData(const uint8_t* data, size_t len);
+  void onDisconnect();
+  void onAck();
+
+private:
+  AsyncClient* tcp;
+  const char* domain;
+  uint16_t port;
+  const char* id;
+  const char* user;
+  const char* pass;
+  void (*callback)(char*, uint8_t*, unsigned int);
+  int _state;
+  uint16_t nextMsgId;
+  unsigned long connectStart;
+  unsigned long lastOutActivity;
+  unsigned long lastInActivity;
+  boolean pingOutstanding;
+
+  // Outgoing bytes, a ring drained by flush()
+  uint8_t tx[MQTT_ASYNC_TX_SIZE];
+  uint16_t txHead;
+  uint16_t txCount;
+  int16_t txStreaming;                  // bytes still expected by write()
+  boolean txPut(const uint8_t* data, size_t len);
+  uint16_t txSpace();
+  void flush();
+
+  // Incoming packet being assembled
+  uint8_t rx[MQTT_MAX_PACKET_SIZE];
+  uint8_t rxState;
+  uint8_t rxHeader;
+  uint32_t rxLength;
+  uint32_t rxMultiplier;
+  uint32_t rxPos;
+  void handlePacket();
+
+  // QoS 1 queue, oldest first, as in PubSubClient
+#if MQTT_QOS1_QUEUE_SIZE > 0
+  uint8_t* qosPacket;                   // allocated when first needed
+  uint8_t* qosSlot(uint8_t slot) { return qosPacket + (size_t)slot * MQTT_MAX_PACKET_SIZE; }
+  uint16_t qosLength[MQTT_QOS1_QUEUE_SIZE];
+  uint16_t qosMsgId[MQTT_QOS1_QUEUE_SIZE];
+  uint8_t qosStart[MQTT_QOS1_QUEUE_SIZE];
+  uint8_t qosFlags[MQTT_QOS1_QUEUE_SIZE];
+  uint8_t qosHead;
+  void qosSend();
+#endif
+  uint8_t qosCount;
+  uint8_t qosInflight;
+  int16_t qosStreaming;                 // slot being filled by write()
+  uint16_t qosEnd;                      // its length once the payload is in
+  uint16_t qosNextMsgId();
+  int16_t qosBegin(const char* topic, unsigned int plength, boolean retained);
+  boolean qosCommit();
+  void qosAck(uint16_t msgId);
+  void qosResend();
+
+  uint16_t writeHeader(uint8_t* buf, uint8_t header, uint32_t length);
+  void closed(int state);
+};
+
+#endif // _EMONESP_ASYNC_MQTT_H
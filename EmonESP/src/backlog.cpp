@@ -0,0 +1,456 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "backlog.h"
+#include "ntp.h"
+
+#include <FS.h>
+#include <ecohouse_link.h>                // ehl_crc16_data()
+#include <ecohouse_block.h>
+
+#define BACKLOG_DIR   "/bl/"
+#define BACKLOG_BOOT  "/blboot"
+#define BACKLOG_TMP   "/bltmp"            // segment being compacted
+#define BACKLOG_MAGIC 0xB10C
+
+struct BacklogRecord {
+  uint16_t magic;
+  uint16_t boot;
+  uint16_t crc;                           // over sample
+  uint16_t reserved;
+  EmoncmsSample sample;
+};
+
+unsigned long backlog_written = 0;
+unsigned long backlog_sent = 0;
+unsigned long backlog_lost = 0;
+unsigned long backlog_saved = 0;
+
+static uint16_t boot_id = 0;
+static boolean have_segments = false;
+static unsigned long rd_seg = 0;        // oldest segment
+static uint16_t rd_index = 0;           // next record to read in rd_seg
+static unsigned long wr_seg = 0;        // segment being appended to
+static unsigned long pending = 0;
+
+// Records of the last backlog_read() of rd_seg, until they are consumed
+// or given back: while set, the rows of rd_seg must not move
+static boolean reading = false;
+static uint8_t read_invalid = 0;        // of them, corrupt or stale
+
+// Compaction and reads of compacted segments, one at a time
+static EcohouseBlock block;
+static uint8_t block_data[EHB_MAX_BLOCK];
+
+static String segment_name(unsigned long seg)
+{
+  char name[20];
+  snprintf(name, sizeof(name), BACKLOG_DIR "%08lx", seg);
+  return String(name);
+}
+
+// A segment holds BacklogRecords while it is written, then blocks
+static boolean segment_compacted(File& f)
+{
+  uint16_t magic = 0;
+  f.seek(0, SeekSet);
+  f.read((uint8_t *)&magic, sizeof(magic));
+  f.seek(0, SeekSet);
+  return magic == EHB_FRAME_MAGIC;
+}
+
+// Read the next frame header of a compacted segment
+static boolean segment_frame(File& f, EcohouseBlockFrame& frame)
+{
+  return f.read((uint8_t *)&frame, sizeof(frame)) == sizeof(frame) &&
+    frame.magic == EHB_FRAME_MAGIC && frame.length <= EHB_MAX_BLOCK &&
+    f.position() + frame.length <= f.size();
+}
+
+static uint16_t segment_records(unsigned long seg)
+{
+  File f = SPIFFS.open(segment_name(seg), "r");
+  if (!f) {
+    return 0;
+  }
+  uint16_t n = 0;
+  if (segment_compacted(f)) {
+    // Up to the first damaged header, nothing after it can be found
+    EcohouseBlockFrame frame;
+    while (segment_frame(f, frame)) {
+      n += frame.rows;
+      f.seek(frame.length, SeekCur);
+    }
+  } else {
+    n = f.size() / sizeof(BacklogRecord);
+  }
+  f.close();
+  return n;
+}
+
+// A sample set split for EcohouseBlock::add()
+struct BlockRow {
+  unsigned long time;
+  uint8_t count;
+  char keys[EHB_MAX_KEYS][EHB_KEY_SIZE];
+  const char *key_ptrs[EHB_MAX_KEYS];
+  int32_t values[EHB_MAX_KEYS];
+};
+
+// Split a sample set rendered as {"key":value,...} into a block row.
+// Returns false if a block cannot give it back as it is: a value that is
+// not a number or has more than two decimals, a key too long for the
+// dictionary or more than EHB_MAX_KEYS fields
+static boolean block_row(const EmoncmsSample& sample, BlockRow& row)
+{
+  row.time = sample.time;
+  row.count = 0;
+
+  const char *p = sample.json;
+  while ((p = strchr(p, '"')) != NULL) {
+    const char *key = p + 1;
+    const char *key_end = strchr(key, '"');
+    if (key_end == NULL || key_end[1] != ':' || row.count == EHB_MAX_KEYS) {
+      return false;
+    }
+    const char *value = key_end + 2;
+    p = value + strcspn(value, ",}");
+    size_t len = key_end - key;
+    if (len == 0 || len >= EHB_KEY_SIZE ||
+        !ehb_parse_exact(value, p - value, row.values[row.count])) {
+      return false;
+    }
+    memcpy(row.keys[row.count], key, len);
+    row.keys[row.count][len] = '\0';
+    row.key_ptrs[row.count] = row.keys[row.count];
+    row.count++;
+  }
+  return true;
+}
+
+static boolean block_add(const BlockRow& row)
+{
+  return block.add(row.time, row.count, row.key_ptrs, row.values);
+}
+
+// Render a block row back into a sample set
+static void block_sample(uint8_t row, EmoncmsSample& sample)
+{
+  size_t len = 0;
+  sample.time = block.time(row);
+  sample.json[len++] = '{';
+  for (uint8_t i = 0; i < block.fields(row); i++) {
+    char value[14];
+    ehl_format_value(block.value(row, i), value);
+    int n = snprintf(sample.json + len, sizeof(sample.json) - len, "%s\"%s\":%s",
+                     i > 0 ? "," : "", block.key(row, i), value);
+    if (n < 0 || len + n >= sizeof(sample.json) - 1) {
+      break;
+    }
+    len += n;
+  }
+  sample.json[len++] = '}';
+  sample.json[len] = '\0';
+}
+
+// The frame is tagged with the boot its rows were captured in
+static boolean block_write(File& out, uint16_t boot)
+{
+  EcohouseBlockFrame frame;
+  size_t len = block.encode(block_data, sizeof(block_data));
+  ehb_frame(frame, boot, block_data, len, block.rows());
+  boolean ok = out.write((const uint8_t *)&frame, sizeof(frame)) == sizeof(frame) &&
+    out.write(block_data, len) == len;
+  block.begin();
+  return ok;
+}
+
+// -------------------------------------------------------------------
+// Rewrite a full segment of BacklogRecords as blocks, a few KB instead
+// of BACKLOG_SEGMENT_RECORDS fixed size records. Records that could not
+// be sent anyway are dropped on the way. If any other record would not
+// come back from a block as it went in, the segment is left as it is
+// -------------------------------------------------------------------
+static void segment_compact(unsigned long seg)
+{
+  File in = SPIFFS.open(segment_name(seg), "r");
+  if (!in || segment_compacted(in)) {
+    return;
+  }
+  File out = SPIFFS.open(BACKLOG_TMP, "w");
+  if (!out) {
+    in.close();
+    return;
+  }
+
+  unsigned long start = millis();
+  uint16_t before = in.size() / sizeof(BacklogRecord);
+  uint16_t after = 0;
+  boolean ok = true;
+  boolean exact = true;
+  uint16_t boot = 0;                      // of the rows in block
+  BacklogRecord rec;
+  static BlockRow row;
+  block.begin();
+  while (ok && in.read((uint8_t *)&rec, sizeof(rec)) == sizeof(rec)) {
+    if (rec.magic != BACKLOG_MAGIC ||
+        rec.crc != ehl_crc16_data((const uint8_t *)&rec.sample, sizeof(rec.sample), 0) ||
+        (rec.boot != boot_id && !ntp_is_unix(rec.sample.time))) {
+      continue;
+    }
+    if (!block_row(rec.sample, row)) {
+      exact = ok = false;
+      break;
+    }
+    if (block.rows() > 0 && (rec.boot != boot || !block_add(row))) {
+      // Block full, or the row is from another boot: store the block and
+      // start the next one with this row
+      ok = block_write(out, boot);
+    }
+    if (ok && block.rows() == 0) {
+      boot = rec.boot;
+      ok = block_add(row);
+    }
+    after++;
+  }
+  if (ok && block.rows() > 0) {
+    ok = block_write(out, boot);
+  }
+  size_t bytes = out.size();
+  in.close();
+  out.close();
+
+  if (!ok || after == 0) {
+    // Keep the records as they are
+    SPIFFS.remove(BACKLOG_TMP);
+    block.begin();
+    if (!exact) {
+      DEBUG.printf("Backlog: segment %lu not compacted, a record does not fit a block exactly\n", seg);
+    }
+    return;
+  }
+  SPIFFS.remove(segment_name(seg));
+  SPIFFS.rename(BACKLOG_TMP, segment_name(seg));
+  pending -= before - after;
+  backlog_lost += before - after;
+  backlog_saved += (unsigned long)before * sizeof(BacklogRecord) - bytes;
+  DEBUG.printf("Backlog: segment %lu compacted, %u records in %u bytes, %lu ms\n",
+               seg, after, (unsigned)bytes, millis() - start);
+}
+
+// Delete the oldest segment and move the read cursor to the next one
+static void drop_read_segment()
+{
+  uint16_t records = segment_records(rd_seg);
+  pending -= records > rd_index ? records - rd_index : 0;
+  reading = false;
+  SPIFFS.remove(segment_name(rd_seg));
+  if (rd_seg == wr_seg) {
+    have_segments = false;
+  } else {
+    rd_seg++;
+  }
+  rd_index = 0;
+}
+
+void backlog_setup()
+{
+  // Count boots so records from earlier ones can be told apart
+  File f = SPIFFS.open(BACKLOG_BOOT, "r");
+  if (f) {
+    f.read((uint8_t *)&boot_id, sizeof(boot_id));
+    f.close();
+  }
+  boot_id++;
+  f = SPIFFS.open(BACKLOG_BOOT, "w");
+  if (f) {
+    f.write((const uint8_t *)&boot_id, sizeof(boot_id));
+    f.close();
+  }
+
+  Dir dir = SPIFFS.openDir(BACKLOG_DIR);
+  while (dir.next()) {
+    unsigned long seg = strtoul(dir.fileName().c_str() + strlen(BACKLOG_DIR), NULL, 16);
+    if (!have_segments || seg < rd_seg) rd_seg = seg;
+    if (!have_segments || seg > wr_seg) wr_seg = seg;
+    have_segments = true;
+    pending += segment_records(seg);
+  }
+  rd_index = 0;
+  // Left by a compaction that did not finish
+  SPIFFS.remove(BACKLOG_TMP);
+
+  DEBUG.printf("Backlog: %lu records in segments %lu..%lu\n", pending, rd_seg, wr_seg);
+}
+
+boolean backlog_append(const EmoncmsSample& sample)
+{
+  if (!have_segments) {
+    rd_seg = wr_seg = wr_seg + 1;
+    rd_index = 0;
+    have_segments = true;
+  } else if (segment_records(wr_seg) >= BACKLOG_SEGMENT_RECORDS) {
+    // Unless it is being read from: rows would move under rd_index, or
+    // under the span of an upload still in flight
+    if (wr_seg != rd_seg || (rd_index == 0 && !reading)) {
+      segment_compact(wr_seg);
+    }
+    wr_seg++;
+    if (wr_seg - rd_seg >= BACKLOG_SEGMENTS) {
+      unsigned long before = pending;
+      drop_read_segment();
+      backlog_lost += before - pending;
+      DEBUG.println("Backlog full, oldest segment discarded");
+    }
+  }
+
+  BacklogRecord rec;
+  rec.magic = BACKLOG_MAGIC;
+  rec.boot = boot_id;
+  rec.reserved = 0;
+  rec.sample = sample;
+  rec.crc = ehl_crc16_data((const uint8_t *)&rec.sample, sizeof(rec.sample), 0);
+
+  File f = SPIFFS.open(segment_name(wr_seg), "a");
+  if (!f) {
+    backlog_lost++;
+    return false;
+  }
+  size_t written = f.write((const uint8_t *)&rec, sizeof(rec));
+  f.close();
+  if (written != sizeof(rec)) {
+    backlog_lost++;
+    return false;
+  }
+
+  backlog_written++;
+  pending++;
+  return true;
+}
+
+// backlog_read() for a compacted segment
+static uint8_t block_read(File& f, EmoncmsSample *out, uint8_t max, uint8_t& span)
+{
+  uint8_t count = 0;
+  uint16_t row = 0;                       // first row of the frame
+  EcohouseBlockFrame frame;
+  while (count < max && segment_frame(f, frame)) {
+    if (row + frame.rows <= rd_index + span) {
+      // Already sent
+      row += frame.rows;
+      f.seek(frame.length, SeekCur);
+      continue;
+    }
+    boolean valid = f.read(block_data, frame.length) == frame.length &&
+      ehb_frame_valid(frame, block_data) && block.decode(block_data, frame.length) &&
+      block.rows() == frame.rows;
+    for (uint8_t r = rd_index + span - row; r < frame.rows && count < max; r++) {
+      span++;
+      if (!valid || (frame.tag != boot_id && !ntp_is_unix(block.time(r)))) {
+        continue;
+      }
+      block_sample(r, out[count++]);
+    }
+    row += frame.rows;
+  }
+  return count;
+}
+
+uint8_t backlog_read(EmoncmsSample *out, uint8_t max, uint8_t& span)
+{
+  uint8_t count = 0;
+  span = 0;
+  reading = false;
+  if (!have_segments) {
+    return 0;
+  }
+
+  File f = SPIFFS.open(segment_name(rd_seg), "r");
+  if (!f) {
+    // Gone or unreadable: nothing in it can be sent, move on. How many
+    // records it held is unknown, count those left instead
+    unsigned long before = pending;
+    drop_read_segment();
+    pending = 0;
+    for (unsigned long seg = rd_seg; have_segments && seg <= wr_seg; seg++) {
+      pending += segment_records(seg);
+    }
+    if (before > pending) {
+      backlog_lost += before - pending;
+    }
+    DEBUG.println("Backlog: segment unreadable, discarded");
+    return 0;
+  }
+  if (segment_compacted(f)) {
+    count = block_read(f, out, max, span);
+  } else {
+    f.seek(rd_index * sizeof(BacklogRecord), SeekSet);
+    BacklogRecord rec;
+    while (count < max && f.read((uint8_t *)&rec, sizeof(rec)) == sizeof(rec)) {
+      span++;
+      if (rec.magic != BACKLOG_MAGIC ||
+          rec.crc != ehl_crc16_data((const uint8_t *)&rec.sample, sizeof(rec.sample), 0) ||
+          (rec.boot != boot_id && !ntp_is_unix(rec.sample.time))) {
+        continue;
+      }
+      out[count++] = rec.sample;
+    }
+  }
+  f.close();
+  reading = span > 0;
+  read_invalid = span - count;
+  return count;
+}
+
+void backlog_unread()
+{
+  reading = false;
+}
+
+void backlog_consume(uint8_t span)
+{
+  if (!have_segments || !reading || span == 0) {
+    // Nothing read, or the segment was discarded in the meantime
+    reading = false;
+    return;
+  }
+  reading = false;
+
+  // Corrupt and stale records are counted once, as they go
+  backlog_lost += read_invalid;
+  rd_index += span;
+  pending -= span;
+  // A drained segment is deleted; if it was also the one being written
+  // the next append starts a new segment
+  if (rd_index >= segment_records(rd_seg)) {
+    drop_read_segment();
+  }
+}
+
+unsigned long backlog_pending()
+{
+  return pending;
+}
@@ -0,0 +1,110 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_BACKLOG_H
+#define _EMONESP_BACKLOG_H
+
+#include <Arduino.h>
+#include "emoncms.h"
+
+// -------------------------------------------------------------------
+// Store-and-forward backlog in SPIFFS
+//
+// Sample sets that could not be uploaded are appended, as fixed size
+// records, to segment files /bl/<number>. Segments are only ever
+// appended to and deleted whole once drained, so no flash page is
+// rewritten in place. When all BACKLOG_SEGMENTS are in use the oldest
+// segment is discarded.
+//
+// A full segment is compacted: its records are rewritten, through a
+// temporary file, as ecohouse_block blocks (key dictionary, delta of
+// delta times, varint value deltas in hundredths), which take a few
+// bytes per sample set instead of a fixed size record. Compaction is
+// lossless but for the text of the values, which come back with two
+// decimals ("21.5" as "21.50"): a segment holding a value that is not a
+// number or has further non-zero decimals, a key longer than 15
+// characters or more than 32 fields in a set is not compacted at all.
+// Each block is tagged with the boot its sample sets were captured in.
+//
+// Records stamped with seconds since boot cannot be placed in time
+// after a reboot and are discarded on drain; those stamped with Unix
+// time (see ntp.h) are kept and sent once the clock is set again.
+// -------------------------------------------------------------------
+
+// Estimate, from the generated day of ehb_tool bench rather than from a
+// recorded capture: compacted, a segment of 16-field sample sets takes
+// about 4 KB, so at one set every 10 s the backlog would hold some 34
+// hours in under 400 KB of SPIFFS. Real readings that change more
+// compress less. The segment being written stays as 26 KB of records
+// until it is full
+#define BACKLOG_SEGMENTS        96
+#define BACKLOG_SEGMENT_RECORDS 128
+
+// At most BACKLOG_DRAIN_BATCH records per request, one request every
+// BACKLOG_DRAIN_INTERVAL ms, and only while the live queue is idle
+#define BACKLOG_DRAIN_BATCH     5
+#define BACKLOG_DRAIN_INTERVAL  15000
+
+extern unsigned long backlog_written;   // records appended
+extern unsigned long backlog_sent;      // records delivered
+extern unsigned long backlog_lost;      // discarded: full, corrupt or stale
+extern unsigned long backlog_saved;     // flash bytes saved by compaction
+
+// -------------------------------------------------------------------
+// Find the segments left by previous boots. Call after SPIFFS.begin()
+// -------------------------------------------------------------------
+extern void backlog_setup();
+
+// -------------------------------------------------------------------
+// Append one sample set. Returns false if it could not be written
+// -------------------------------------------------------------------
+extern boolean backlog_append(const EmoncmsSample& sample);
+
+// -------------------------------------------------------------------
+// Read up to max of the oldest sample sets into out, without removing
+// them. span receives how many stored records were looked at, valid or
+// not, and must be passed to backlog_consume() once they are sent.
+// Returns the number of sample sets in out.
+// -------------------------------------------------------------------
+extern uint8_t backlog_read(EmoncmsSample *out, uint8_t max, uint8_t& span);
+
+// -------------------------------------------------------------------
+// Drop the span records returned by the last backlog_read(). Until
+// then, or backlog_unread(), the segment they are in is not compacted
+// -------------------------------------------------------------------
+extern void backlog_consume(uint8_t span);
+
+// -------------------------------------------------------------------
+// Give back the records of the last backlog_read(), e.g. after a
+// failed upload: they are read again next time
+// -------------------------------------------------------------------
+extern void backlog_unread();
+
+// -------------------------------------------------------------------
+// Number of records waiting in flash
+// -------------------------------------------------------------------
+extern unsigned long backlog_pending();
+
+#endif // _EMONESP_BACKLOG_H
@@ -0,0 +1,153 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "cbor.h"
+
+#include <string.h>
+
+// Major types, in the top 3 bits of the initial byte
+#define CBOR_UINT   0x00
+#define CBOR_NEGINT 0x20
+#define CBOR_TEXT   0x60
+#define CBOR_MAP    0xA0
+#define CBOR_FLOAT  0xFA                // followed by 4 bytes
+#define CBOR_DOUBLE 0xFB                // followed by 8 bytes
+
+static void cbor_put(CborWriter& w, const uint8_t *data, size_t len)
+{
+  if (w.out != NULL) {
+    w.out->write(data, len);
+  }
+  w.length += len;
+}
+
+// Initial byte and argument, in the shortest form
+static void cbor_head(CborWriter& w, uint8_t major, uint64_t n)
+{
+  uint8_t buf[9];
+  size_t len;
+  if (n < 24) {
+    buf[0] = major | n;
+    len = 1;
+  } else {
+    uint8_t bytes = n <= 0xFF ? 1 : n <= 0xFFFF ? 2 : n <= 0xFFFFFFFFUL ? 4 : 8;
+    buf[0] = major | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27);
+    for (uint8_t i = 0; i < bytes; i++) {
+      buf[bytes - i] = n >> (8 * i);
+    }
+    len = 1 + bytes;
+  }
+  cbor_put(w, buf, len);
+}
+
+void cbor_begin(CborWriter& w, Print *out)
+{
+  w.out = out;
+  w.length = 0;
+}
+
+void cbor_map(CborWriter& w, size_t pairs)
+{
+  cbor_head(w, CBOR_MAP, pairs);
+}
+
+void cbor_text(CborWriter& w, const char *text)
+{
+  size_t len = strlen(text);
+  cbor_head(w, CBOR_TEXT, len);
+  cbor_put(w, (const uint8_t *)text, len);
+}
+
+void cbor_uint(CborWriter& w, uint32_t n)
+{
+  cbor_head(w, CBOR_UINT, n);
+}
+
+void cbor_number(CborWriter& w, const char *decimal)
+{
+  // Split into an integer mantissa and a count of decimals
+  const char *p = decimal;
+  boolean negative = *p == '-';
+  if (negative) {
+    p++;
+  }
+  uint64_t mantissa = 0;
+  int8_t decimals = -1;                 // -1: no decimal point
+  uint8_t digits = 0;
+  for (; *p != '\0'; p++) {
+    if (*p == '.' && decimals < 0) {
+      decimals = 0;
+    } else if (*p >= '0' && *p <= '9' && digits < 18) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits++;
+      if (decimals >= 0) {
+        decimals++;
+      }
+    } else {
+      break;
+    }
+  }
+  if (*p != '\0' || digits == 0 || decimals > 9) {
+    cbor_text(w, decimal);
+    return;
+  }
+
+  if (decimals < 0) {
+    if (negative && mantissa > 0) {
+      cbor_head(w, CBOR_NEGINT, mantissa - 1);
+    } else {
+      cbor_head(w, CBOR_UINT, mantissa);
+    }
+    return;
+  }
+
+  double scale = 1;
+  for (int8_t i = 0; i < decimals; i++) {
+    scale *= 10;
+  }
+  double value = (negative ? -(double)mantissa : (double)mantissa) / scale;
+  float single = value;
+  double back = (double)single * scale;
+  uint64_t rounded = (uint64_t)((back < 0 ? -back : back) + 0.5);
+
+  uint8_t buf[9];
+  if (rounded == mantissa) {
+    uint32_t bits;
+    memcpy(&bits, &single, sizeof(bits));
+    buf[0] = CBOR_FLOAT;
+    for (uint8_t i = 0; i < 4; i++) {
+      buf[4 - i] = bits >> (8 * i);
+    }
+    cbor_put(w, buf, 5);
+  } else {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    buf[0] = CBOR_DOUBLE;
+    for (uint8_t i = 0; i < 8; i++) {
+      buf[8 - i] = bits >> (8 * i);
+    }
+    cbor_put(w, buf, 9);
+  }
+}
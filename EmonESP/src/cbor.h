@@ -0,0 +1,64 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_CBOR_H
+#define _EMONESP_CBOR_H
+
+#include <Arduino.h>
+#include <Print.h>
+
+// -------------------------------------------------------------------
+// Streaming CBOR (RFC 8949) writer
+//
+// Each item is written straight to a Print, e.g. the MQTT client
+// between beginPublish() and endPublish() or an AsyncResponseStream;
+// nothing is buffered. With no Print the bytes are only counted, so
+// the payload length can be known before it is sent.
+//
+// Values arrive as the decimal text of the input line and are sent as
+// numbers: without a decimal point as integers, otherwise as a 32-bit
+// float when that gives back the same decimals and a 64-bit one when
+// it does not. Anything else is sent as a text string.
+// -------------------------------------------------------------------
+
+#define CBOR_CONTENT_TYPE "application/cbor"
+
+struct CborWriter {
+  Print *out;                           // NULL: count only
+  size_t length;                        // bytes written so far
+};
+
+extern void cbor_begin(CborWriter& w, Print *out);
+
+// A map of pairs key/value items follows
+extern void cbor_map(CborWriter& w, size_t pairs);
+
+extern void cbor_text(CborWriter& w, const char *text);
+extern void cbor_uint(CborWriter& w, uint32_t n);
+
+// A number from its decimal text, e.g. "-12.30"
+extern void cbor_number(CborWriter& w, const char *decimal);
+
+#endif // _EMONESP_CBOR_H
@@ -25,6 +25,9 @@
 
 #include "emonesp.h"
 #include "config.h"
+#include "mqtt.h"
+#include "deadband.h"
+#include "aggregate.h"
 
 #include <Arduino.h>
 #include <EEPROM.h>                   // Save config settings
@@ -49,6 +52,14 @@ String mqtt_topic = "";
 String mqtt_user = "";
 String mqtt_pass = "";
 String mqtt_feed_prefix = "";
+String mqtt_format = "";
+
+// Report by exception
+String deadband = "";
+String deadband_heartbeat = "";
+
+// Aggregation windows
+String aggregate_window = "";
 
 #define EEPROM_ESID_SIZE          32
 #define EEPROM_EPASS_SIZE         64
@@ -63,6 +74,10 @@ String mqtt_feed_prefix = "";
 #define EEPROM_MQTT_FEED_PREFIX_SIZE  10
 #define EEPROM_WWW_USER_SIZE      16
 #define EEPROM_WWW_PASS_SIZE      16
+#define EEPROM_MQTT_FORMAT_SIZE   8
+#define EEPROM_DEADBAND_SIZE      8
+#define EEPROM_DEADBAND_HEARTBEAT_SIZE 6
+#define EEPROM_AGGREGATE_WINDOW_SIZE   6
 #define EEPROM_SIZE 512
 
 #define EEPROM_ESID_START         0
@@ -91,6 +106,14 @@ String mqtt_feed_prefix = "";
 #define EEPROM_WWW_USER_END       (EEPROM_WWW_USER_START + EEPROM_WWW_USER_SIZE)
 #define EEPROM_WWW_PASS_START     EEPROM_WWW_USER_END
 #define EEPROM_WWW_PASS_END       (EEPROM_WWW_PASS_START + EEPROM_WWW_PASS_SIZE)
+#define EEPROM_MQTT_FORMAT_START  EEPROM_WWW_PASS_END
+#define EEPROM_MQTT_FORMAT_END    (EEPROM_MQTT_FORMAT_START + EEPROM_MQTT_FORMAT_SIZE)
+#define EEPROM_DEADBAND_START     EEPROM_MQTT_FORMAT_END
+#define EEPROM_DEADBAND_END       (EEPROM_DEADBAND_START + EEPROM_DEADBAND_SIZE)
+#define EEPROM_DEADBAND_HEARTBEAT_START EEPROM_DEADBAND_END
+#define EEPROM_DEADBAND_HEARTBEAT_END   (EEPROM_DEADBAND_HEARTBEAT_START + EEPROM_DEADBAND_HEARTBEAT_SIZE)
+#define EEPROM_AGGREGATE_WINDOW_START   EEPROM_DEADBAND_HEARTBEAT_END
+#define EEPROM_AGGREGATE_WINDOW_END     (EEPROM_AGGREGATE_WINDOW_START + EEPROM_AGGREGATE_WINDOW_SIZE)
 
 // -------------------------------------------------------------------
 // Reset EEPROM, wipes all settings
@@ -149,6 +172,15 @@ void config_load_settings()
   EEPROM_read_string(EEPROM_MQTT_FEED_PREFIX_START, EEPROM_MQTT_FEED_PREFIX_SIZE, mqtt_feed_prefix);
   EEPROM_read_string(EEPROM_MQTT_USER_START, EEPROM_MQTT_USER_SIZE, mqtt_user);
   EEPROM_read_string(EEPROM_MQTT_PASS_START, EEPROM_MQTT_PASS_SIZE, mqtt_pass);
+  EEPROM_read_string(EEPROM_MQTT_FORMAT_START, EEPROM_MQTT_FORMAT_SIZE, mqtt_format);
+  mqtt_topic_setup();
+
+  // Filter settings
+  EEPROM_read_string(EEPROM_DEADBAND_START, EEPROM_DEADBAND_SIZE, deadband);
+  EEPROM_read_string(EEPROM_DEADBAND_HEARTBEAT_START, EEPROM_DEADBAND_HEARTBEAT_SIZE, deadband_heartbeat);
+  EEPROM_read_string(EEPROM_AGGREGATE_WINDOW_START, EEPROM_AGGREGATE_WINDOW_SIZE, aggregate_window);
+  deadband_setup();
+  aggregate_setup();
 
   // Web server credentials
   EEPROM_read_string(EEPROM_WWW_USER_START, EEPROM_WWW_USER_SIZE, www_username);
@@ -177,13 +209,15 @@ void config_save_emoncms(String server, String node, String apikey, String finge
   EEPROM.commit();
 }
 
-void config_save_mqtt(String server, String topic, String prefix, String user, String pass)
+void config_save_mqtt(String server, String topic, String prefix, String user, String pass, String format)
 {
   mqtt_server = server;
   mqtt_topic = topic;
   mqtt_feed_prefix = prefix;
   mqtt_user = user;
   mqtt_pass = pass;
+  mqtt_format = format;
+  mqtt_topic_setup();
 
   // Save MQTT server max 45 characters
   EEPROM_write_string(EEPROM_MQTT_SERVER_START, EEPROM_MQTT_SERVER_SIZE, mqtt_server);
@@ -200,6 +234,29 @@ void config_save_mqtt(String server, String topic, String prefix, String user, S
   // Save MQTT pass max 64 characters
   EEPROM_write_string(EEPROM_MQTT_PASS_START, EEPROM_MQTT_PASS_SIZE, mqtt_pass);
 
+  // Save MQTT payload format max 8 characters
+  EEPROM_write_string(EEPROM_MQTT_FORMAT_START, EEPROM_MQTT_FORMAT_SIZE, mqtt_format);
+
+  EEPROM.commit();
+}
+
+void config_save_filter(String band, String heartbeat, String window)
+{
+  deadband = band;
+  deadband_heartbeat = heartbeat;
+  aggregate_window = window;
+  deadband_setup();
+  aggregate_setup();
+
+  // Save deadband max 8 characters, e.g. 0.5 or 2%
+  EEPROM_write_string(EEPROM_DEADBAND_START, EEPROM_DEADBAND_SIZE, deadband);
+
+  // Save heartbeat in seconds max 6 characters
+  EEPROM_write_string(EEPROM_DEADBAND_HEARTBEAT_START, EEPROM_DEADBAND_HEARTBEAT_SIZE, deadband_heartbeat);
+
+  // Save aggregation window in seconds max 6 characters
+  EEPROM_write_string(EEPROM_AGGREGATE_WINDOW_START, EEPROM_AGGREGATE_WINDOW_SIZE, aggregate_window);
+
   EEPROM.commit();
 }
 
@@ -56,6 +56,24 @@ extern String mqtt_topic;
 extern String mqtt_user;
 extern String mqtt_pass;
 extern String mqtt_feed_prefix;
+extern String mqtt_format;
+
+// Report by exception, see deadband.h
+extern String deadband;
+extern String deadband_heartbeat;
+
+// Aggregation window in seconds, see aggregate.h
+extern String aggregate_window;
+
+// MQTT payload formats
+// keys    - one message per key on <base-topic>/<prefix><key> (default)
+// json    - one message on <base-topic>: {"CT1":3935,"T1":12.5,...}
+// compact - one message on <base-topic>: CT1:3935,T1:12.5,...
+// cbor    - one message on <base-topic>: the json map in CBOR, see cbor.h
+#define MQTT_FORMAT_KEYS    "keys"
+#define MQTT_FORMAT_JSON    "json"
+#define MQTT_FORMAT_COMPACT "compact"
+#define MQTT_FORMAT_CBOR    "cbor"
 
 // -------------------------------------------------------------------
 // Load saved settings
@@ -70,7 +88,12 @@ extern void config_save_emoncms(String server, String node, String apikey, Strin
 // -------------------------------------------------------------------
 // Save the MQTT broker details
 // -------------------------------------------------------------------
-extern void config_save_mqtt(String server, String topic, String prefix, String user, String pass);
+extern void config_save_mqtt(String server, String topic, String prefix, String user, String pass, String format);
+
+// -------------------------------------------------------------------
+// Save the filter applied to readings before they reach the sinks
+// -------------------------------------------------------------------
+extern void config_save_filter(String band, String heartbeat, String window);
 
 // -------------------------------------------------------------------
 // Save the admin/web interface details
@@ -90,8 +90,12 @@ function ConfigViewModel() {
     "mqtt_server": "",
     "mqtt_topic": "",
     "mqtt_feed_prefix": "",
+    "mqtt_format": "",
     "mqtt_user": "",
     "mqtt_pass": "",
+    "deadband": "",
+    "deadband_heartbeat": "",
+    "aggregate_window": "",
     "www_username": "",
     "www_password": "",
     "espflash": "",
@@ -272,7 +276,8 @@ function EmonEspViewModel() {
       topic: self.config.mqtt_topic(),
       prefix: self.config.mqtt_feed_prefix(),
       user: self.config.mqtt_user(),
-      pass: self.config.mqtt_pass()
+      pass: self.config.mqtt_pass(),
+      format: self.config.mqtt_format()
     };
 
     if (mqtt.server === "") {
@@ -289,6 +294,37 @@ function EmonEspViewModel() {
       });
     }
   };
+
+  // -----------------------------------------------------------------------
+  // Event: Filter save
+  // -----------------------------------------------------------------------
+  self.saveFilterFetching = ko.observable(false);
+  self.saveFilterSuccess = ko.observable(false);
+  self.saveFilter = function () {
+    var filter = {
+      deadband: self.config.deadband(),
+      heartbeat: self.config.deadband_heartbeat(),
+      window: self.config.aggregate_window()
+    };
+
+    if (filter.deadband !== "" && !/^[0-9]*\.?[0-9]+%?$/.test(filter.deadband)) {
+      alert("Please enter a deadband such as 0.5 or 2%");
+    } else if (filter.heartbeat !== "" && !/^[0-9]+$/.test(filter.heartbeat)) {
+      alert("Please enter the heartbeat in seconds");
+    } else if (filter.window !== "" && !/^[0-9]+$/.test(filter.window)) {
+      alert("Please enter the aggregation window in seconds");
+    } else {
+      self.saveFilterFetching(true);
+      self.saveFilterSuccess(false);
+      $.post(baseEndpoint + "/savefilter", filter, function (data) {
+        self.saveFilterSuccess(true);
+      }).fail(function () {
+        alert("Failed to save filter config");
+      }).always(function () {
+        self.saveFilterFetching(false);
+      });
+    }
+  };
 }
 
 $(function () {
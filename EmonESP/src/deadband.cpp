@@ -0,0 +1,130 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "deadband.h"
+#include "config.h"
+
+#include <stdlib.h>
+
+unsigned long deadband_sent = 0;
+unsigned long deadband_suppressed = 0;
+unsigned long deadband_untracked = 0;
+
+struct DeadbandEntry {
+  char key[DEADBAND_KEY_SIZE];
+  float value;                  // last value sent
+  unsigned long sent_at;        // ms
+};
+
+static DeadbandEntry table[DEADBAND_KEYS];
+static uint8_t table_count = 0;
+
+static boolean enabled = false;
+static float band = 0;          // absolute, or a fraction when relative
+static boolean relative = false;
+static unsigned long heartbeat = DEADBAND_HEARTBEAT * 1000UL;
+
+void deadband_setup()
+{
+  enabled = deadband.length() > 0;
+  band = deadband.toFloat();
+  relative = deadband.endsWith("%");
+  if (relative) {
+    band /= 100;
+  }
+  if (band < 0) {
+    band = -band;
+  }
+
+  long seconds = deadband_heartbeat.toInt();
+  heartbeat = (seconds > 0 ? seconds : DEADBAND_HEARTBEAT) * 1000UL;
+
+  table_count = 0;
+}
+
+static DeadbandEntry* deadband_entry(const char* key)
+{
+  for (uint8_t i = 0; i < table_count; i++) {
+    if (strcmp(table[i].key, key) == 0) {
+      return &table[i];
+    }
+  }
+  if (table_count == DEADBAND_KEYS || strlen(key) >= DEADBAND_KEY_SIZE) {
+    return NULL;
+  }
+
+  // First time the key is seen: it is always sent
+  DeadbandEntry* entry = &table[table_count++];
+  strlcpy(entry->key, key, sizeof(entry->key));
+  entry->sent_at = millis() - heartbeat;
+  return entry;
+}
+
+// True if the field has to be sent
+static boolean deadband_pass(const RecordField& field)
+{
+  char* end;
+  float value = strtod(field.value, &end);
+  if (end == field.value || *end != '\0') {
+    return true;
+  }
+
+  DeadbandEntry* entry = deadband_entry(field.key);
+  if (entry == NULL) {
+    deadband_untracked++;
+    return true;
+  }
+
+  unsigned long now = millis();
+  float limit = relative ? band * fabs(entry->value) : band;
+  if (now - entry->sent_at < heartbeat && fabs(value - entry->value) <= limit) {
+    return false;
+  }
+  entry->value = value;
+  entry->sent_at = now;
+  return true;
+}
+
+boolean deadband_filter(Record& rec)
+{
+  if (!enabled) {
+    deadband_sent += rec.count;
+    return rec.count > 0;
+  }
+
+  // Keep the fields to send in order, in place
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < rec.count; i++) {
+    if (deadband_pass(rec.fields[i])) {
+      rec.fields[kept++] = rec.fields[i];
+      deadband_sent++;
+    } else {
+      deadband_suppressed++;
+    }
+  }
+  rec.count = kept;
+  return kept > 0;
+}
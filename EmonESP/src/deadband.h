@@ -0,0 +1,69 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_DEADBAND_H
+#define _EMONESP_DEADBAND_H
+
+#include <Arduino.h>
+#include "record.h"
+
+// -------------------------------------------------------------------
+// Report by exception
+//
+// A field is passed on to the sinks only when its value has moved
+// outside the deadband around the value last sent for its key, or when
+// the key has been silent for the heartbeat interval. The deadband is
+// absolute, e.g. "0.5", or relative to the last sent value, e.g. "2%".
+// A deadband of "0" holds back repeated values only, a blank one passes
+// every field. Values that are not numbers always pass.
+//
+// The last sent value of each key is kept in a fixed table; keys that
+// do not fit in it are passed unfiltered.
+// -------------------------------------------------------------------
+
+#define DEADBAND_KEYS       32
+#define DEADBAND_KEY_SIZE   16
+#define DEADBAND_HEARTBEAT  300         // s, when the setting is blank
+
+// Fields passed on and held back since boot
+extern unsigned long deadband_sent;
+extern unsigned long deadband_suppressed;
+// Fields passed unfiltered because their key did not fit the table
+extern unsigned long deadband_untracked;
+
+// -------------------------------------------------------------------
+// Apply the deadband and deadband_heartbeat settings. The last sent
+// values are forgotten, so every key is sent once more
+// -------------------------------------------------------------------
+extern void deadband_setup();
+
+// -------------------------------------------------------------------
+// Remove the fields of rec that are inside the deadband.
+//
+// Returns false if no field is left to send.
+// -------------------------------------------------------------------
+extern boolean deadband_filter(Record& rec);
+
+#endif // _EMONESP_DEADBAND_H
@@ -27,62 +27,330 @@
 #include "emoncms.h"
 #include "config.h"
 #include "http.h"
+#include "record.h"
+#include "backlog.h"
+#include "async_http.h"
+#include "supervisor.h"
+#include "ntp.h"
 
 #include <Arduino.h>
 
 //EMONCMS SERVER strings
-const char* e_url = "/input/post.json?json=";
+const char* e_url = "/input/bulk.json";
+
+#if BACKLOG_DRAIN_BATCH > EMONCMS_UPLOAD_MAX
+#error "BACKLOG_DRAIN_BATCH must not exceed EMONCMS_UPLOAD_MAX"
+#endif
 boolean emoncms_connected = false;
 
 unsigned long packets_sent = 0;
 unsigned long packets_success = 0;
-unsigned long emoncms_connection_error_count = 0;
+Supervisor emoncms_supervisor;
+
+unsigned long emoncms_samples_sent = 0;
+unsigned long emoncms_samples_dropped = 0;
+unsigned long emoncms_bytes_sent = 0;
+unsigned long emoncms_radio_ms = 0;
+unsigned long emoncms_blocking_ms_max = 0;
+
+// Queue of sample sets waiting for the next bulk upload
+static EmoncmsSample queue[EMONCMS_QUEUE_SIZE];
+static uint8_t queue_head = 0;          // oldest entry
+static uint8_t queue_count = 0;
+
+static unsigned long last_drain = 0;
+
+// Upload in flight and what to do once its result is known
+enum { UPLOAD_IDLE, UPLOAD_LIVE, UPLOAD_BACKLOG };
+static uint8_t upload_kind = UPLOAD_IDLE;
+static uint8_t upload_count = 0;        // sample sets in the request
+static uint8_t upload_remove = 0;       // queue entries it still covers
+static uint8_t upload_span = 0;         // backlog records it covers
+static unsigned long upload_start = 0;
+
+// Move the oldest queued sample set to the flash backlog
+static void queue_spill_oldest()
+{
+  if (!backlog_append(queue[queue_head])) {
+    emoncms_samples_dropped++;
+  }
+  queue_head = (queue_head + 1) % EMONCMS_QUEUE_SIZE;
+  queue_count--;
+  if (upload_kind == UPLOAD_LIVE && upload_remove > 0) {
+    // It was part of the upload in flight
+    upload_remove--;
+  }
+}
+
+// -------------------------------------------------------------------
+// Append the record to the upload queue as {"key":value,...}
+// -------------------------------------------------------------------
+void emoncms_publish(const Record& rec, unsigned long time)
+{
+  if (queue_count == EMONCMS_QUEUE_SIZE) {
+    // Full, the oldest sample set goes to flash to make room
+    queue_spill_oldest();
+  }
+
+  EmoncmsSample& sample = queue[(queue_head + queue_count) % EMONCMS_QUEUE_SIZE];
+  sample.time = time;
+
+  size_t len = 0;
+  sample.json[len++] = '{';
+  for (uint8_t i = 0; i < rec.count; i++) {
+    int n = snprintf(sample.json + len, sizeof(sample.json) - len, "%s\"%s\":%s",
+                     i > 0 ? "," : "", rec.fields[i].key, rec.fields[i].value);
+    if (n < 0 || len + n >= sizeof(sample.json) - 1) {
+      DEBUG.println("Emoncms sample too long, truncated");
+      break;
+    }
+    len += n;
+  }
+  sample.json[len++] = '}';
+  sample.json[len] = '\0';
+  queue_count++;
+}
+
+// -------------------------------------------------------------------
+// Bookkeeping once an upload has completed, in loop() context
+// -------------------------------------------------------------------
+static void emoncms_result(boolean ok, const String& result)
+{
+  uint8_t kind = upload_kind;
+  upload_kind = UPLOAD_IDLE;
+  emoncms_radio_ms += millis() - upload_start;
+
+  if (ok){
+    supervisor_success(emoncms_supervisor);
+    packets_success++;
+    emoncms_samples_sent += upload_count;
+    emoncms_connected = true;
+    if (kind == UPLOAD_LIVE) {
+      uint8_t n = min(upload_remove, queue_count);
+      queue_head = (queue_head + n) % EMONCMS_QUEUE_SIZE;
+      queue_count -= n;
+    } else {
+      backlog_consume(upload_span);
+      backlog_sent += upload_count;
+    }
+    return;
+  }
 
-void emoncms_publish(String data)
+  // Sample sets stay queued, or in the backlog, for the next attempt
+  if (kind == UPLOAD_BACKLOG) {
+    backlog_unread();
+  }
+  emoncms_connected=false;
+  DEBUG.print("Emoncms error: ");
+  DEBUG.println(result);
+  supervisor_failure(emoncms_supervisor);
+}
+
+// Emoncms answers 200 with an error message in the body when it rejects
+// the data: only "ok" counts as delivered
+static void emoncms_async_done(int status, const String& body)
 {
-  // We now create a URL for server data upload
+  emoncms_result(status == 200 && body == "ok",
+                 status > 0 && status != 200 ? "server error: " + String(status) : body);
+}
+
+// -------------------------------------------------------------------
+// Append text to a form body. '%', '&', '+' and anything outside
+// printable ASCII are percent-encoded, the rest of the JSON goes as it
+// is: the server decodes it back to what was sent
+// -------------------------------------------------------------------
+static void form_append(String& form, const char* text)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  for (const char* p = text; *p != '\0'; p++) {
+    uint8_t c = *p;
+    if (c == '%' || c == '&' || c == '+' || c <= ' ' || c >= 0x7F) {
+      form += '%';
+      form += hex[c >> 4];
+      form += hex[c & 0x0F];
+    } else {
+      form += (char)c;
+    }
+  }
+}
+
+// -------------------------------------------------------------------
+// Send sample sets in one /input/bulk.json request, POSTed as data= so
+// the request line stays short. The result is handled by
+// emoncms_result(), later if the request is asynchronous.
+//
+// Once SNTP has set the clock every row carries its Unix time and
+// time=0 makes emoncms take them as they are. Before that rows carry
+// seconds since boot and sentat, the request time on the same scale,
+// lets emoncms place them relative to its own clock
+// -------------------------------------------------------------------
+static void emoncms_send(const EmoncmsSample *const *samples, uint8_t count, uint8_t kind)
+{
+  boolean absolute = ntp_synced();
+  unsigned long now = absolute ? ntp_now() : millis() / 1000;
+
+  // The sample sets go in the body...
+  String form;
+  form.reserve(count * (EMONCMS_SAMPLE_SIZE + 24) + 200);
+  form = "data=[";
+  for (uint8_t i = 0; i < count; i++) {
+    if (i > 0) form += ',';
+    form += '[';
+    form += absolute ? ntp_to_unix(samples[i]->time) : samples[i]->time;
+    form += ",\"";
+    form_append(form, emoncms_node.c_str());
+    form += "\",";
+    form_append(form, samples[i]->json);
+    form += ']';
+  }
+  // Gateway statistics ride along with the newest sample set
+  form += ",[";
+  form += now;
+  form += ",\"";
+  form_append(form, emoncms_node.c_str());
+  form += "\",{\"psent\":";
+  form += packets_sent;
+  form += ",\"psuccess\":";
+  form += packets_success;
+  form += ",\"freeram\":";
+  form += ESP.getFreeHeap();
+  form += "}]]";
+
+  // ...the rest in the URL
   String url = e_url;
-  url += "{";
-  // Copy across, data length
-  for (int i = 0; i < data.length(); ++i){
-    url += data[i];
-  }
-  url += ",psent:";
-  url += packets_sent;
-  url += ",psuccess:";
-  url += packets_success;
-  url += ",freeram:";
-  url += String(ESP.getFreeHeap());
-  url += "}&node=";
-  url += emoncms_node;
+  if (absolute) {
+    url += "?time=0";
+  } else {
+    url += "?sentat=";
+    url += now;
+  }
   url += "&apikey=";
   url += emoncms_apikey;
 
-  DEBUG.println(url); delay(10);
+  DEBUG.println(url);
+  DEBUG.println(form);
   packets_sent++;
+  emoncms_bytes_sent += url.length() + form.length();
+
+  upload_kind = kind;
+  upload_count = count;
+  upload_remove = count;
+  upload_start = millis();
 
   // Send data to Emoncms server
-  String result="";
+  if (emoncms_fingerprint!=0 && !async_http_supports_tls()){
+    // HTTPS on port 443, blocking: ESPAsyncTCP is built without TLS
+    DEBUG.println("HTTPS Enabled");
+    String body;
+    int status = post_https(emoncms_fingerprint.c_str(), emoncms_server.c_str(), url, form, 443, body);
+    if (millis() - upload_start > emoncms_blocking_ms_max) {
+      emoncms_blocking_ms_max = millis() - upload_start;
+    }
+    emoncms_async_done(status, body);
+    return;
+  }
+
+  boolean queued;
   if (emoncms_fingerprint!=0){
     // HTTPS on port 443 if HTTPS fingerprint is present
-    DEBUG.println("HTTPS Enabled"); delay(10);
-    result = get_https(emoncms_fingerprint.c_str(), emoncms_server.c_str(), url, 443);
+    DEBUG.println("HTTPS Enabled");
+    queued = async_http_post(emoncms_server.c_str(), 443, url, form, emoncms_fingerprint.c_str(), emoncms_async_done);
   } else {
     // Plain HTTP if other emoncms server e.g EmonPi
-    DEBUG.println("Plain old HTTP"); delay(10);
-    result = get_http(emoncms_server.c_str(), url);
+    DEBUG.println("Plain old HTTP");
+    queued = async_http_post(emoncms_server.c_str(), 80, url, form, NULL, emoncms_async_done);
   }
-  if (result == "ok"){
-    packets_success++;
-    emoncms_connected = true;
+  if (!queued) {
+    emoncms_result(false, "HTTP queue full");
   }
-  else{
-    emoncms_connected=false;
-    DEBUG.print("Emoncms error: ");
-    DEBUG.println(result);
-    emoncms_connection_error_count ++;
-    if (emoncms_connection_error_count>30) {
-      ESP.restart();
+}
+
+// -------------------------------------------------------------------
+// Send the oldest queued sample sets, at most EMONCMS_UPLOAD_MAX; on
+// failure they stay queued
+// -------------------------------------------------------------------
+static void emoncms_flush()
+{
+  const EmoncmsSample *samples[EMONCMS_UPLOAD_MAX];
+  uint8_t count = min(queue_count, (uint8_t)EMONCMS_UPLOAD_MAX);
+  for (uint8_t i = 0; i < count; i++) {
+    samples[i] = &queue[(queue_head + i) % EMONCMS_QUEUE_SIZE];
+  }
+  emoncms_send(samples, count, UPLOAD_LIVE);
+}
+
+// -------------------------------------------------------------------
+// Send a few of the oldest sample sets held in the flash backlog
+// -------------------------------------------------------------------
+static void emoncms_drain()
+{
+  EmoncmsSample samples[BACKLOG_DRAIN_BATCH];
+  const EmoncmsSample *ptrs[BACKLOG_DRAIN_BATCH];
+  uint8_t span;
+
+  last_drain = millis();
+  uint8_t count = backlog_read(samples, BACKLOG_DRAIN_BATCH, span);
+  if (count == 0) {
+    // Nothing usable in this span (corrupt or from an earlier boot)
+    backlog_consume(span);
+    return;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (ntp_is_unix(samples[i].time) && !ntp_synced()) {
+      // Stamped with Unix time in an earlier boot, wait for the clock
+      backlog_unread();
+      return;
     }
+    ptrs[i] = &samples[i];
   }
+  upload_span = span;
+  emoncms_send(ptrs, count, UPLOAD_BACKLOG);
+}
+
+void emoncms_loop()
+{
+  // One upload at a time
+  if (upload_kind != UPLOAD_IDLE) {
+    return;
+  }
+
+  static boolean supervisor_ready = false;
+  if (!supervisor_ready) {
+    supervisor_init(emoncms_supervisor, "emoncms", EMONCMS_FAILURE_THRESHOLD);
+    supervisor_ready = true;
+  }
+
+  // Live data first
+  boolean live_due = queue_count > 0 &&
+    (queue_count >= EMONCMS_BATCH_SIZE ||
+     ntp_age(queue[queue_head].time) >= EMONCMS_BATCH_AGE);
+  // Then the backlog, at a bounded rate and only while uploads succeed
+  boolean drain_due = backlog_pending() > 0 && emoncms_connected &&
+    millis() - last_drain >= BACKLOG_DRAIN_INTERVAL;
+
+  // While the server is failing, the circuit holds uploads back and the
+  // queue overflows into the backlog
+  if ((!live_due && !drain_due) || !supervisor_allow(emoncms_supervisor)) {
+    return;
+  }
+
+  if (live_due) {
+    emoncms_flush();
+  } else {
+    emoncms_drain();
+  }
+}
+
+const char* emoncms_transport()
+{
+  if (emoncms_fingerprint == 0) {
+    return "http";
+  }
+  return async_http_supports_tls() ? "https" : "https_blocking";
+}
+
+unsigned long emoncms_queued()
+{
+  return queue_count;
 }
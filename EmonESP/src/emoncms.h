@@ -27,21 +27,74 @@
 #define _EMONESP_EMONCMS_H
 
 #include <Arduino.h>
+#include "record.h"
+#include "supervisor.h"
 
 // -------------------------------------------------------------------
 // Commutication with EmonCMS
 // -------------------------------------------------------------------
 
 extern boolean emoncms_connected;
-extern unsigned long packets_sent;
-extern unsigned long packets_success;
+extern unsigned long packets_sent;      // bulk requests made
+extern unsigned long packets_success;   // bulk requests answered "ok"
+
+// Upload statistics
+extern unsigned long emoncms_samples_sent;      // sample sets delivered
+extern unsigned long emoncms_samples_dropped;   // lost: queue full, backlog failed
+extern unsigned long emoncms_bytes_sent;        // request URL and body bytes
+extern unsigned long emoncms_radio_ms;          // time spent in requests
+
+// HTTPS uploads only go through the event driven client when ESPAsyncTCP
+// is built with ASYNC_TCP_SSL_ENABLED, which it is not by default. They
+// are then made with post_https() and block loop() for up to HTTP_TIMEOUT
+// per request: "http", "https" (both event driven) or "https_blocking"
+extern const char* emoncms_transport();
+extern unsigned long emoncms_blocking_ms_max;   // longest blocking upload
+
+// Circuit breaker of the emoncms uploads
+extern Supervisor emoncms_supervisor;
+
+// Consecutive failed uploads that open the circuit
+#define EMONCMS_FAILURE_THRESHOLD 3
+
+// Sample sets kept in RAM between uploads
+#define EMONCMS_QUEUE_SIZE  12
+// Longest rendered sample set, {"key":value,...}
+#define EMONCMS_SAMPLE_SIZE 192
+// Upload when this many sample sets are queued...
+#define EMONCMS_BATCH_SIZE  5
+// ...or when the oldest one is this old (s)
+#define EMONCMS_BATCH_AGE   120
+// Most sample sets in one request: it stays under about 1.5 KB
+#define EMONCMS_UPLOAD_MAX  6
+
+// One queued sample set, rendered as the JSON object of a bulk.json row
+struct EmoncmsSample {
+  unsigned long time;                   // from ntp_stamp()
+  char json[EMONCMS_SAMPLE_SIZE];
+};
 
 // -------------------------------------------------------------------
-// Publish values to EmonCMS
+// Queue values for EmonCMS. They are sent, stamped with the time they
+// were received, in one /input/bulk.json request by emoncms_loop().
+// When the queue is full the oldest set is moved to the flash backlog.
 //
-// data: a comma seperated list of name:value pairs to send
+// rec: the parsed name:value pairs to send
+// time: when they were received, from ntp_stamp()
+// -------------------------------------------------------------------
+void emoncms_publish(const Record& rec, unsigned long time);
+
+// -------------------------------------------------------------------
+// Upload the queue once it is big or old enough, otherwise drain the
+// flash backlog. Must be called in the main loop function while
+// connected to the WiFi
+// -------------------------------------------------------------------
+void emoncms_loop();
+
+// -------------------------------------------------------------------
+// Number of sample sets waiting to be uploaded
 // -------------------------------------------------------------------
-void emoncms_publish(String data);
+unsigned long emoncms_queued();
 
 #endif // _EMONESP_EMONCMS_H
 
@@ -27,61 +27,365 @@
 #include "http.h"
 
 #include <WiFiClientSecure.h>         // Secure https GET request
-#include <ESP8266HTTPClient.h>
+
+// Cores with BearSSL can resume TLS sessions; axTLS cannot
+#if defined(wificlientbearssl_h) && !defined(USING_AXTLS)
+#define HTTP_TLS_SESSIONS 1
+static BearSSL::Session tls_session;
+#else
+#define HTTP_TLS_SESSIONS 0
+#endif
 
 WiFiClientSecure client;              // Create class for HTTPS TCP connections get_https()
-HTTPClient http;                      // Create class for HTTP TCP connections get_http
+WiFiClient plain_client;              // Create class for HTTP TCP connections get_http()
+
+unsigned long http_connects = 0;
+unsigned long http_reused = 0;
+
+unsigned long tls_handshakes = 0;
+unsigned long tls_resumed = 0;
+unsigned long tls_handshake_ms = 0;
+unsigned long tls_handshake_ms_max = 0;
+unsigned long tls_heap_min = 0;
+
+// Certificate pin, parsed once from the configured fingerprint
+static uint8_t pin[20];
+static String pin_source;
+static boolean pin_valid = false;
+
+// One kept-alive connection per client, to the host it was opened for
+struct HttpConnection {
+  WiFiClient *tcp;
+  String host;
+  int port;
+  unsigned long last_used;
+};
+
+static HttpConnection https_conn = { &client, "", 0, 0 };
+static HttpConnection http_conn = { &plain_client, "", 0, 0 };
+
+// Failures of http_exchange(): the connection was closed before a single
+// byte of the response came in, or the exchange failed in any other way
+#define HTTP_RESET  -2
+#define HTTP_FAILED -1
+
+// Latency of the last HTTP_LATENCY_SAMPLES requests (ms)
+static unsigned long latency[HTTP_LATENCY_SAMPLES];
+static uint8_t latency_next = 0;
+static uint8_t latency_count = 0;
+
+void http_record_latency(unsigned long ms)
+{
+  latency[latency_next] = ms;
+  latency_next = (latency_next + 1) % HTTP_LATENCY_SAMPLES;
+  if (latency_count < HTTP_LATENCY_SAMPLES) {
+    latency_count++;
+  }
+}
+
+unsigned long http_latency_percentile(uint8_t percent)
+{
+  if (latency_count == 0) {
+    return 0;
+  }
+
+  unsigned long sorted[HTTP_LATENCY_SAMPLES];
+  memcpy(sorted, latency, latency_count * sizeof(sorted[0]));
+  // Insertion sort, at most HTTP_LATENCY_SAMPLES entries
+  for (uint8_t i = 1; i < latency_count; i++) {
+    unsigned long v = sorted[i];
+    int8_t j = i - 1;
+    while (j >= 0 && sorted[j] > v) {
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = v;
+  }
+  uint8_t index = ((uint16_t)percent * (latency_count - 1) + 50) / 100;
+  return sorted[index];
+}
+
+const uint8_t* http_pin(const char* fingerprint)
+{
+  if (pin_source != fingerprint) {
+    // "AA:BB:.." or "AA BB .." to 20 bytes
+    const char* p = fingerprint;
+    pin_valid = true;
+    for (uint8_t i = 0; i < sizeof(pin); i++) {
+      while (*p == ':' || *p == ' ') p++;
+      if (!isxdigit(p[0]) || !isxdigit(p[1])) {
+        pin_valid = false;
+        break;
+      }
+      char hex[3] = { p[0], p[1], '\0' };
+      pin[i] = strtoul(hex, NULL, 16);
+      p += 2;
+    }
+    pin_source = fingerprint;
+  }
+  return pin_valid ? pin : NULL;
+}
 
 // -------------------------------------------------------------------
-// HTTPS SECURE GET Request
-// url: N/A
+// Open the TLS connection, resuming the previous session when the core
+// supports it and falling back to a full handshake if that fails
 // -------------------------------------------------------------------
+static boolean tls_connect(const char* host, int port, const char* fingerprint)
+{
+  unsigned long start = millis();
+  boolean ok;
 
-String get_https(const char* fingerprint, const char* host, String url, int httpsPort){
-  // Use WiFiClient class to create TCP connections
-  if (!client.connect(host, httpsPort)) {
-    DEBUG.print(host + httpsPort); //debug
-    return("Connection error");
-  }
-  if (client.verify(fingerprint, host)) {
-    client.print(String("GET ") + url + " HTTP/1.1\r\n" + "Host: " + host +
-                 "\r\n" + "Connection: close\r\n\r\n");
-     // Handle wait for reply and timeout
-    unsigned long timeout = millis();
-    while (client.available() == 0) {
-      if (millis() - timeout > 5000) {
-        client.stop();
-        return("Client Timeout");
+#if HTTP_TLS_SESSIONS
+  const uint8_t* fp = http_pin(fingerprint);
+  if (fp == NULL) {
+    return false;
+  }
+  client.setFingerprint(fp);
+  client.setSession(&tls_session);
+
+  br_ssl_session_parameters* params = tls_session.getSession();
+  uint8_t id_len = params->session_id_len;
+  uint8_t id[sizeof(params->session_id)];
+  memcpy(id, params->session_id, id_len);
+
+  ok = client.connect(host, port);
+  if (!ok && id_len > 0) {
+    // Resumption refused or broken: start again without a session
+    tls_session = BearSSL::Session();
+    client.setSession(&tls_session);
+    id_len = 0;
+    ok = client.connect(host, port);
+  }
+  if (ok && id_len > 0 && params->session_id_len == id_len &&
+      memcmp(params->session_id, id, id_len) == 0) {
+    tls_resumed++;
+  }
+#else
+  ok = client.connect(host, port) && client.verify(fingerprint, host);
+  if (!ok) {
+    client.stop();
+  }
+#endif
+
+  if (ok) {
+    tls_handshakes++;
+    tls_handshake_ms = millis() - start;
+    if (tls_handshake_ms > tls_handshake_ms_max) {
+      tls_handshake_ms_max = tls_handshake_ms;
+    }
+    unsigned long heap = ESP.getFreeHeap();
+    if (tls_heap_min == 0 || heap < tls_heap_min) {
+      tls_heap_min = heap;
+    }
+  }
+  return ok;
+}
+
+// -------------------------------------------------------------------
+// Make sure conn is connected to host:port, reusing the open connection
+// unless it was closed, has been idle too long or is for another host.
+// fingerprint: pinned certificate for TLS connections, NULL otherwise
+// -------------------------------------------------------------------
+static boolean http_open(HttpConnection& conn, const char* host, int port,
+                         const char* fingerprint, boolean& fresh)
+{
+  fresh = false;
+  if (conn.tcp->connected() && conn.port == port && conn.host == host &&
+      millis() - conn.last_used < HTTP_IDLE_TIMEOUT) {
+    http_reused++;
+    return true;
+  }
+
+  conn.tcp->stop();
+  if (fingerprint != NULL ? !tls_connect(host, port, fingerprint) : !conn.tcp->connect(host, port)) {
+    return false;
+  }
+  conn.tcp->setTimeout(HTTP_TIMEOUT);
+  conn.host = host;
+  conn.port = port;
+  http_connects++;
+  fresh = true;
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Send one GET, or a POST of form if it is not empty, on an open
+// connection and read the whole response so the connection can carry
+// the next request.
+// Returns the status code, HTTP_RESET or HTTP_FAILED.
+// -------------------------------------------------------------------
+static int http_exchange(HttpConnection& conn, const char* host, const String& url,
+                         const String& form, String& body)
+{
+  WiFiClient& tcp = *conn.tcp;
+
+  String head = String(form.length() > 0 ? "POST " : "GET ") + url + " HTTP/1.1\r\n" +
+                "Host: " + host + "\r\n" +
+                (HTTP_KEEP_ALIVE ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+  if (form.length() > 0) {
+    head += "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: ";
+    head += form.length();
+    head += "\r\n";
+  }
+  head += "\r\n";
+  tcp.print(head);
+  tcp.print(form);
+
+  // A kept-alive connection the server closed in the meantime ends here,
+  // before anything is received
+  unsigned long wait = millis();
+  while (!tcp.available() && tcp.connected() && millis() - wait < HTTP_TIMEOUT) {
+    delay(1);
+  }
+  if (!tcp.available()) {
+    return tcp.connected() ? HTTP_FAILED : HTTP_RESET;
+  }
+
+  String line = tcp.readStringUntil('\n');
+  if (!line.startsWith("HTTP/1.")) {
+    return HTTP_FAILED;
+  }
+  int status = line.substring(9, 12).toInt();
+  DEBUG.println(line); //debug
+
+  // Headers
+  long length = -1;
+  boolean chunked = false;
+  boolean keep = HTTP_KEEP_ALIVE && line.startsWith("HTTP/1.1");
+  while (true) {
+    line = tcp.readStringUntil('\n');
+    line.trim();
+    if (line.length() == 0) {
+      break;
+    }
+    line.toLowerCase();
+    if (line.startsWith("content-length:")) {
+      length = line.substring(15).toInt();
+    } else if (line.startsWith("transfer-encoding:") && line.indexOf("chunked") > 0) {
+      chunked = true;
+    } else if (line.startsWith("connection:") && line.indexOf("close") > 0) {
+      keep = false;
+    }
+  }
+
+  // Body
+  body = "";
+  if (chunked) {
+    while (true) {
+      line = tcp.readStringUntil('\n');
+      long size = strtol(line.c_str(), NULL, 16);
+      if (size <= 0) {
+        tcp.readStringUntil('\n');   // trailer
+        break;
       }
+      while (size-- > 0) {
+        int c = tcp.read();
+        if (c < 0) {
+          unsigned long start = millis();
+          while (!tcp.available() && tcp.connected() && millis() - start < HTTP_TIMEOUT) {
+            delay(1);
+          }
+          c = tcp.read();
+          if (c < 0) return HTTP_FAILED;
+        }
+        body += (char)c;
+      }
+      tcp.readStringUntil('\n');     // CRLF after the chunk
     }
-    // Handle message receive
-    while(client.available()){
-      String line = client.readStringUntil('\r');
-      DEBUG.println(line); //debug
-      if (line.startsWith("HTTP/1.1 200 OK")) {
-        return("ok");
+  } else if (length >= 0) {
+    while (length-- > 0) {
+      unsigned long start = millis();
+      while (!tcp.available() && tcp.connected() && millis() - start < HTTP_TIMEOUT) {
+        delay(1);
       }
+      int c = tcp.read();
+      if (c < 0) return HTTP_FAILED;
+      body += (char)c;
     }
   } else {
-    return("HTTPS fingerprint no match");
+    // No length: the body ends when the server closes
+    body = tcp.readString();
+    keep = false;
+  }
+
+  if (keep) {
+    conn.last_used = millis();
+  } else {
+    tcp.stop();
+  }
+  return status;
+}
+
+// -------------------------------------------------------------------
+// GET url, or POST form to it, on conn, retrying once on a fresh
+// connection if a kept-alive one turns out to have been closed by the
+// server. Only a connection closed before any byte of the response is
+// retried: after a timeout, or once the response has started, the
+// server may have acted on the request and a POST would be sent twice
+// -------------------------------------------------------------------
+static int http_get(HttpConnection& conn, const char* host, int port, const String& url,
+                    const String& form, String& body, const char* fingerprint)
+{
+  unsigned long start = millis();
+  int status = -1;
+
+  for (uint8_t attempt = 0; attempt < 2; attempt++) {
+    boolean fresh;
+    if (!http_open(conn, host, port, fingerprint, fresh)) {
+      body = fingerprint != NULL ? "Connection error or HTTPS fingerprint no match" : "Connection error";
+      return -1;
+    }
+    status = http_exchange(conn, host, url, form, body);
+    if (status >= 0) {
+      break;
+    }
+    conn.tcp->stop();
+    body = "Client Timeout";
+    if (fresh || status != HTTP_RESET) {
+      break;
+    }
+  }
+
+  if (status > 0) {
+    http_record_latency(millis() - start);
+  }
+  return status;
+}
+
+// -------------------------------------------------------------------
+// HTTPS SECURE GET Request
+// -------------------------------------------------------------------
+
+String get_https(const char* fingerprint, const char* host, String url, int httpsPort){
+  String body;
+  int status = post_https(fingerprint, host, url, "", httpsPort, body);
+  if (status == 200 || status < 0) {
+    return(body);
   }
   return("error " + String(host));
 }
 
+// -------------------------------------------------------------------
+// HTTPS SECURE POST Request, GET if form is empty
+// -------------------------------------------------------------------
+int post_https(const char* fingerprint, const char* host, String url, const String& form, int httpsPort, String& body){
+  int status = http_get(https_conn, host, httpsPort, url, form, body, fingerprint);
+  if (status < 0) {
+    DEBUG.println(host); //debug
+  }
+  return status;
+}
+
 // -------------------------------------------------------------------
 // HTTP GET Request
 // url: N/A
 // -------------------------------------------------------------------
 String get_http(const char *host, String url){
-  http.begin(String("http://") + host + String(url));
-  int httpCode = http.GET();
-  if((httpCode > 0) && (httpCode == HTTP_CODE_OK)){
-    String payload = http.getString();
-    DEBUG.println(payload);
-    http.end();
-    return(payload);
-  } else {
-    http.end();
-    return("server error: "+String(httpCode));
+  String body;
+  int status = http_get(http_conn, host, 80, url, "", body, NULL);
+  if (status == 200) {
+    DEBUG.println(body);
+    return(body);
   }
+  return("server error: "+String(status));
 } // end http_get
@@ -32,16 +32,71 @@
 
 #include <Arduino.h>
 
+// Reuse one HTTP/1.1 connection per protocol between requests. Set to 0
+// to close after every request, e.g. to compare latencies.
+#ifndef HTTP_KEEP_ALIVE
+#define HTTP_KEEP_ALIVE 1
+#endif
+
+// A kept-alive connection unused for longer than this (ms) is reopened
+#define HTTP_IDLE_TIMEOUT 60000
+
+// Response timeout (ms)
+#define HTTP_TIMEOUT 5000
+
+// Number of recent requests the latency percentiles are taken over
+#define HTTP_LATENCY_SAMPLES 32
+
+extern unsigned long http_connects;   // TCP (and TLS) connections opened
+extern unsigned long http_reused;     // requests sent on an open connection
+
+// TLS handshakes done, how many resumed a session, their duration (ms)
+// and the lowest free heap seen right after one
+extern unsigned long tls_handshakes;
+extern unsigned long tls_resumed;
+extern unsigned long tls_handshake_ms;
+extern unsigned long tls_handshake_ms_max;
+extern unsigned long tls_heap_min;
+
 // -------------------------------------------------------------------
 // HTTPS SECURE GET Request
-// url: N/A
+// Returns the response body, or an error message
 // -------------------------------------------------------------------
 extern String get_https(const char* fingerprint, const char* host, String url, int httpsPort);
 
+// -------------------------------------------------------------------
+// HTTPS SECURE POST Request
+// form: application/x-www-form-urlencoded body, GET if empty
+// body: the response body, or an error message if there is no response
+// Returns the status code, or a negative value if the exchange failed.
+// Whether the server accepted the request is up to the caller: emoncms
+// answers 200 with an error message in the body
+// -------------------------------------------------------------------
+extern int post_https(const char* fingerprint, const char* host, String url,
+                      const String& form, int httpsPort, String& body);
+
 // -------------------------------------------------------------------
 // HTTP GET Request
 // url: N/A
 // -------------------------------------------------------------------
 extern String get_http(const char* host, String url);
 
+// -------------------------------------------------------------------
+// Request latency percentile over the last HTTP_LATENCY_SAMPLES
+// requests (ms), e.g. 50 for the median and 99 for p99
+// -------------------------------------------------------------------
+extern unsigned long http_latency_percentile(uint8_t percent);
+
+// -------------------------------------------------------------------
+// Certificate pin for a fingerprint such as "AA:BB:...", as 20 bytes.
+// The last fingerprint is parsed once and kept in memory. Returns NULL
+// if the fingerprint is malformed.
+// -------------------------------------------------------------------
+extern const uint8_t* http_pin(const char* fingerprint);
+
+// -------------------------------------------------------------------
+// Add one request latency (ms) to the percentile window
+// -------------------------------------------------------------------
+extern void http_record_latency(unsigned long ms);
+
 #endif // _EMONESP_HTTP_H
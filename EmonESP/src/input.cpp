@@ -26,37 +26,131 @@
 #include "emonesp.h"
 #include "input.h"
 
+#include <ecohouse_link.h>
+
 String input_string="";
-String last_datastr="";
+Record last_record;
+
+EcohouseLinkDecoder link_decoder;
+
+// Serial input is assembled a byte at a time so loop() never waits for
+// the rest of a line
+static char line_buf[INPUT_LINE_SIZE];
+static uint16_t line_len = 0;
+static boolean line_overflow = false;
+static unsigned long input_last_byte = 0;
+
+uint32_t input_overflows = 0;
+uint32_t input_timeouts = 0;
 
-boolean input_get(String& data)
+// Text line without surrounding whitespace, newlines etc
+static boolean input_parse(Record& rec, char *line)
+{
+  char *end = line + strlen(line);
+  while (end > line && isspace(end[-1])) *--end = '\0';
+  while (isspace(*line)) line++;
+  return record_parse(rec, line);
+}
+
+// Fields of the frame just decoded, in hundredths as "120.50"
+static boolean input_frame(Record& rec)
+{
+  char key[EHL_KEY_SIZE];
+  char value[14];
+
+  record_clear(rec);
+  for (uint8_t i = 0; i < link_decoder.count(); i++) {
+    ehl_key(link_decoder.channel(i), key);
+    ehl_format_value(link_decoder.value(i), value);
+    record_add(rec, key, value);
+  }
+  return rec.count > 0;
+}
+
+// -------------------------------------------------------------------
+// Consume the bytes already received on serial. Returns true as soon as
+// a whole text line or a valid, not duplicated ecohouse_link frame is
+// available in rec. Partial input is kept for the next call.
+// -------------------------------------------------------------------
+static boolean input_get_serial(Record& rec)
+{
+  if ((line_len > 0 || line_overflow || link_decoder.busy()) &&
+      millis() - input_last_byte > INPUT_TIMEOUT) {
+    DEBUG.println("Serial input timed out, discarding partial input");
+    input_timeouts++;
+    line_len = 0;
+    line_overflow = false;
+    link_decoder.reset();
+  }
+
+  // Bytes of a rejected frame, and those after a frame returned last time
+  int8_t result;
+  while ((result = link_decoder.poll()) != EHL_NEED_MORE) {
+    if (result == EHL_FRAME_OK && input_frame(rec)) {
+      return true;
+    }
+  }
+
+  while (Serial.available()) {
+    uint8_t b = Serial.read();
+    input_last_byte = millis();
+
+    // Binary frame from the Nano, integrity checked by CRC16 and SEQ
+    if (link_decoder.busy() || (line_len == 0 && !line_overflow && b == EHL_SYNC)) {
+      result = link_decoder.push(b);
+      while (result != EHL_NEED_MORE) {
+        if (result == EHL_FRAME_OK && input_frame(rec)) {
+          return true;
+        }
+        if (result == EHL_FRAME_BAD) {
+          DEBUG.printf("Link frame rejected, crc_errors=%u\n", link_decoder.crc_errors);
+        }
+        result = link_decoder.poll();
+      }
+      continue;
+    }
+
+    // Legacy text line
+    if (b == '\n') {
+      boolean complete = !line_overflow;
+      if (line_overflow) {
+        DEBUG.println("Serial line too long, discarded");
+        input_overflows++;
+      }
+      line_buf[line_len] = '\0';
+      line_len = 0;
+      line_overflow = false;
+      if (complete && input_parse(rec, line_buf)) {
+        return true;
+      }
+    } else if (line_len < INPUT_LINE_SIZE - 1) {
+      line_buf[line_len++] = b;
+    } else {
+      line_overflow = true;
+    }
+  }
+  return false;
+}
+
+boolean input_get(Record& rec)
 {
   boolean gotData = false;
 
   // If data from test API e.g `http://<IP-ADDRESS>/input?string=CT1:3935,CT2:325,T1:12.5,T2:16.9,T3:11.2,T4:34.7`
   if(input_string.length() > 0) {
-    data = input_string;
+    input_string.trim();
+    gotData = record_parse(rec, input_string.c_str());
     input_string = "";
-    gotData = true;
   }
   // If data received on serial
-  else if (Serial.available()) {
-    // Could check for string integrity here
-    data = Serial.readStringUntil('\n');
-    gotData = true;
+  else {
+    gotData = input_get_serial(rec);
   }
 
   if(gotData)
   {
-    // Get rid of any whitespace, newlines etc
-    data.trim();
-
-    if(data.length() > 0) {
-      DEBUG.printf("Got '%s'\n", data.c_str());
-      last_datastr = data;
-    } else {
-      gotData = false;
-    }
+    DEBUG.printf("Got %u fields\n", rec.count);
+    record_copy(last_record, rec);
   }
 
   return gotData;
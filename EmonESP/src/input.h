@@ -27,20 +27,48 @@
 #define _EMONESP_INPUT_H
 
 #include <Arduino.h>
+#include <ecohouse_link.h>
+
+#include "record.h"
 
 // -------------------------------------------------------------------
 // Support for reading input
 // -------------------------------------------------------------------
 
-extern String last_datastr;
+// Last sample set received, as it came in (before aggregation/deadband)
+extern Record last_record;
 extern String input_string;
 
+// Decoder of the binary Nano link, its counters are shown on /status
+extern EcohouseLinkDecoder link_decoder;
+
+// Longest text line accepted on serial, including the terminating '\0'
+#define INPUT_LINE_SIZE 256
+
+// Partial serial input older than this (ms) is discarded
+#define INPUT_TIMEOUT 500
+
+// Lines discarded for exceeding INPUT_LINE_SIZE / partial input timeouts
+extern uint32_t input_overflows;
+extern uint32_t input_timeouts;
+
 // -------------------------------------------------------------------
 // Read input sent via the web_server or serial.
 //
-// data: if true is returned data will be updated with the new line of
-//       input
+// Serial input is either an ecohouse_link binary frame (SYNC, LEN, SEQ,
+// channel/value pairs, CRC16) or a legacy text line. Frames that fail the
+// CRC are dropped, and their bytes are scanned again for the start of the
+// next frame; repeated sequence numbers are not forwarded. The fields of a
+// valid frame are added to the record one by one, only text lines are
+// parsed. Input is assembled without blocking; false is returned until a
+// whole line or frame has arrived.
+//
+// Each line is one complete sample set for a sweep of the sensors, e.g.
+// `p1:120.50,p2:35.00,p3:0.00,t1:21.5`, and is passed to every sink as
+// a single unit (one emoncms post, one MQTT publish burst).
+//
+// rec: if true is returned rec holds the new sample set
 // -------------------------------------------------------------------
-extern boolean input_get(String& data);
+extern boolean input_get(Record& rec);
 
 #endif // _EMONESP_INPUT_H
@@ -26,82 +26,259 @@
 #include "emonesp.h"
 #include "mqtt.h"
 #include "config.h"
+#include "record.h"
+#include "cbor.h"
 
 #include <Arduino.h>
-#include <PubSubClient.h>             // MQTT https://github.com/knolleary/pubsubclient PlatformIO lib: 89
+
+#if MQTT_ASYNC
+#include "async_mqtt.h"
+MqttAsyncClient mqttclient;           // Event driven client on ESPAsyncTCP
+#else
+#include <PubSubClient.h>             // MQTT https://github.com/knolleary/pubsubclient
 #include <WiFiClient.h>
 
 WiFiClient espClient;                 // Create client for MQTT
 PubSubClient mqttclient(espClient);   // Create client for MQTT
+#endif
+
+Supervisor mqtt_supervisor;
+
+unsigned long mqtt_publish_us = 0;
+unsigned long mqtt_publish_us_max = 0;
+long mqtt_publish_heap = 0;
+unsigned long mqtt_publish_failed = 0;
+unsigned long mqtt_loop_us = 0;
+unsigned long mqtt_loop_us_max = 0;
 
-long lastMqttReconnectAttempt = 0;
-int clientTimeout = 0;
-int i = 0;
+// A connection attempt has been started and its outcome not yet counted
+static boolean connect_pending = false;
+
+// <base-topic>/<prefix>, rendered by mqtt_topic_setup(). Each key is
+// written in place after it, at topic + topic_base
+static char topic[MQTT_TOPIC_SIZE];
+static int topic_base = -1;             // -1: settings do not fit
 
 
 // -------------------------------------------------------------------
 // MQTT Connect
+//
+// PubSubClient connects before returning. The async client only starts
+// connecting; mqtt_loop() picks up the outcome either way
 // -------------------------------------------------------------------
-boolean mqtt_connect()
+static void mqtt_connect()
 {
+  static char client_id[12];
+  snprintf(client_id, sizeof(client_id), "%u", ESP.getChipId());
+
   mqttclient.setServer(mqtt_server.c_str(), 1883);
   DEBUG.println("MQTT Connecting...");
-  String strID = String(ESP.getChipId());
-  if (mqttclient.connect(strID.c_str(), mqtt_user.c_str(), mqtt_pass.c_str())) {  // Attempt to connect
+  mqttclient.connect(client_id, mqtt_user.c_str(), mqtt_pass.c_str());
+  connect_pending = true;
+}
+
+// -------------------------------------------------------------------
+// Count the outcome of the last connection attempt once it is known
+// -------------------------------------------------------------------
+static void mqtt_connect_result()
+{
+#if MQTT_ASYNC
+  if (mqttclient.connecting()) {
+    return;
+  }
+#endif
+  connect_pending = false;
+  if (mqttclient.connected()) {
     DEBUG.println("MQTT connected");
     mqttclient.publish(mqtt_topic.c_str(), "connected"); // Once connected, publish an announcement..
+    supervisor_success(mqtt_supervisor);
   } else {
     DEBUG.print("MQTT failed: ");
     DEBUG.println(mqttclient.state());
-    return(0);
+    supervisor_failure(mqtt_supervisor);
+  }
+}
+
+// -------------------------------------------------------------------
+// Render the topic prefix, on load and whenever the MQTT settings change
+// -------------------------------------------------------------------
+void mqtt_topic_setup()
+{
+  topic_base = snprintf(topic, sizeof(topic), "%s/%s", mqtt_topic.c_str(), mqtt_feed_prefix.c_str());
+  if (topic_base < 0 || topic_base >= (int)sizeof(topic)) {
+    DEBUG.println("MQTT topic too long");
+    topic_base = -1;
+  }
+}
+
+// -------------------------------------------------------------------
+// Render one field of a single message payload. Returns its length,
+// and streams it to the broker when send is set
+// -------------------------------------------------------------------
+static size_t mqtt_write_field(const char* key, const char* value, boolean json, boolean first, boolean send)
+{
+  const char* quote = json ? "\"" : "";
+  const char* parts[] = { first ? "" : ",", quote, key, quote, ":", value };
+  size_t len = 0;
+  for (uint8_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+    size_t n = strlen(parts[i]);
+    if (send && n > 0) {
+      mqttclient.write((const uint8_t*)parts[i], n);
+    }
+    len += n;
+  }
+  return len;
+}
+
+// {"CT1":3935,...} as a CBOR map, with numbers rather than their text
+static size_t mqtt_write_cbor(const Record& rec, const char* free_ram, boolean send)
+{
+  CborWriter w;
+  cbor_begin(w, send ? &mqttclient : NULL);
+  cbor_map(w, rec.count + 1);
+  for (uint8_t i = 0; i < rec.count; i++) {
+    cbor_text(w, rec.fields[i].key);
+    cbor_number(w, rec.fields[i].value);
+  }
+  cbor_text(w, "freeram");
+  cbor_number(w, free_ram);
+  return w.length;
+}
+
+static size_t mqtt_write_single(const Record& rec, const char* free_ram, const String& format, boolean send)
+{
+  if (format == MQTT_FORMAT_CBOR) {
+    return mqtt_write_cbor(rec, free_ram, send);
+  }
+
+  boolean json = format == MQTT_FORMAT_JSON;
+  size_t len = 0;
+  if (json) {
+    if (send) mqttclient.write('{');
+    len++;
+  }
+  for (uint8_t i = 0; i < rec.count; i++) {
+    len += mqtt_write_field(rec.fields[i].key, rec.fields[i].value, json, i == 0, send);
+  }
+  len += mqtt_write_field("freeram", free_ram, json, rec.count == 0, send);
+  if (json) {
+    if (send) mqttclient.write('}');
+    len++;
+  }
+  return len;
+}
+
+// Record being published in parts, because it has more messages than
+// the QoS 1 queue has free slots: its ring time and the next message
+// (field index, rec.count for freeram)
+static const Record* part_rec = NULL;
+static unsigned long part_time = 0;
+static uint8_t part_next = 0;
+
+static boolean mqtt_single_format()
+{
+  return mqtt_format == MQTT_FORMAT_JSON || mqtt_format == MQTT_FORMAT_COMPACT ||
+         mqtt_format == MQTT_FORMAT_CBOR;
+}
+
+// Messages of the record still to publish
+static uint8_t mqtt_remaining(const Record& rec, unsigned long time)
+{
+  if (mqtt_single_format()) {
+    return 1;
   }
-  return (1);
+  uint8_t next = (&rec == part_rec && time == part_time) ? part_next : 0;
+  return rec.count + 1 - next;
+}
+
+// -------------------------------------------------------------------
+// Publish the whole record as one message on the base topic, e.g
+// emon/emonesp > {"CT1":3935,"CT2":325,"T1":12.5,"freeram":21000}
+// or the same map in CBOR. The payload is streamed. At QoS 1 it must
+// fit a queue slot, larger payloads go at QoS 0 while connected
+// -------------------------------------------------------------------
+static void mqtt_publish_single(const Record& rec, const String& format)
+{
+  char free_ram[12];
+  snprintf(free_ram, sizeof(free_ram), "%u", ESP.getFreeHeap());
+
+  // Length first: it goes in the packet header
+  size_t len = mqtt_write_single(rec, free_ram, format, false);
+  if (!mqttclient.beginPublish(mqtt_topic.c_str(), len, false, MQTT_PUBLISH_QOS) &&
+      !mqttclient.beginPublish(mqtt_topic.c_str(), len, false)) {
+    DEBUG.println("MQTT publish failed");
+    mqtt_publish_failed++;
+    return;
+  }
+  mqtt_write_single(rec, free_ram, format, true);
+  mqttclient.endPublish();
+  DEBUG.printf("%s = %u bytes\r\n", mqtt_topic.c_str(), len);
 }
 
 // -------------------------------------------------------------------
 // Publish to MQTT
-// Split up data string into sub topics: e.g
+// One sub topic per field of the record: e.g
 // data = CT1:3935,CT2:325,T1:12.5,T2:16.9,T3:11.2,T4:34.7
 // base topic = emon/emonesp
 // MQTT Publish: emon/emonesp/CT1 > 3935 etc..
+// In the json, compact and cbor formats, one message: see
+// mqtt_publish_single()
 // -------------------------------------------------------------------
-void mqtt_publish(String data)
-{
-  String mqtt_data = "";
-  String topic = mqtt_topic + "/" + mqtt_feed_prefix;
-  int i=0;
-  while (int (data[i]) != 0)
-  {
-    // Construct MQTT topic e.g. <base_topic>/CT1 e.g. emonesp/CT1
-    while (data[i]!=':'){
-      topic+= data[i];
-      i++;
-      if (int(data[i])==0){
-        break;
-      }
+// A message is never downgraded to QoS 0: when the queue fills up the
+// rest of the record waits for PUBACKs to free slots, and goes out on
+// a later call. Returns true once the whole record is done
+static boolean mqtt_publish_keys(const Record& rec, unsigned long time)
+{
+  if (topic_base < 0) {
+    return true;
+  }
+
+  char free_ram[12];
+  snprintf(free_ram, sizeof(free_ram), "%u", ESP.getFreeHeap());
+
+  char *suffix = topic + topic_base;
+  size_t suffix_size = sizeof(topic) - topic_base;
+  for (uint8_t i = rec.count + 1 - mqtt_remaining(rec, time); i <= rec.count; i++) {
+    // Complete the topic e.g. <base_topic>/CT1 e.g. emonesp/CT1
+    const char* value = i < rec.count ? rec.fields[i].value : free_ram;
+    strlcpy(suffix, i < rec.count ? rec.fields[i].key : "freeram", suffix_size);
+    DEBUG.printf("%s = %s\r\n", topic, value);
+    if (mqttclient.publish(topic, value, false, MQTT_PUBLISH_QOS)) {
+      continue;
     }
-    i++;
-    // Construct data string to publish to above topic
-    while (data[i]!=','){
-      mqtt_data+= data[i];
-      i++;
-      if (int(data[i])==0){
-        break;
-      }
+    if (MQTT_PUBLISH_QOS == 1 && MQTT_QOS1_QUEUE_SIZE > 0 &&
+        mqttclient.queued() == MQTT_QOS1_QUEUE_SIZE) {
+      // Queue full: carry on from here later
+      part_rec = &rec;
+      part_time = time;
+      part_next = i;
+      return false;
     }
-    // send data via mqtt
-    //delay(100);
-    DEBUG.printf("%s = %s\r\n", topic.c_str(), mqtt_data.c_str());
-    mqttclient.publish(topic.c_str(), mqtt_data.c_str());
-    topic = mqtt_topic + "/" + mqtt_feed_prefix;
-    mqtt_data="";
-    i++;
-    if (int(data[i]) == 0) break;
+    // Too long for a queue slot, or not connected at QoS 0
+    mqtt_publish_failed++;
   }
+  part_rec = NULL;
+  return true;
+}
 
-  String ram_topic = mqtt_topic + "/" + mqtt_feed_prefix + "freeram";
-  String free_ram = String(ESP.getFreeHeap());
-  mqttclient.publish(ram_topic.c_str(), free_ram.c_str());
+boolean mqtt_publish(const Record& rec, unsigned long time)
+{
+  unsigned long start = micros();
+  long heap_before = ESP.getFreeHeap();
+
+  boolean done = true;
+  if (mqtt_single_format()) {
+    mqtt_publish_single(rec, mqtt_format);
+  } else {
+    done = mqtt_publish_keys(rec, time);
+  }
+
+  mqtt_publish_heap = heap_before - (long)ESP.getFreeHeap();
+  mqtt_publish_us = micros() - start;
+  if (mqtt_publish_us > mqtt_publish_us_max) {
+    mqtt_publish_us_max = mqtt_publish_us;
+  }
+  return done;
 }
 
 // -------------------------------------------------------------------
@@ -111,19 +288,33 @@ void mqtt_publish(String data)
 // -------------------------------------------------------------------
 void mqtt_loop()
 {
-  if (!mqttclient.connected()) {
-    long now = millis();
-    // try and reconnect continuously for first 5s then try again once every 10s
-    if ( (now < 50000) || ((now - lastMqttReconnectAttempt)  > 100000) ) {
-      lastMqttReconnectAttempt = now;
-      if (mqtt_connect()) { // Attempt to reconnect
-        lastMqttReconnectAttempt = 0;
-      }
+  static boolean supervisor_ready = false;
+  if (!supervisor_ready) {
+    supervisor_init(mqtt_supervisor, "mqtt", MQTT_FAILURE_THRESHOLD);
+    supervisor_ready = true;
+  }
+
+  unsigned long start = micros();
+
+  if (connect_pending) {
+    mqttclient.loop();
+    mqtt_connect_result();
+  } else if (!mqttclient.connected()) {
+    // Reconnect with jittered exponential backoff while the broker is down
+    if (supervisor_allow(mqtt_supervisor)) {
+      mqtt_connect();
     }
   } else {
     // if MQTT connected
     mqttclient.loop();
   }
+
+  // Worst case time spent here, e.g. a blocking connect while the broker
+  // is down
+  mqtt_loop_us = micros() - start;
+  if (mqtt_loop_us > mqtt_loop_us_max) {
+    mqtt_loop_us_max = mqtt_loop_us;
+  }
 }
 
 void mqtt_restart()
@@ -131,9 +322,46 @@ void mqtt_restart()
   if (mqttclient.connected()) {
     mqttclient.disconnect();
   }
+  connect_pending = false;
+  // New settings: reconnect straight away
+  supervisor_init(mqtt_supervisor, "mqtt", MQTT_FAILURE_THRESHOLD);
 }
 
 boolean mqtt_connected()
 {
   return mqttclient.connected();
 }
+
+boolean mqtt_ready(const Record& rec, unsigned long time)
+{
+  if (!mqttclient.connected()) {
+    return false;
+  }
+#if MQTT_PUBLISH_QOS == 1
+  // Free slots for the rest of the record, or for a full queue of it
+  uint8_t needed = min((uint8_t)mqtt_remaining(rec, time), (uint8_t)MQTT_QOS1_QUEUE_SIZE);
+  return mqttclient.queued() + needed <= MQTT_QOS1_QUEUE_SIZE;
+#else
+  return true;
+#endif
+}
+
+uint8_t mqtt_queued()
+{
+  return mqttclient.queued();
+}
+
+uint8_t mqtt_inflight()
+{
+  return mqttclient.inflight();
+}
+
+unsigned long mqtt_acked()
+{
+  return mqttclient.acked;
+}
+
+unsigned long mqtt_resent()
+{
+  return mqttclient.resent;
+}
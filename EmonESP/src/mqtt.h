@@ -31,6 +31,8 @@
 // -------------------------------------------------------------------
 
 #include <Arduino.h>
+#include "record.h"
+#include "supervisor.h"
 
 // -------------------------------------------------------------------
 // Perform the background MQTT operations. Must be called in the main
@@ -41,9 +43,65 @@ extern void mqtt_loop();
 // -------------------------------------------------------------------
 // Publish values to MQTT
 //
-// data: a comma seperated list of name:value pairs to send
+// rec: the parsed name:value pairs to send
+// time: when the record arrived, as kept by the publisher
+//
+// Returns true once the whole record has been handed to the client. At
+// QoS 1 a record with more messages than there are free queue slots
+// goes out in parts: call again with the same record and time once
+// mqtt_ready() says so
 // -------------------------------------------------------------------
-extern void mqtt_publish(String data);
+extern boolean mqtt_publish(const Record& rec, unsigned long time);
+
+// -------------------------------------------------------------------
+// True when (the rest of) a record can be published without waiting:
+// connected, and as many free QoS 1 slots as it has messages left, or
+// an empty queue if it has more than the queue holds
+// -------------------------------------------------------------------
+extern boolean mqtt_ready(const Record& rec, unsigned long time);
+
+// -------------------------------------------------------------------
+// Render the "<base-topic>/<prefix>" topic prefix. Call once the MQTT
+// settings have been loaded or changed
+// -------------------------------------------------------------------
+extern void mqtt_topic_setup();
+
+// Longest topic, prefix and key included
+#define MQTT_TOPIC_SIZE 128
+
+// Time to publish the last record and maximum since boot (us)
+extern unsigned long mqtt_publish_us;
+extern unsigned long mqtt_publish_us_max;
+
+// Free heap lost while publishing the last record; expected to be 0
+extern long mqtt_publish_heap;
+
+// Time spent in the last mqtt_loop() and maximum since boot (us)
+extern unsigned long mqtt_loop_us;
+extern unsigned long mqtt_loop_us_max;
+
+// Use the event driven client on ESPAsyncTCP (async_mqtt.h) instead of
+// PubSubClient, so connecting to a broker that is down never blocks
+// loop(). Opt in with -DMQTT_ASYNC=1
+#ifndef MQTT_ASYNC
+#define MQTT_ASYNC 0
+#endif
+
+// QoS of the readings. QoS 1 messages are kept by the client until
+// the broker acknowledges them, across reconnects
+#ifndef MQTT_PUBLISH_QOS
+#define MQTT_PUBLISH_QOS 1
+#endif
+
+// Messages the client could not send or queue
+extern unsigned long mqtt_publish_failed;
+
+// QoS 1 state: messages queued, of those in flight, acknowledged and
+// sent again after a reconnect
+extern uint8_t mqtt_queued();
+extern uint8_t mqtt_inflight();
+extern unsigned long mqtt_acked();
+extern unsigned long mqtt_resent();
 
 // -------------------------------------------------------------------
 // Restart the MQTT connection
@@ -56,4 +114,10 @@ extern void mqtt_restart();
 // -------------------------------------------------------------------
 extern boolean mqtt_connected();
 
+// Circuit breaker of the broker connection
+extern Supervisor mqtt_supervisor;
+
+// Failed connection attempts that open the circuit
+#define MQTT_FAILURE_THRESHOLD 1
+
 #endif // _EMONESP_MQTT_H
@@ -0,0 +1,102 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "ntp.h"
+
+#include <time.h>
+#include <TimeLib.h>
+
+unsigned long ntp_sync_ms = 0;
+
+// Sync provider for the Time library: the SNTP clock, once it is set
+static time_t ntp_provider()
+{
+  time_t t = time(NULL);
+  return ntp_is_unix(t) ? t : 0;
+}
+
+void ntp_setup()
+{
+  // UTC: emoncms takes Unix time
+  configTime(0, 0, NTP_SERVER);
+  setSyncInterval(NTP_RETRY_INTERVAL);
+  setSyncProvider(ntp_provider);
+}
+
+boolean ntp_synced()
+{
+  if (ntp_sync_ms != 0) {
+    return true;
+  }
+  // now() polls the provider when a sync is due
+  now();
+  if (timeStatus() == timeNotSet) {
+    return false;
+  }
+  ntp_sync_ms = millis();
+  if (ntp_sync_ms == 0) {
+    ntp_sync_ms = 1;
+  }
+  setSyncInterval(NTP_SYNC_INTERVAL);
+  DEBUG.print("SNTP time: ");
+  DEBUG.println(now());
+  return true;
+}
+
+unsigned long ntp_now()
+{
+  return ntp_synced() ? now() : 0;
+}
+
+unsigned long ntp_stamp(unsigned long ms)
+{
+  if (!ntp_synced()) {
+    return ms / 1000;
+  }
+  return ntp_now() - (millis() - ms) / 1000;
+}
+
+boolean ntp_is_unix(unsigned long time)
+{
+  return time >= NTP_UNIX_MIN;
+}
+
+unsigned long ntp_to_unix(unsigned long time)
+{
+  if (ntp_is_unix(time) || !ntp_synced()) {
+    return time;
+  }
+  return ntp_now() - (millis() / 1000 - time);
+}
+
+unsigned long ntp_age(unsigned long time)
+{
+  if (ntp_is_unix(time)) {
+    unsigned long t = ntp_now();
+    return t > time ? t - time : 0;
+  }
+  return millis() / 1000 - time;
+}
@@ -0,0 +1,92 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_NTP_H
+#define _EMONESP_NTP_H
+
+#include <Arduino.h>
+
+// -------------------------------------------------------------------
+// Wall-clock time from SNTP
+//
+// The ESP8266 core's SNTP client sets the system clock; the Time
+// library pulls from it through setSyncProvider() and keeps now().
+// Sample sets are stamped with millis() when their line completes.
+// Once SNTP has set the clock those stamps are converted to Unix time,
+// so emoncms gets explicit timestamps however late a set is uploaded.
+// Until then times are seconds since boot, as before.
+//
+// A time is told apart by its size: seconds since boot never reach
+// NTP_UNIX_MIN, Unix times from a synchronised clock always do.
+// -------------------------------------------------------------------
+
+#define NTP_SERVER   "pool.ntp.org"
+#define NTP_UNIX_MIN 1500000000UL      // 2017-07-14
+
+// Seconds between Time library syncs, before and after the first one
+#define NTP_RETRY_INTERVAL 10
+#define NTP_SYNC_INTERVAL  3600
+
+extern unsigned long ntp_sync_ms;       // millis() of the first sync, 0 if none
+
+// -------------------------------------------------------------------
+// Start SNTP. It runs in the background once WiFi is connected
+// -------------------------------------------------------------------
+extern void ntp_setup();
+
+// -------------------------------------------------------------------
+// True once the clock holds Unix time; it stays set until reboot
+// -------------------------------------------------------------------
+extern boolean ntp_synced();
+
+// -------------------------------------------------------------------
+// Unix time now, 0 if not synchronised
+// -------------------------------------------------------------------
+extern unsigned long ntp_now();
+
+// -------------------------------------------------------------------
+// The time of a millis() stamp: Unix time if synchronised, otherwise
+// seconds since boot
+// -------------------------------------------------------------------
+extern unsigned long ntp_stamp(unsigned long ms);
+
+// -------------------------------------------------------------------
+// Whether a time from ntp_stamp() is Unix time
+// -------------------------------------------------------------------
+extern boolean ntp_is_unix(unsigned long time);
+
+// -------------------------------------------------------------------
+// A time from ntp_stamp() as Unix time. Seconds since boot are taken
+// to be from this boot and are returned unchanged until the clock is
+// synchronised
+// -------------------------------------------------------------------
+extern unsigned long ntp_to_unix(unsigned long time);
+
+// -------------------------------------------------------------------
+// Seconds elapsed since a time from ntp_stamp()
+// -------------------------------------------------------------------
+extern unsigned long ntp_age(unsigned long time);
+
+#endif // _EMONESP_NTP_H
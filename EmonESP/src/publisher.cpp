@@ -0,0 +1,155 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "publisher.h"
+#include "config.h"
+#include "emoncms.h"
+#include "mqtt.h"
+#include "ntp.h"
+#include "wifi.h"
+
+struct PublisherEntry {
+  unsigned long time;                   // ms since boot
+  Record record;                        // parsed once, shared by the sinks
+};
+
+struct PublisherSink {
+  const char* name;
+  boolean (*active)();                  // configured; if not, skipped
+  boolean (*ready)(const Record& rec, unsigned long time);  // can take it now
+  boolean (*publish)(const Record& rec, unsigned long time);  // false: not all sent
+
+  unsigned long cursor;                 // next sample set to hand over
+  unsigned long sent;
+  unsigned long drops;
+};
+
+// -------------------------------------------------------------------
+// Sinks
+// -------------------------------------------------------------------
+
+// The sinks need the station side of the WiFi; in AP only mode nothing
+// is kept for them
+static boolean wifi_sta()
+{
+  return wifi_mode == WIFI_MODE_STA || wifi_mode == WIFI_MODE_AP_AND_STA;
+}
+
+static boolean emoncms_active()
+{
+  return wifi_sta() && emoncms_apikey != 0;
+}
+
+// The emoncms queue takes everything, it spills to the flash backlog
+static boolean emoncms_ready(const Record& rec, unsigned long time)
+{
+  return true;
+}
+
+static boolean emoncms_sink(const Record& rec, unsigned long time)
+{
+  emoncms_publish(rec, ntp_stamp(time));
+  return true;
+}
+
+static boolean mqtt_active()
+{
+  return wifi_sta() && mqtt_server != 0;
+}
+
+static PublisherSink sinks[] = {
+  { "emoncms", emoncms_active, emoncms_ready, emoncms_sink },
+  { "mqtt", mqtt_active, mqtt_ready, mqtt_publish },
+};
+
+#define SINK_COUNT (sizeof(sinks) / sizeof(sinks[0]))
+
+// -------------------------------------------------------------------
+// Ring
+// -------------------------------------------------------------------
+
+static PublisherEntry ring[PUBLISHER_RING_SIZE];
+static unsigned long head = 0;          // sample sets pushed since boot
+
+void publisher_push(const Record& rec)
+{
+  PublisherEntry& entry = ring[head % PUBLISHER_RING_SIZE];
+  entry.time = millis();
+  record_copy(entry.record, rec);
+  head++;
+}
+
+// Pending sample sets of a sink, after dropping what was overwritten
+static unsigned long publisher_depth(PublisherSink& sink)
+{
+  unsigned long depth = head - sink.cursor;
+  if (depth > PUBLISHER_RING_SIZE) {
+    sink.drops += depth - PUBLISHER_RING_SIZE;
+    sink.cursor = head - PUBLISHER_RING_SIZE;
+    depth = PUBLISHER_RING_SIZE;
+  }
+  return depth;
+}
+
+void publisher_loop()
+{
+  for (uint8_t i = 0; i < SINK_COUNT; i++) {
+    PublisherSink& sink = sinks[i];
+    if (!sink.active()) {
+      // Not configured: nothing is kept for it
+      sink.cursor = head;
+      continue;
+    }
+    if (publisher_depth(sink) == 0) {
+      continue;
+    }
+
+    const PublisherEntry& entry = ring[sink.cursor % PUBLISHER_RING_SIZE];
+    if (!sink.ready(entry.record, entry.time)) {
+      continue;
+    }
+    // A sample set sent in parts stays at the cursor until the last one
+    if (sink.publish(entry.record, entry.time)) {
+      sink.cursor++;
+      sink.sent++;
+    }
+  }
+}
+
+void publisher_status(String& s)
+{
+  for (uint8_t i = 0; i < SINK_COUNT; i++) {
+    PublisherSink& sink = sinks[i];
+    unsigned long depth = sink.active() ? publisher_depth(sink) : 0;
+    unsigned long age = depth > 0 ? millis() - ring[sink.cursor % PUBLISHER_RING_SIZE].time : 0;
+    String prefix = String("\"") + sink.name + "_ring_";
+
+    s += prefix + "depth\":\"" + String(depth) + "\",";
+    s += prefix + "drops\":\"" + String(sink.drops) + "\",";
+    s += prefix + "sent\":\"" + String(sink.sent) + "\",";
+    s += prefix + "age_ms\":\"" + String(age) + "\",";
+  }
+}
@@ -0,0 +1,70 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_PUBLISHER_H
+#define _EMONESP_PUBLISHER_H
+
+#include <Arduino.h>
+#include "record.h"
+
+// -------------------------------------------------------------------
+// Fan-out of sample sets to the sinks
+//
+// Each sample set is stored once in a ring, as the parsed Record,
+// stamped with the time it arrived. Every sink (emoncms, MQTT, ...) has
+// its own cursor into the ring and is handed the stored records in
+// order, at most one per call of publisher_loop(), whenever it is ready
+// to take one; nothing is parsed again. A sink may take a sample set in
+// parts (MQTT at QoS 1, one message per key): it stays at the sink's
+// cursor until the last part is out. A slow or
+// disconnected sink does not hold up the others or the serial input:
+// once it falls a whole ring behind, its oldest sample sets are
+// overwritten and counted as drops for that sink.
+//
+// Sinks are listed in publisher.cpp.
+// -------------------------------------------------------------------
+
+// Each entry is a whole Record, some 600 bytes
+#define PUBLISHER_RING_SIZE 8
+
+// -------------------------------------------------------------------
+// Add a sample set to the ring
+// -------------------------------------------------------------------
+extern void publisher_push(const Record& rec);
+
+// -------------------------------------------------------------------
+// Hand the next sample set to each sink that is ready for it. Must be
+// called in the main loop function
+// -------------------------------------------------------------------
+extern void publisher_loop();
+
+// -------------------------------------------------------------------
+// Append the queue depth, drops, sent count and age of the oldest
+// pending sample set of every sink to the /status JSON, e.g.
+// "mqtt_ring_depth":"0","mqtt_ring_drops":"0",...
+// -------------------------------------------------------------------
+extern void publisher_status(String& s);
+
+#endif // _EMONESP_PUBLISHER_H
@@ -0,0 +1,128 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "record.h"
+
+unsigned long record_parse_us = 0;
+unsigned long record_parse_us_max = 0;
+long record_parse_heap = 0;
+long record_sink_heap = 0;
+
+boolean record_parse(Record& rec, const char *line)
+{
+  unsigned long start = micros();
+  long heap_before = ESP.getFreeHeap();
+
+  strlcpy(rec.line, line, sizeof(rec.line));
+  rec.count = 0;
+
+  char *p = rec.line;
+  while (*p != '\0' && rec.count < RECORD_MAX_FIELDS) {
+    RecordField& field = rec.fields[rec.count];
+    char *token = p;
+    char *colon = NULL;
+
+    while (*p != '\0' && *p != ',') {
+      if (*p == ':' && colon == NULL) colon = p;
+      p++;
+    }
+    if (*p == ',') *p++ = '\0';
+
+    if (colon != NULL) {
+      *colon = '\0';
+      field.key = token;
+      field.value = colon + 1;
+    } else {
+      snprintf(rec.index_keys[rec.count], sizeof(rec.index_keys[0]), "%u", rec.count + 1);
+      field.key = rec.index_keys[rec.count];
+      field.value = token;
+    }
+
+    // Skip empty fields such as a trailing ','
+    if (*field.value != '\0' || colon != NULL) {
+      rec.count++;
+    }
+  }
+
+  record_parse_heap = heap_before - (long)ESP.getFreeHeap();
+  record_parse_us = micros() - start;
+  if (record_parse_us > record_parse_us_max) {
+    record_parse_us_max = record_parse_us;
+  }
+
+  return rec.count > 0;
+}
+
+void record_clear(Record& rec)
+{
+  rec.line[0] = '\0';
+  rec.count = 0;
+}
+
+boolean record_add(Record& rec, const char *key, const char *value)
+{
+  size_t used = 0;
+  if (rec.count > 0) {
+    const char *last = rec.fields[rec.count - 1].value;
+    used = last + strlen(last) + 1 - rec.line;
+  }
+  size_t key_len = strlen(key) + 1;
+  size_t value_len = strlen(value) + 1;
+  if (rec.count >= RECORD_MAX_FIELDS || used + key_len + value_len > sizeof(rec.line)) {
+    return false;
+  }
+
+  RecordField& field = rec.fields[rec.count++];
+  memcpy(rec.line + used, key, key_len);
+  field.key = rec.line + used;
+  memcpy(rec.line + used + key_len, value, value_len);
+  field.value = rec.line + used + key_len;
+  return true;
+}
+
+// Fields point into the record itself, so they are moved along with it
+static const char* record_rebase(const char *p, const Record& src, Record& dst)
+{
+  if (p >= src.line && p < src.line + sizeof(src.line)) {
+    return dst.line + (p - src.line);
+  }
+  const char *keys = &src.index_keys[0][0];
+  if (p >= keys && p < keys + sizeof(src.index_keys)) {
+    return &dst.index_keys[0][0] + (p - keys);
+  }
+  return p;
+}
+
+void record_copy(Record& dst, const Record& src)
+{
+  memcpy(dst.line, src.line, sizeof(dst.line));
+  memcpy(dst.index_keys, src.index_keys, sizeof(dst.index_keys));
+  dst.count = src.count;
+  for (uint8_t i = 0; i < src.count; i++) {
+    dst.fields[i].key = record_rebase(src.fields[i].key, src, dst);
+    dst.fields[i].value = record_rebase(src.fields[i].value, src, dst);
+  }
+}
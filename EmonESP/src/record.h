@@ -0,0 +1,90 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_RECORD_H
+#define _EMONESP_RECORD_H
+
+#include <Arduino.h>
+
+// -------------------------------------------------------------------
+// One input line split into key/value fields
+//
+// The line is copied once into the record and tokenised in place: the
+// ':' and ',' separators are replaced by '\0', so every key and value
+// is a zero terminated view into Record::line and no heap is used.
+// A field without ':' gets its 1-based position as key, as emoncms does
+// for CSV input.
+// -------------------------------------------------------------------
+
+#define RECORD_LINE_SIZE  256
+#define RECORD_MAX_FIELDS 32
+
+struct RecordField {
+  const char *key;
+  const char *value;
+};
+
+struct Record {
+  char line[RECORD_LINE_SIZE];
+  char index_keys[RECORD_MAX_FIELDS][3];   // "1".."32" for CSV fields
+  uint8_t count;
+  RecordField fields[RECORD_MAX_FIELDS];
+};
+
+// Parse time of the last record and maximum since boot (us)
+extern unsigned long record_parse_us;
+extern unsigned long record_parse_us_max;
+
+// Free heap lost while parsing the last record; expected to be 0
+extern long record_parse_heap;
+
+// Free heap lost across all sinks for the last record, i.e. what the
+// sinks did not give back
+extern long record_sink_heap;
+
+// -------------------------------------------------------------------
+// Split line into rec.
+//
+// Returns false if the line is empty. Fields beyond RECORD_MAX_FIELDS
+// and text beyond RECORD_LINE_SIZE - 1 are dropped.
+// -------------------------------------------------------------------
+extern boolean record_parse(Record& rec, const char *line);
+
+// -------------------------------------------------------------------
+// Copy src into dst without parsing it again. The fields of dst point
+// into dst
+// -------------------------------------------------------------------
+extern void record_copy(Record& dst, const Record& src);
+
+// -------------------------------------------------------------------
+// Build a record field by field, without a line to parse: start with
+// record_clear() and append each key/value with record_add(), which
+// copies both into Record::line. Returns false, leaving rec as it was,
+// once there is no room left for the field.
+// -------------------------------------------------------------------
+extern void record_clear(Record& rec);
+extern boolean record_add(Record& rec, const char *key, const char *value);
+
+#endif // _EMONESP_RECORD_H
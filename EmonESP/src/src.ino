@@ -29,8 +29,15 @@
 #include "web_server.h"
 #include "ota.h"
 #include "input.h"
+#include "record.h"
+#include "aggregate.h"
+#include "deadband.h"
+#include "publisher.h"
 #include "emoncms.h"
+#include "backlog.h"
+#include "async_http.h"
 #include "mqtt.h"
+#include "ntp.h"
 
 // -------------------------------------------------------------------
 // SETUP
@@ -54,9 +61,15 @@ void setup() {
   // Initialise the WiFi
   wifi_setup();
 
+  // Wall-clock time for sample timestamps
+  ntp_setup();
+
   // Bring up the web server
   web_server_setup();
 
+  // Find the upload backlog left in SPIFFS
+  backlog_setup();
+
   // Start the OTA update systems
   ota_setup();
 
@@ -73,22 +86,35 @@ void loop()
   ota_loop();
   web_server_loop();
   wifi_loop();
+  async_http_loop();
+
+  // Parsed once, every sink consumes the same fields. Sample sets are
+  // folded into aggregation windows and fields inside the deadband are
+  // dropped here, for all sinks
+  static Record record;
+  boolean gotInput = input_get(record);
+  gotInput = aggregate(record, gotInput) && deadband_filter(record);
+  long heap_before = ESP.getFreeHeap();
 
-  String input = "";
-  boolean gotInput = input_get(input);
+  // Stored once; each sink takes it when it is ready
+  if (gotInput) {
+    publisher_push(record);
+  }
 
   if (wifi_mode == WIFI_MODE_STA || wifi_mode == WIFI_MODE_AP_AND_STA)
   {
-    if(emoncms_apikey != 0 && gotInput) {
-      emoncms_publish(input);
+    if(emoncms_apikey != 0) {
+      emoncms_loop();
     }
     if(mqtt_server != 0)
     {
       mqtt_loop();
-      if(gotInput) {
-        mqtt_publish(input);
-      }
     }
   }
+  publisher_loop();
+
+  if (gotInput) {
+    record_sink_heap = heap_before - (long)ESP.getFreeHeap();
+  }
 } // end loop
 
@@ -0,0 +1,110 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "emonesp.h"
+#include "supervisor.h"
+
+void supervisor_init(Supervisor& sv, const char* name, uint8_t threshold)
+{
+  memset(&sv, 0, sizeof(sv));
+  sv.name = name;
+  sv.threshold = threshold;
+  sv.state = SUPERVISOR_CLOSED;
+  sv.backoff = SUPERVISOR_BACKOFF_MIN;
+}
+
+boolean supervisor_allow(Supervisor& sv)
+{
+  switch (sv.state) {
+    case SUPERVISOR_CLOSED:
+      return true;
+    case SUPERVISOR_OPEN:
+      if (millis() - sv.opened_at < sv.retry_in) {
+        return false;
+      }
+      sv.state = SUPERVISOR_HALF_OPEN;
+      sv.probing = false;
+      // fall through
+    case SUPERVISOR_HALF_OPEN:
+      if (sv.probing) {
+        return false;
+      }
+      sv.probing = true;
+      return true;
+  }
+  return false;
+}
+
+void supervisor_success(Supervisor& sv)
+{
+  if (sv.state != SUPERVISOR_CLOSED) {
+    DEBUG.printf("%s: circuit closed\n", sv.name);
+  }
+  sv.state = SUPERVISOR_CLOSED;
+  sv.failures = 0;
+  sv.probing = false;
+  sv.backoff = SUPERVISOR_BACKOFF_MIN;
+  sv.successes++;
+  sv.last_success = millis();
+}
+
+void supervisor_failure(Supervisor& sv)
+{
+  sv.errors++;
+  if (sv.failures < 255) {
+    sv.failures++;
+  }
+
+  if (sv.state == SUPERVISOR_HALF_OPEN) {
+    // Failed probe: wait twice as long
+    sv.backoff = min(sv.backoff * 2, (unsigned long)SUPERVISOR_BACKOFF_MAX);
+  } else if (sv.state == SUPERVISOR_CLOSED && sv.failures < sv.threshold) {
+    return;
+  }
+
+  // Equal jitter: between half and all of the backoff, so sinks that
+  // failed together do not retry together
+  sv.state = SUPERVISOR_OPEN;
+  sv.probing = false;
+  sv.opened_at = millis();
+  sv.retry_in = sv.backoff / 2 + random(sv.backoff / 2 + 1);
+  sv.trips++;
+  DEBUG.printf("%s: circuit open, retry in %lu ms\n", sv.name, sv.retry_in);
+}
+
+void supervisor_status(String& s, const Supervisor& sv)
+{
+  static const char* names[] = { "closed", "open", "half-open" };
+  String prefix = String("\"") + sv.name + "_";
+
+  s += prefix + "state\":\"" + names[sv.state] + "\",";
+  s += prefix + "successes\":\"" + String(sv.successes) + "\",";
+  s += prefix + "errors\":\"" + String(sv.errors) + "\",";
+  s += prefix + "failures\":\"" + String(sv.failures) + "\",";
+  s += prefix + "trips\":\"" + String(sv.trips) + "\",";
+  s += prefix + "backoff_ms\":\"" + String(sv.state == SUPERVISOR_OPEN ? sv.retry_in : 0) + "\",";
+  s += prefix + "last_success_s\":\"" +
+       String(sv.successes ? (millis() - sv.last_success) / 1000 : 0) + "\",";
+}
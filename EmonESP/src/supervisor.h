@@ -0,0 +1,82 @@
+/*
+ * -------------------------------------------------------------------
+ * EmonESP Serial to Emoncms gateway
+ * -------------------------------------------------------------------
+ * Adaptation of Chris Howells OpenEVSE ESP Wifi
+ * by Trystan Lea, Glyn Hudson, OpenEnergyMonitor
+ * All adaptation GNU General Public License as below.
+ *
+ * -------------------------------------------------------------------
+ *
+ * This file is part of OpenEnergyMonitor.org project.
+ * EmonESP is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * EmonESP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with EmonESP; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _EMONESP_SUPERVISOR_H
+#define _EMONESP_SUPERVISOR_H
+
+#include <Arduino.h>
+
+// -------------------------------------------------------------------
+// Connectivity supervisor (circuit breaker) for one sink
+//
+// closed:    normal operation, every attempt is allowed
+// open:      after `threshold` consecutive failures nothing is tried
+//            until a jittered, exponentially growing backoff expires
+// half-open: one probe attempt; success closes the circuit, failure
+//            opens it again with twice the backoff
+// -------------------------------------------------------------------
+
+#define SUPERVISOR_CLOSED    0
+#define SUPERVISOR_OPEN      1
+#define SUPERVISOR_HALF_OPEN 2
+
+#define SUPERVISOR_BACKOFF_MIN 5000       // ms
+#define SUPERVISOR_BACKOFF_MAX 600000     // ms
+
+struct Supervisor {
+  const char* name;
+  uint8_t threshold;        // consecutive failures that open the circuit
+  uint8_t state;
+  uint8_t failures;         // consecutive failures
+  boolean probing;          // half-open probe in progress
+  unsigned long backoff;    // current backoff (ms)
+  unsigned long opened_at;
+  unsigned long retry_in;   // jittered wait before the next probe (ms)
+
+  // Health counters
+  unsigned long successes;
+  unsigned long errors;
+  unsigned long trips;      // times the circuit opened
+  unsigned long last_success;
+};
+
+extern void supervisor_init(Supervisor& sv, const char* name, uint8_t threshold);
+
+// -------------------------------------------------------------------
+// Returns true if the sink may try now. Report the outcome of every
+// allowed attempt with supervisor_success() or supervisor_failure()
+// -------------------------------------------------------------------
+extern boolean supervisor_allow(Supervisor& sv);
+
+extern void supervisor_success(Supervisor& sv);
+extern void supervisor_failure(Supervisor& sv);
+
+// -------------------------------------------------------------------
+// Append the supervisor state to a /status JSON object, as
+// "<name>_state":"closed","<name>_errors":"3",... with a trailing ','
+// -------------------------------------------------------------------
+extern void supervisor_status(String& s, const Supervisor& sv);
+
+#endif // _EMONESP_SUPERVISOR_H
@@ -33,7 +33,15 @@
 #include "wifi.h"
 #include "mqtt.h"
 #include "input.h"
+#include "record.h"
+#include "cbor.h"
+#include "deadband.h"
+#include "aggregate.h"
+#include "publisher.h"
+#include "ntp.h"
 #include "emoncms.h"
+#include "backlog.h"
+#include "http.h"
 #include "ota.h"
 #include "debug.h"
 
@@ -221,11 +229,13 @@ handleSaveMqtt(AsyncWebServerRequest *request) {
                    request->arg("topic"),
                    request->arg("prefix"),
                    request->arg("user"),
-                   request->arg("pass"));
+                   request->arg("pass"),
+                   request->arg("format"));
 
   char tmpStr[200];
-  snprintf(tmpStr, sizeof(tmpStr), "Saved: %s %s %s %s %s", mqtt_server.c_str(),
-           mqtt_topic.c_str(), mqtt_feed_prefix.c_str(), mqtt_user.c_str(), mqtt_pass.c_str());
+  snprintf(tmpStr, sizeof(tmpStr), "Saved: %s %s %s %s %s %s", mqtt_server.c_str(),
+           mqtt_topic.c_str(), mqtt_feed_prefix.c_str(), mqtt_user.c_str(), mqtt_pass.c_str(),
+           mqtt_format.c_str());
   DBUGLN(tmpStr);
 
   response->setCode(200);
@@ -236,6 +246,31 @@ handleSaveMqtt(AsyncWebServerRequest *request) {
   mqttRestartTime = millis();
 }
 
+// -------------------------------------------------------------------
+// Save the filter applied to readings
+// url: /savefilter
+// -------------------------------------------------------------------
+void
+handleSaveFilter(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response;
+  if(false == requestPreProcess(request, response, "text/plain")) {
+    return;
+  }
+
+  config_save_filter(request->arg("deadband"),
+                     request->arg("heartbeat"),
+                     request->arg("window"));
+
+  char tmpStr[200];
+  snprintf(tmpStr, sizeof(tmpStr), "Saved: %s %s %s", deadband.c_str(),
+           deadband_heartbeat.c_str(), aggregate_window.c_str());
+  DBUGLN(tmpStr);
+
+  response->setCode(200);
+  response->print(tmpStr);
+  request->send(response);
+}
+
 // -------------------------------------------------------------------
 // Save the web site user/pass
 // url: /saveadmin
@@ -260,15 +295,36 @@ handleSaveAdmin(AsyncWebServerRequest *request) {
 // -------------------------------------------------------------------
 // Last values on atmega serial
 // url: /lastvalues
+//
+// Accept: application/cbor returns the fields as a CBOR map of numbers
+// instead of the "key:value,..." text
 // -------------------------------------------------------------------
 void handleLastValues(AsyncWebServerRequest *request) {
+  AsyncWebHeader *accept = request->getHeader("Accept");
+  boolean cbor = accept != NULL && accept->value().indexOf(CBOR_CONTENT_TYPE) >= 0;
+
   AsyncResponseStream *response;
-  if(false == requestPreProcess(request, response, "text/plain")) {
+  if(false == requestPreProcess(request, response, cbor ? CBOR_CONTENT_TYPE : "text/plain")) {
     return;
   }
+  response->addHeader("Vary", "Accept");
 
   response->setCode(200);
-  response->print(last_datastr);
+  if (cbor) {
+    // Streamed into the response as it is rendered
+    CborWriter w;
+    cbor_begin(w, response);
+    cbor_map(w, last_record.count);
+    for (uint8_t i = 0; i < last_record.count; i++) {
+      cbor_text(w, last_record.fields[i].key);
+      cbor_number(w, last_record.fields[i].value);
+    }
+  } else {
+    for (uint8_t i = 0; i < last_record.count; i++) {
+      if (i > 0) response->print(",");
+      response->printf("%s:%s", last_record.fields[i].key, last_record.fields[i].value);
+    }
+  }
   request->send(response);
 }
 
@@ -300,8 +356,73 @@ handleStatus(AsyncWebServerRequest *request) {
   s += "\"emoncms_connected\":\""+String(emoncms_connected)+"\",";
   s += "\"packets_sent\":\""+String(packets_sent)+"\",";
   s += "\"packets_success\":\""+String(packets_success)+"\",";
+  s += "\"emoncms_queued\":\""+String(emoncms_queued())+"\",";
+  s += "\"emoncms_samples_sent\":\""+String(emoncms_samples_sent)+"\",";
+  s += "\"emoncms_samples_dropped\":\""+String(emoncms_samples_dropped)+"\",";
+  s += "\"emoncms_bytes_per_sample\":\""+String(emoncms_samples_sent ? emoncms_bytes_sent / emoncms_samples_sent : 0)+"\",";
+  s += "\"emoncms_requests_per_hour\":\""+String(packets_sent * 3600000.0 / millis(), 1)+"\",";
+  s += "\"emoncms_radio_ms\":\""+String(emoncms_radio_ms)+"\",";
+  s += "\"emoncms_transport\":\""+String(emoncms_transport())+"\",";
+  s += "\"emoncms_blocking_ms_max\":\""+String(emoncms_blocking_ms_max)+"\",";
+  s += "\"http_latency_median\":\""+String(http_latency_percentile(50))+"\",";
+  s += "\"http_latency_p99\":\""+String(http_latency_percentile(99))+"\",";
+  s += "\"http_connects\":\""+String(http_connects)+"\",";
+  s += "\"http_reused\":\""+String(http_reused)+"\",";
+  s += "\"tls_handshakes\":\""+String(tls_handshakes)+"\",";
+  s += "\"tls_resumed\":\""+String(tls_resumed)+"\",";
+  s += "\"tls_handshake_ms\":\""+String(tls_handshake_ms)+"\",";
+  s += "\"tls_handshake_ms_max\":\""+String(tls_handshake_ms_max)+"\",";
+  s += "\"tls_heap_min\":\""+String(tls_heap_min)+"\",";
+  s += "\"backlog_pending\":\""+String(backlog_pending())+"\",";
+  s += "\"backlog_written\":\""+String(backlog_written)+"\",";
+  s += "\"backlog_sent\":\""+String(backlog_sent)+"\",";
+  s += "\"backlog_lost\":\""+String(backlog_lost)+"\",";
+  s += "\"backlog_saved\":\""+String(backlog_saved)+"\",";
+  s += "\"ntp_time\":\""+String(ntp_now())+"\",";
+  s += "\"ntp_synced_ms\":\""+String(ntp_sync_ms)+"\",";
+  supervisor_status(s, emoncms_supervisor);
 
   s += "\"mqtt_connected\":\""+String(mqtt_connected())+"\",";
+  supervisor_status(s, mqtt_supervisor);
+  s += "\"mqtt_publish_us\":\""+String(mqtt_publish_us)+"\",";
+  s += "\"mqtt_publish_us_max\":\""+String(mqtt_publish_us_max)+"\",";
+  s += "\"mqtt_publish_heap\":\""+String(mqtt_publish_heap)+"\",";
+  s += "\"mqtt_publish_failed\":\""+String(mqtt_publish_failed)+"\",";
+  s += "\"mqtt_loop_us\":\""+String(mqtt_loop_us)+"\",";
+  s += "\"mqtt_loop_us_max\":\""+String(mqtt_loop_us_max)+"\",";
+  s += "\"mqtt_queued\":\""+String(mqtt_queued())+"\",";
+  s += "\"mqtt_inflight\":\""+String(mqtt_inflight())+"\",";
+  s += "\"mqtt_acked\":\""+String(mqtt_acked())+"\",";
+  s += "\"mqtt_resent\":\""+String(mqtt_resent())+"\",";
+  s += "\"wifi_down_ms\":\""+String(wifi_down_ms())+"\",";
+
+  // Share of the frames received that were rejected, and the byte error
+  // rate it implies: at least one bad byte per rejected frame
+  uint32_t link_received = link_decoder.frames + link_decoder.duplicates + link_decoder.crc_errors;
+  s += "\"link_bytes\":\""+String(link_decoder.bytes)+"\",";
+  s += "\"link_frames\":\""+String(link_decoder.frames)+"\",";
+  s += "\"link_crc_errors\":\""+String(link_decoder.crc_errors)+"\",";
+  s += "\"link_crc_per_frame\":\""+String(link_received > 0 ? (float)link_decoder.crc_errors / link_received : 0.0f, 4)+"\",";
+  s += "\"link_byte_errors\":\""+String(link_decoder.bytes > 0 ? (float)link_decoder.crc_errors / link_decoder.bytes : 0.0f, 6)+"\",";
+  s += "\"link_dropped\":\""+String(link_decoder.dropped)+"\",";
+  s += "\"link_duplicates\":\""+String(link_decoder.duplicates)+"\",";
+  s += "\"input_overflows\":\""+String(input_overflows)+"\",";
+  s += "\"input_timeouts\":\""+String(input_timeouts)+"\",";
+  s += "\"record_parse_us\":\""+String(record_parse_us)+"\",";
+  s += "\"record_parse_us_max\":\""+String(record_parse_us_max)+"\",";
+  s += "\"record_parse_heap\":\""+String(record_parse_heap)+"\",";
+  s += "\"record_sink_heap\":\""+String(record_sink_heap)+"\",";
+  s += "\"deadband_sent\":\""+String(deadband_sent)+"\",";
+  s += "\"deadband_suppressed\":\""+String(deadband_suppressed)+"\",";
+  s += "\"deadband_suppressed_ratio\":\""+String(deadband_sent + deadband_suppressed ? (float)deadband_suppressed / (deadband_sent + deadband_suppressed) : 0, 3)+"\",";
+  s += "\"deadband_untracked\":\""+String(deadband_untracked)+"\",";
+  s += "\"aggregate_samples\":\""+String(aggregate_samples)+"\",";
+  s += "\"aggregate_windows\":\""+String(aggregate_windows)+"\",";
+  s += "\"aggregate_keys\":\""+String(aggregate_keys())+"\",";
+  s += "\"aggregate_untracked\":\""+String(aggregate_untracked)+"\",";
+  s += "\"aggregate_non_numeric\":\""+String(aggregate_non_numeric)+"\",";
+  s += "\"aggregate_truncated\":\""+String(aggregate_truncated)+"\",";
+  publisher_status(s);
 
   s += "\"free_heap\":\"" + String(ESP.getFreeHeap()) + "\"";
 
@@ -318,6 +439,10 @@ handleStatus(AsyncWebServerRequest *request) {
   s += ",\"mqtt_user\":\"" + mqtt_user + "\"";
   //s += ",\"mqtt_pass\":\""+mqtt_pass+"\""; security risk: DONT RETURN PASSWORDS
   s += ",\"mqtt_feed_prefix\":\""+mqtt_feed_prefix+"\"";
+  s += ",\"mqtt_format\":\""+mqtt_format+"\"";
+  s += ",\"deadband\":\""+deadband+"\"";
+  s += ",\"deadband_heartbeat\":\""+deadband_heartbeat+"\"";
+  s += ",\"aggregate_window\":\""+aggregate_window+"\"";
   s += ",\"www_username\":\"" + www_username + "\"";
   //s += ",\"www_password\":\""+www_password+"\""; security risk: DONT RETURN PASSWORDS
 #endif
@@ -352,7 +477,11 @@ handleConfig(AsyncWebServerRequest *request) {
   s += "\"mqtt_server\":\"" + mqtt_server + "\",";
   s += "\"mqtt_topic\":\"" + mqtt_topic + "\",";
   s += "\"mqtt_feed_prefix\":\"" + mqtt_feed_prefix + "\",";
+  s += "\"mqtt_format\":\"" + mqtt_format + "\",";
   s += "\"mqtt_user\":\"" + mqtt_user + "\",";
+  s += "\"deadband\":\"" + deadband + "\",";
+  s += "\"deadband_heartbeat\":\"" + deadband_heartbeat + "\",";
+  s += "\"aggregate_window\":\"" + aggregate_window + "\",";
   //s += "\"mqtt_pass\":\""+mqtt_pass+"\","; security risk: DONT RETURN PASSWORDS
   s += "\"www_username\":\"" + www_username + "\"";
   //s += "\"www_password\":\""+www_password+"\","; security risk: DONT RETURN PASSWORDS
@@ -614,6 +743,7 @@ web_server_setup()
   server.on("/savenetwork", handleSaveNetwork);
   server.on("/saveemoncms", handleSaveEmoncms);
   server.on("/savemqtt", handleSaveMqtt);
+  server.on("/savefilter", handleSaveFilter);
   server.on("/saveadmin", handleSaveAdmin);
 
   server.on("/reset", handleRst);
@@ -51,6 +51,18 @@ String ipaddress = "";
 unsigned long Timer;
 String st, rssi;
 
+// Last time the station link was seen up, and since when its status
+// has not changed
+static unsigned long wifi_last_connected = 0;
+static wl_status_t wifi_last_status = WL_IDLE_STATUS;
+static unsigned long wifi_status_since = 0;
+
+// Scans run while the link is down, to tell a wedged stack from a
+// router that is off
+static boolean wifi_probing = false;
+static unsigned long wifi_probe_time = 0;
+static uint8_t wifi_scan_failures = 0;
+
 #ifdef WIFI_LED
 #ifndef WIFI_LED_ON_STATE
 #define WIFI_LED_ON_STATE LOW
@@ -208,6 +220,57 @@ wifi_setup() {
   }
 
   Timer = millis();
+  wifi_last_connected = Timer;
+  wifi_status_since = Timer;
+}
+
+// -------------------------------------------------------------------
+// Scan in the background while the link is down. A stack that cannot
+// scan, or that keeps the same status for WIFI_WEDGED_TIMEOUT with the
+// network in range, is wedged and the ESP is restarted. A network out
+// of range, e.g. a router switched off, only means waiting: the SDK
+// reconnects on its own when it comes back
+// -------------------------------------------------------------------
+static void
+wifi_probe() {
+  if (!wifi_probing) {
+    if (millis() - wifi_probe_time >= WIFI_PROBE_INTERVAL) {
+      wifi_probing = true;
+      wifi_probe_time = millis();
+      WiFi.scanNetworks(true);
+    }
+    return;
+  }
+
+  int8_t n = WiFi.scanComplete();
+  if (n == WIFI_SCAN_RUNNING && millis() - wifi_probe_time < WIFI_SCAN_TIMEOUT) {
+    return;
+  }
+  wifi_probing = false;
+  wifi_probe_time = millis();
+
+  boolean in_range = false;
+  for (int8_t i = 0; i < n; i++) {
+    if (WiFi.SSID(i) == esid) {
+      in_range = true;
+    }
+  }
+  if (n >= 0) {
+    WiFi.scanDelete();
+    wifi_scan_failures = 0;
+  } else {
+    // Failed, or still running after WIFI_SCAN_TIMEOUT
+    wifi_scan_failures++;
+  }
+
+  // A wrong password is an answer, not a stuck status
+  boolean stuck = in_range && wifi_last_status != WL_CONNECT_FAILED &&
+    millis() - wifi_status_since >= WIFI_WEDGED_TIMEOUT;
+  if (wifi_scan_failures >= WIFI_SCAN_FAILURES || stuck) {
+    DEBUG.println("WiFi stack wedged, restarting");
+    ESP.restart();
+  }
+  DEBUG.printf("WiFi down, network %s\n", in_range ? "in range" : "not found");
 }
 
 void
@@ -229,6 +292,30 @@ wifi_loop() {
        DEBUG.println("WIFI Mode = 1, resetting");
      }
   }
+
+  // The station link has not come back on its own: find out why
+  if (wifi_mode == WIFI_MODE_STA || wifi_mode == WIFI_MODE_AP_AND_STA) {
+    wl_status_t status = WiFi.status();
+    if (status != wifi_last_status) {
+      wifi_last_status = status;
+      wifi_status_since = millis();
+    }
+    if (status == WL_CONNECTED) {
+      wifi_last_connected = millis();
+      wifi_probing = false;
+      wifi_scan_failures = 0;
+    } else if (millis() - wifi_last_connected >= WIFI_WEDGED_TIMEOUT) {
+      wifi_probe();
+    }
+  }
+}
+
+unsigned long
+wifi_down_ms() {
+  if (WiFi.status() == WL_CONNECTED) {
+    return 0;
+  }
+  return millis() - wifi_last_connected;
 }
 
 void
@@ -1,15 +1,18 @@
 #define DEBUG 0
 
 #define BPS 115200 //Velocidad de las comunicaciones
+#define ESP_LINK_BINARY 1 //1: trama binaria con CRC hacia el ESP, 0: linea de texto
+#define ESP_LINK_TRANSPORT 0 //0: SoftwareSerial, 1: USART, 2: Timer1 (D9), 3: SC16IS750 (ver esp_link.h)
 
-#include <SoftwareSerial.h>
 #define RXPIN 6
 #define TXPIN 5
-SoftwareSerial wifiSerialInit (RXPIN,TXPIN);
 
 #include <FaBoLCD_PCF8574.h>
 FaBoLCD_PCF8574 lcd;
 
+#include "memory_usage.h"
+#include "message_format.h"
+#include "esp_link.h"
 #include "temperature_sensor.h"
 #include "power_sensor.h"
 
@@ -19,9 +22,10 @@ uint32_t t_last_lcd=0;
 void setup(void)
 
   { 
-     
+     ramPaint();
+
      Serial.begin(BPS);
-     wifiSerialInit.begin(BPS);
+     espLinkBegin();
      temperatureSensorsBegin();
 
      lcd.begin(16, 2);
@@ -35,18 +39,31 @@ void loop(void)
     
     if ((current_time - t_last_tx) > 40000)
       {      
-        Serial.print(F("******Print WIFI - sgs: "));
+        log_out.print(F("******Print WIFI - sgs: "));
         t_last_tx = current_time;
-        Serial.println(millis() / 1000);
-        //buildTemperatureMessage(0);
+        log_out.println(millis() / 1000);
+        sweepBegin(msg_sweep);
         buildPowerMessage(0);
+        buildTemperatureMessage(0);
+        sendSweep(log_out, msg_sweep);
+        espLinkSendSweep(msg_sweep);
+
+        log_out.print(F("fmt_us:"));      log_out.print(fmt_time_last);
+        log_out.print(F(" fmt_us_max:")); log_out.print(fmt_time_max);
+        log_out.print(F(" ram_min_free:")); log_out.print(ramMinFree());
+        log_out.print(F(" sweep_dropped:")); log_out.print(msg_sweep.dropped);
+        log_out.print(F(" frame_bytes:")); log_out.print(msg_sweep.frame.length());
+        log_out.print(F(" link_tx_us:")); log_out.print(esp_link_stats.tx_us);
+        log_out.print(F(" link_tx_us_max:")); log_out.print(esp_link_stats.tx_us_max);
+        log_out.print(F(" link_irq_off_us:")); log_out.print(esp_link_stats.irq_off_us);
+        log_out.print(F(" link_tx_late:")); log_out.println(esp_link_stats.tx_late);
       }
 
     if ((current_time - t_last_lcd) > 20000)
       {     
-        Serial.print(F("******Print LCD - sgs: "));
+        log_out.print(F("******Print LCD - sgs: "));
         t_last_lcd = current_time;
-        Serial.println(millis() / 1000);
+        log_out.println(millis() / 1000);
         //buildTemperatureMessage(1);
         buildPowerMessage(1);
       }
@@ -0,0 +1,279 @@
+#ifndef esp_link_h
+#define esp_link_h
+
+// *******************************************************
+// ******** TRANSPORTE DEL ENLACE NANO -> ESP       ********
+// *******************************************************
+//
+// ESP_LINK_TRANSPORT elige por donde salen los barridos hacia el ESP:
+//
+//  ESP_LINK_SOFTSERIAL  SoftwareSerial en RXPIN/TXPIN (montaje original).
+//                       Deshabilita las interrupciones durante cada byte
+//                       (~87 us a 115200), lo que bloquea millis() y
+//                       cualquier muestreo del ADC por interrupcion.
+//  ESP_LINK_USART       USART hardware (pines 0/1) con el buffer circular
+//                       de TX por interrupcion del core. El monitor serie
+//                       comparte la linea, asi que la traza se anula.
+//  ESP_LINK_TIMER1      Solo TX, estilo AltSoftSerial: el Timer1 conmuta
+//                       el pin OC1A (D9) por hardware en cada flanco y la
+//                       ISR solo programa el siguiente; buffer circular.
+//  ESP_LINK_SC16IS750   Puente I2C-UART SC16IS750 (driver WifiData de
+//                       Arduino_Uno_WiFi_Dev_Ed_Library), FIFO de 64 bytes.
+//
+// Comparativa de errores por byte a BPS=115200 con el Nano a 16 MHz. El
+// ESP8266 recibe con su UART casi exacta (80 MHz / 694, +0.06%), asi que
+// el margen de unos +-4% de una trama 8N1 se lo come casi entero el
+// error de baudios del emisor:
+//
+//  backend      baudios reales           error    bloqueo IRQ por byte
+//  SOFTSERIAL   bucle de retardo, aprox.  ~1%      ~87 us (cli)
+//  USART        16 MHz / (8 * 17)         +2.1%    0 (ISR del core)
+//  TIMER1       16 MHz / 139              -0.08%   solo la ISR del flanco
+//  SC16IS750    14.7456 MHz / (16 * 8)    0%       0 (I2C)
+//
+// Por calculo el USART es el mas ajustado y Timer1 y SC16IS750 los mas
+// holgados, pero la tasa de error real depende del cableado y solo se
+// puede medir en el montaje: con cada backend, dejar correr el enlace y
+// leer en /status del ESP link_crc_per_frame (tramas rechazadas por
+// trama recibida), link_byte_errors (rechazos por byte recibido, cota
+// inferior de la tasa por byte) y link_dropped. Aqui se mide el tiempo
+// que tarda en salir cada barrido y el tiempo con interrupciones
+// bloqueadas.
+
+#define ESP_LINK_SOFTSERIAL 0
+#define ESP_LINK_USART      1
+#define ESP_LINK_TIMER1     2
+#define ESP_LINK_SC16IS750  3
+
+#ifndef ESP_LINK_TRANSPORT
+#define ESP_LINK_TRANSPORT ESP_LINK_SOFTSERIAL
+#endif
+
+#define ESP_LINK_TX_BUFFER 64   // buffer circular del backend Timer1
+
+struct EspLinkStats
+  {
+    uint16_t tx_us;          // tiempo de la ultima llamada de envio
+    uint16_t tx_us_max;
+    uint16_t irq_off_us;     // bloqueo maximo de interrupciones por byte/ISR, medido
+    uint16_t tx_late;        // flancos que la ISR programo tarde (Timer1)
+  };
+
+EspLinkStats esp_link_stats;
+
+// Salida de traza: Serial, salvo cuando el propio Serial es el enlace
+class NullPrint : public Print
+  {
+    public:
+      size_t write(uint8_t) {return 1;}
+  };
+
+
+#if ESP_LINK_TRANSPORT == ESP_LINK_SOFTSERIAL
+
+#include <SoftwareSerial.h>
+
+// SoftwareSerial::write() hace cli() durante los 10 bits de cada byte:
+// se mide con micros() la llamada entera, que es esa ventana mas unos
+// pocos ciclos. La ventana es de menos de 1 ms, asi que micros() no
+// pierde el desbordamiento del Timer0 que quede pendiente.
+class EspLinkSoftSerial : public SoftwareSerial
+  {
+    public:
+      EspLinkSoftSerial(uint8_t rx, uint8_t tx) : SoftwareSerial(rx, tx) {}
+      size_t write(uint8_t b);
+      using Print::write;
+  };
+
+uint16_t ss_write_us_max=0;
+
+size_t EspLinkSoftSerial::write(uint8_t b)
+  {
+    uint32_t t_start = micros();
+    size_t n = SoftwareSerial::write(b);
+    uint16_t us = micros() - t_start;
+    if (us > ss_write_us_max) ss_write_us_max = us;
+    return n;
+  }
+
+EspLinkSoftSerial esp_port (RXPIN,TXPIN);
+Print &log_out = Serial;
+
+#elif ESP_LINK_TRANSPORT == ESP_LINK_USART
+
+#if !ESP_LINK_BINARY
+#error "ESP_LINK_USART comparte linea con la traza: requiere ESP_LINK_BINARY 1"
+#endif
+HardwareSerial &esp_port = Serial;
+NullPrint log_null;
+Print &log_out = log_null;
+
+#elif ESP_LINK_TRANSPORT == ESP_LINK_TIMER1
+
+// Solo transmision, OC1A = D9. Timer1 a F_CPU sin prescaler: a 115200
+// cada bit dura 139 ciclos, que es el margen de la ISR para programar
+// el siguiente flanco.
+class EspLinkTimer1 : public Print
+  {
+    public:
+      void begin(uint32_t baud);
+      size_t write(uint8_t b);
+      void flush();
+  };
+
+volatile uint8_t t1_buf[ESP_LINK_TX_BUFFER];
+volatile uint8_t t1_head=0;
+volatile uint8_t t1_tail=0;
+volatile uint8_t t1_state=0;      // 0 parado, 1..9 bits, 10 stop, 11 fin del stop
+volatile uint8_t t1_byte;
+volatile uint8_t t1_bit;
+uint16_t t1_ticks_per_bit;
+volatile uint16_t t1_isr_ticks_max=0;
+
+void EspLinkTimer1::begin(uint32_t baud)
+  {
+    t1_ticks_per_bit = (F_CPU + baud / 2) / baud;
+    digitalWrite(9, HIGH);
+    pinMode(9, OUTPUT);
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TIMSK1 = 0;
+  }
+
+size_t EspLinkTimer1::write(uint8_t b)
+  {
+    uint8_t head = (t1_head + 1) % ESP_LINK_TX_BUFFER;
+    while (head == t1_tail) ;   // buffer lleno: la ISR lo va vaciando
+
+    uint8_t sreg = SREG;
+    cli();
+    if (t1_state == 0)
+      {
+        // Bit de start: el pin baja en la siguiente coincidencia
+        t1_byte = b;
+        t1_bit = 0;
+        t1_state = 1;
+        TCCR1A = _BV(COM1A1);
+        OCR1A = TCNT1 + 16;
+        TIFR1 = _BV(OCF1A);
+        TIMSK1 |= _BV(OCIE1A);
+      }
+    else
+      {
+        t1_buf[head] = b;
+        t1_head = head;
+      }
+    SREG = sreg;
+    return 1;
+  }
+
+void EspLinkTimer1::flush()
+  {
+    while (t1_state != 0) ;
+  }
+
+ISR(TIMER1_COMPA_vect)
+  {
+    uint16_t t_enter = TCNT1;
+    uint16_t target = OCR1A;
+    uint8_t state = t1_state;
+    uint8_t byte = t1_byte;
+
+    // Busca el siguiente cambio de nivel; los bits iguales no generan ISR
+    while (state < 10)
+      {
+        uint8_t bit = (state < 9) ? (byte & 1) : 1;
+        target += t1_ticks_per_bit;
+        byte >>= 1;
+        state++;
+        if (bit != t1_bit)
+          {
+            TCCR1A = bit ? (_BV(COM1A1) | _BV(COM1A0)) : _BV(COM1A1);
+            OCR1A = target;
+            if ((int16_t)(target - TCNT1) <= 0) esp_link_stats.tx_late++;
+            t1_bit = bit;
+            t1_byte = byte;
+            t1_state = state;
+            goto done;
+          }
+      }
+
+    if (t1_head == t1_tail)
+      {
+        if (state == 10)
+          {
+            // target es el inicio del bit de stop: esperar a que termine
+            t1_state = 11;
+            OCR1A = target + t1_ticks_per_bit;
+          }
+        else
+          {
+            t1_state = 0;
+            TCCR1A = 0;
+            TIMSK1 &= ~_BV(OCIE1A);
+          }
+      }
+    else
+      {
+        uint8_t tail = (t1_tail + 1) % ESP_LINK_TX_BUFFER;
+        t1_tail = tail;
+        t1_byte = t1_buf[tail];
+        t1_bit = 0;
+        t1_state = 1;
+        TCCR1A = _BV(COM1A1);
+        OCR1A = (state == 10) ? target + t1_ticks_per_bit : TCNT1 + 16;
+      }
+
+  done:
+    uint16_t ticks = TCNT1 - t_enter;
+    if (ticks > t1_isr_ticks_max) t1_isr_ticks_max = ticks;
+  }
+
+EspLinkTimer1 esp_port;
+Print &log_out = Serial;
+
+#elif ESP_LINK_TRANSPORT == ESP_LINK_SC16IS750
+
+#include <lib/SC16IS750.h>
+WifiData esp_port;
+Print &log_out = Serial;
+
+#else
+#error "ESP_LINK_TRANSPORT desconocido"
+#endif
+
+
+// Function Prototypes
+void espLinkBegin();
+void espLinkSendSweep(MsgSweep &sweep);
+
+
+void espLinkBegin()
+  {
+    esp_port.begin(BPS);
+  }
+
+// Envia el barrido (trama binaria o linea de texto) y mide cuanto tarda
+void espLinkSendSweep(MsgSweep &sweep)
+  {
+    uint32_t t_start = micros();
+#if ESP_LINK_BINARY
+    sendSweepFrame(esp_port, sweep);
+#else
+    sendSweep(esp_port, sweep);
+#endif
+    esp_link_stats.tx_us = micros() - t_start;
+    if (esp_link_stats.tx_us > esp_link_stats.tx_us_max) esp_link_stats.tx_us_max = esp_link_stats.tx_us;
+
+#if ESP_LINK_TRANSPORT == ESP_LINK_SOFTSERIAL
+    esp_link_stats.irq_off_us = ss_write_us_max;
+#elif ESP_LINK_TRANSPORT == ESP_LINK_TIMER1
+    esp_link_stats.irq_off_us = t1_isr_ticks_max / (F_CPU / 1000000UL);
+#else
+    // USART: la ISR del core solo copia un byte al registro de datos.
+    // SC16IS750: la escritura I2C no deshabilita interrupciones.
+    esp_link_stats.irq_off_us = 0;
+#endif
+  }
+
+#endif
@@ -0,0 +1,443 @@
+/*!
+ *  @file 		ecohouse_block.cpp
+ *  @version	1.0
+ *
+ * Compact columnar encoding of buffered EcoHouse sample sets
+ * GNU GPL
+*/
+
+#include "ecohouse_block.h"
+#include "ecohouse_link.h"
+
+#include <string.h>
+
+
+/* Function: 	Zigzag mapping of a signed delta, small magnitudes first
+ * Parameters:	n: delta, at most 33 bits
+ * Return: 		unsigned value
+ */
+static uint64_t ehb_zigzag(int64_t n)
+{
+	return ((uint64_t)n << 1) ^ (uint64_t)(n >> 63);
+}
+
+static int64_t ehb_unzigzag(uint64_t u)
+{
+	return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+static size_t ehb_varint_size(uint64_t u)
+{
+	size_t n = 1;
+	while (u >= 0x80) {
+		u >>= 7;
+		n++;
+	}
+	return n;
+}
+
+static size_t ehb_put_varint(uint8_t *buf, uint64_t u)
+{
+	size_t n = 0;
+	while (u >= 0x80) {
+		buf[n++] = (uint8_t)(u | 0x80);
+		u >>= 7;
+	}
+	buf[n++] = (uint8_t)u;
+	return n;
+}
+
+/* Function: 	Reads a varint
+ * Parameters:	data, len: the block
+ *				pos: read position, advanced past the varint
+ *				u: receives the value
+ * Return: 		false if the varint is truncated or longer than 64 bits
+ */
+static bool ehb_get_varint(const uint8_t *data, size_t len, size_t &pos, uint64_t &u)
+{
+	u = 0;
+	for (uint8_t shift = 0; shift < 64; shift += 7) {
+		if (pos >= len) return false;
+		uint8_t b = data[pos++];
+		u |= (uint64_t)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+static size_t ehb_bitmap_size(uint8_t rows)
+{
+	return (rows + 7) / 8;
+}
+
+
+void ehb_frame(EcohouseBlockFrame &frame, uint16_t tag, const uint8_t *block, uint16_t length, uint8_t rows)
+{
+	frame.magic = EHB_FRAME_MAGIC;
+	frame.tag = tag;
+	frame.length = length;
+	frame.rows = rows;
+	frame.reserved = 0;
+	frame.crc = ehl_crc16_data(block, length, 0);
+}
+
+bool ehb_frame_valid(const EcohouseBlockFrame &frame, const uint8_t *block)
+{
+	return frame.magic == EHB_FRAME_MAGIC &&
+		frame.length <= EHB_MAX_BLOCK &&
+		frame.crc == ehl_crc16_data(block, frame.length, 0);
+}
+
+bool ehb_parse_value(const char *text, size_t len, int32_t &value)
+{
+	size_t i = 0;
+	bool negative = false;
+	if (i < len && (text[i] == '-' || text[i] == '+')) {
+		negative = text[i] == '-';
+		i++;
+	}
+
+	int64_t v = 0;
+	uint8_t digits = 0;
+	uint8_t decimals = 0;
+	bool point = false;
+	bool round_up = false;
+	for (; i < len; i++) {
+		char c = text[i];
+		if (c == '.' && !point) {
+			point = true;
+			continue;
+		}
+		if (c < '0' || c > '9') return false;
+		digits++;
+		if (point && decimals >= EHL_VALUE_DECIMALS) {
+			// Beyond hundredths only the first dropped digit counts
+			if (decimals++ == EHL_VALUE_DECIMALS) round_up = c >= '5';
+			continue;
+		}
+		if (point) decimals++;
+		v = v * 10 + (c - '0');
+		if (v > INT32_MAX) return false;
+	}
+	if (digits == 0) return false;
+
+	for (; decimals < EHL_VALUE_DECIMALS; decimals++) {
+		v *= 10;
+	}
+	if (round_up) v++;
+	if (v > INT32_MAX) return false;
+	value = negative ? (int32_t)-v : (int32_t)v;
+	return true;
+}
+
+bool ehb_parse_exact(const char *text, size_t len, int32_t &value)
+{
+	const char *point = (const char *)memchr(text, '.', len);
+	if (point != NULL) {
+		for (size_t i = point - text + 1 + EHL_VALUE_DECIMALS; i < len; i++) {
+			if (text[i] != '0') return false;
+		}
+	}
+	return ehb_parse_value(text, len, value);
+}
+
+
+/* Function: 	Empties the block
+ * Parameters:	none
+ * Return: 		nothing
+ */
+void EcohouseBlock::begin()
+{
+	_rows = 0;
+	_keys = 0;
+	_dict_bytes = 0;
+	_time_bytes = 0;
+}
+
+int8_t EcohouseBlock::find_key(const char *key) const
+{
+	for (uint8_t k = 0; k < _keys; k++) {
+		if (strcmp(_key[k], key) == 0) return k;
+	}
+	return -1;
+}
+
+/* Function: 	Encoded size of the time of the next row
+ * Parameters:	time: time of the next row
+ * Return: 		bytes
+ */
+size_t EcohouseBlock::time_bytes(uint32_t time) const
+{
+	if (_rows == 0) return ehb_varint_size(time);
+	int64_t delta = (int64_t)time - _time[_rows - 1];
+	if (_rows == 1) return ehb_varint_size(ehb_zigzag(delta));
+	int64_t previous = (int64_t)_time[_rows - 1] - _time[_rows - 2];
+	return ehb_varint_size(ehb_zigzag(delta - previous));
+}
+
+size_t EcohouseBlock::size() const
+{
+	size_t n = 1 + ehb_varint_size(_rows) + ehb_varint_size(_keys) + _dict_bytes + _time_bytes;
+	for (uint8_t k = 0; k < _keys; k++) {
+		n += 1 + _value_bytes[k];
+		if (_present[k] < _rows) n += ehb_bitmap_size(_rows);
+	}
+	return n;
+}
+
+/* Function: 	Appends one row, all or nothing
+ * Parameters:	time: time of the row
+ *				count, keys, values: its fields
+ * Return: 		false if the row would not fit in the block
+ */
+bool EcohouseBlock::add(uint32_t time, uint8_t count, const char *const *keys, const int32_t *values)
+{
+	uint16_t cells = _rows == 0 ? 0 : _row_end[_rows - 1];
+	if (_rows == EHB_MAX_ROWS || count > EHB_MAX_KEYS || cells + count > EHB_MAX_CELLS) return false;
+
+	// Where each field goes, new keys after the existing ones; -1 for
+	// a key repeated within the row, which is dropped
+	int8_t slot[EHB_MAX_KEYS];
+	uint8_t keys_after = _keys;
+	size_t grow = time_bytes(time);
+	for (uint8_t i = 0; i < count; i++) {
+		int8_t k = find_key(keys[i]);
+		for (uint8_t j = 0; k < 0 && j < i; j++) {
+			if (slot[j] >= _keys && strcmp(keys[j], keys[i]) == 0) k = slot[j];
+		}
+		bool repeated = false;
+		for (uint8_t j = 0; k >= 0 && j < i; j++) {
+			repeated |= slot[j] == k;
+		}
+		if (repeated) {
+			slot[i] = -1;
+			continue;
+		}
+		if (k < 0) {
+			size_t len = strlen(keys[i]);
+			if (keys_after == EHB_MAX_KEYS || len == 0 || len >= EHB_KEY_SIZE) return false;
+			k = keys_after++;
+			grow += 1 + len + 1;            // dictionary entry and flags
+			grow += ehb_varint_size(ehb_zigzag(values[i]));
+		} else {
+			grow += ehb_varint_size(ehb_zigzag((int64_t)values[i] - _last[k]));
+		}
+		slot[i] = k;
+	}
+
+	// Bitmaps of sparse columns may grow by a byte, and columns this
+	// row lacks become sparse
+	size_t after = size() + grow + ehb_varint_size(_rows + 1) - ehb_varint_size(_rows) +
+		ehb_varint_size(keys_after) - ehb_varint_size(_keys);
+	for (uint8_t k = 0; k < keys_after; k++) {
+		bool here = false;
+		for (uint8_t i = 0; i < count; i++) {
+			here |= slot[i] == k;
+		}
+		uint8_t present = (k < _keys ? _present[k] : 0) + (here ? 1 : 0);
+		bool was_sparse = k < _keys && _present[k] < _rows;
+		size_t before_bitmap = was_sparse ? ehb_bitmap_size(_rows) : 0;
+		size_t after_bitmap = present < _rows + 1 ? ehb_bitmap_size(_rows + 1) : 0;
+		after += after_bitmap - before_bitmap;
+	}
+	if (after > EHB_MAX_BLOCK) return false;
+
+	// Commit: new keys, then the cells of the row in dictionary order
+	for (uint8_t i = 0; i < count; i++) {
+		if (slot[i] < _keys) continue;
+		uint8_t k = slot[i];
+		strcpy(_key[k], keys[i]);
+		_dict_bytes += 1 + strlen(keys[i]);
+		_last[k] = 0;
+		_present[k] = 0;
+		_value_bytes[k] = 0;
+		_keys++;
+	}
+	_time_bytes += time_bytes(time);
+	_time[_rows] = time;
+	for (uint8_t k = 0; k < _keys; k++) {
+		for (uint8_t i = 0; i < count; i++) {
+			if (slot[i] != k) continue;
+			_cell_key[cells] = k;
+			_cell_value[cells++] = values[i];
+			_value_bytes[k] += ehb_varint_size(ehb_zigzag((int64_t)values[i] - _last[k]));
+			_last[k] = values[i];
+			_present[k]++;
+		}
+	}
+	_row_end[_rows++] = cells;
+	return true;
+}
+
+/* Function: 	Encodes the block
+ * Parameters:	buf, len: output buffer
+ * Return: 		encoded length, 0 if buf is too small
+ */
+size_t EcohouseBlock::encode(uint8_t *buf, size_t len) const
+{
+	if (size() > len) return 0;
+
+	size_t pos = 0;
+	buf[pos++] = EHB_VERSION;
+	pos += ehb_put_varint(buf + pos, _rows);
+	pos += ehb_put_varint(buf + pos, _keys);
+	for (uint8_t k = 0; k < _keys; k++) {
+		uint8_t n = strlen(_key[k]);
+		buf[pos++] = n;
+		memcpy(buf + pos, _key[k], n);
+		pos += n;
+	}
+
+	for (uint8_t r = 0; r < _rows; r++) {
+		if (r == 0) {
+			pos += ehb_put_varint(buf + pos, _time[0]);
+		} else {
+			int64_t delta = (int64_t)_time[r] - _time[r - 1];
+			if (r > 1) delta -= (int64_t)_time[r - 1] - _time[r - 2];
+			pos += ehb_put_varint(buf + pos, ehb_zigzag(delta));
+		}
+	}
+
+	for (uint8_t k = 0; k < _keys; k++) {
+		bool sparse = _present[k] < _rows;
+		buf[pos++] = sparse ? EHB_COLUMN_SPARSE : 0;
+		uint8_t *bitmap = buf + pos;
+		if (sparse) {
+			memset(bitmap, 0, ehb_bitmap_size(_rows));
+			pos += ehb_bitmap_size(_rows);
+		}
+		int32_t last = 0;
+		for (uint8_t r = 0; r < _rows; r++) {
+			for (uint16_t c = row_start(r); c < row_end(r); c++) {
+				if (_cell_key[c] != k) continue;
+				if (sparse) bitmap[r / 8] |= 1 << (r % 8);
+				pos += ehb_put_varint(buf + pos, ehb_zigzag((int64_t)_cell_value[c] - last));
+				last = _cell_value[c];
+			}
+		}
+	}
+	return pos;
+}
+
+/* Function: 	Replaces the block with a decoded one
+ * Parameters:	data, len: the encoded block
+ * Return: 		false if the data is not a valid block
+ */
+bool EcohouseBlock::decode(const uint8_t *data, size_t len)
+{
+	begin();
+	if (len < 1 || data[0] != EHB_VERSION) return false;
+
+	size_t pos = 1;
+	uint64_t rows, keys, u;
+	if (!ehb_get_varint(data, len, pos, rows) || rows > EHB_MAX_ROWS) return false;
+	if (!ehb_get_varint(data, len, pos, keys) || keys > EHB_MAX_KEYS) return false;
+
+	for (uint8_t k = 0; k < keys; k++) {
+		if (pos >= len) return false;
+		uint8_t n = data[pos++];
+		if (n == 0 || n >= EHB_KEY_SIZE || pos + n > len) return false;
+		memcpy(_key[k], data + pos, n);
+		_key[k][n] = '\0';
+		pos += n;
+	}
+
+	size_t times = pos;
+	int64_t delta = 0;
+	for (uint8_t r = 0; r < rows; r++) {
+		if (!ehb_get_varint(data, len, pos, u)) return false;
+		if (r == 0) {
+			_time[0] = (uint32_t)u;
+			continue;
+		}
+		delta = (r == 1 ? 0 : delta) + ehb_unzigzag(u);
+		_time[r] = (uint32_t)(_time[r - 1] + delta);
+	}
+
+	// Columns are read twice: first to count the fields of each row,
+	// then to place the values, so rows come out in dictionary order
+	size_t columns = pos;
+	uint16_t fill[EHB_MAX_ROWS];
+	memset(fill, 0, sizeof(fill));
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		pos = columns;
+		for (uint8_t k = 0; k < keys; k++) {
+			if (pos >= len) return false;
+			bool sparse = data[pos++] & EHB_COLUMN_SPARSE;
+			const uint8_t *bitmap = data + pos;
+			if (sparse) {
+				pos += ehb_bitmap_size(rows);
+				if (pos > len) return false;
+			}
+			int32_t last = 0;
+			for (uint8_t r = 0; r < rows; r++) {
+				if (sparse && !(bitmap[r / 8] & (1 << (r % 8)))) continue;
+				if (!ehb_get_varint(data, len, pos, u)) return false;
+				last = (int32_t)(last + ehb_unzigzag(u));
+				if (pass == 0) {
+					fill[r]++;
+					continue;
+				}
+				_cell_key[fill[r]] = k;
+				_cell_value[fill[r]++] = last;
+			}
+		}
+		if (pass == 0) {
+			// Row ends from the counts; fill becomes each row's start
+			uint16_t cells = 0;
+			for (uint8_t r = 0; r < rows; r++) {
+				uint16_t n = fill[r];
+				fill[r] = cells;
+				cells += n;
+				if (cells > EHB_MAX_CELLS) return false;
+				_row_end[r] = cells;
+			}
+		}
+	}
+
+	// Reload the running sizes, so rows could be added to the block
+	_keys = keys;
+	_rows = rows;
+	for (uint8_t k = 0; k < _keys; k++) {
+		_dict_bytes += 1 + strlen(_key[k]);
+		_last[k] = 0;
+		_present[k] = 0;
+		_value_bytes[k] = 0;
+	}
+	for (uint16_t c = 0; c < (_rows == 0 ? 0 : _row_end[_rows - 1]); c++) {
+		uint8_t k = _cell_key[c];
+		_value_bytes[k] += ehb_varint_size(ehb_zigzag((int64_t)_cell_value[c] - _last[k]));
+		_last[k] = _cell_value[c];
+		_present[k]++;
+	}
+	_time_bytes = columns - times;
+	return true;
+}
+
+/* Function: 	Renders a row as "p1:120.50,t1:21.50"
+ * Parameters:	row: row to render
+ *				buf, size: output buffer
+ * Return: 		number of characters written, not counting the '\0'
+ */
+size_t EcohouseBlock::format(uint8_t row, char *buf, size_t size) const
+{
+	size_t len = 0;
+	for (uint8_t i = 0; i < fields(row); i++) {
+		char item[EHB_KEY_SIZE + 14];
+		uint8_t n = 0;
+
+		if (i > 0) item[n++] = ',';
+		const char *k = key(row, i);
+		size_t kl = strlen(k);
+		memcpy(item + n, k, kl);
+		n += kl;
+		item[n++] = ':';
+		n += ehl_format_value(value(row, i), item + n);
+
+		if (len + n >= size) break;
+		memcpy(buf + len, item, n);
+		len += n;
+	}
+	if (size > 0) buf[len] = '\0';
+	return len;
+}
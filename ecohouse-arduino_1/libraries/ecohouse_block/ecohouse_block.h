@@ -0,0 +1,154 @@
+/*!
+ *  @file 		ecohouse_block.h
+ *  @version	1.0
+ *
+ * Compact columnar encoding of buffered EcoHouse sample sets
+ * GNU GPL
+ *
+ * A block holds up to EHB_MAX_ROWS sample sets. Each row has a time
+ * and any number of key:value fields; values are fixed point in
+ * hundredths, as they travel on the Nano link. The block is stored
+ * column by column (all varints are LEB128, signed ones zigzag):
+ *
+ *   VERSION | ROWS | KEYS | key dictionary | time column | value columns
+ *
+ *   VERSION     EHB_VERSION, 1 byte
+ *   ROWS, KEYS  varints
+ *   dictionary  KEYS x { length (1 byte), key text }
+ *   time        first time, then the first delta, then delta-of-delta
+ *               for every further row: regular sweeps cost 1 byte a row
+ *   column      per key, in dictionary order:
+ *                 flags    1 byte, EHB_COLUMN_SPARSE if some rows lack it
+ *                 bitmap   ceil(ROWS / 8) bytes, only if sparse; bit r
+ *                          (LSB first) set if row r has the key
+ *                 values   signed varint deltas from the previous value
+ *                          of the column, the first one from 0
+ *
+ * Blocks are kept in files as frames: an EcohouseBlockFrame header
+ * followed by the encoded block, checked by a CRC16.
+*/
+
+#ifndef ecohouse_block_h
+#define ecohouse_block_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EHB_VERSION         1
+#define EHB_MAX_ROWS        32
+#define EHB_MAX_KEYS        32
+#define EHB_MAX_CELLS       384     // fields over all rows of a block
+#define EHB_MAX_BLOCK       1024    // largest encoded block, in bytes
+#define EHB_KEY_SIZE        16      // longest key + '\0'
+#define EHB_COLUMN_SPARSE   0x01
+
+#define EHB_FRAME_MAGIC     0xB10D
+
+//! Header of a stored block
+struct EcohouseBlockFrame {
+	uint16_t magic;         // EHB_FRAME_MAGIC
+	uint16_t tag;           // left to the writer
+	uint16_t length;        // encoded block bytes that follow
+	uint8_t rows;
+	uint8_t reserved;
+	uint16_t crc;           // CRC16 of the encoded block
+};
+
+//! Fills in a frame header for an encoded block
+void ehb_frame(EcohouseBlockFrame &frame, uint16_t tag, const uint8_t *block, uint16_t length, uint8_t rows);
+
+//! Checks a frame header against the encoded block that followed it
+bool ehb_frame_valid(const EcohouseBlockFrame &frame, const uint8_t *block);
+
+//! Parses decimal text ("-12.3") into hundredths
+/*!
+\param const char *text: the value, not necessarily '\0' terminated
+\param size_t len: characters of text to parse
+\param int32_t &value: receives the value; further decimals are rounded
+\return	false if text is not a number or does not fit in hundredths
+*/
+bool ehb_parse_value(const char *text, size_t len, int32_t &value);
+
+//! As ehb_parse_value(), but only for values that hundredths hold exactly
+/*!
+\return	false as well if a decimal beyond hundredths is not 0, so that
+        the value would have to be rounded
+*/
+bool ehb_parse_exact(const char *text, size_t len, int32_t &value);
+
+
+class EcohouseBlock
+{
+	public:
+		EcohouseBlock() { begin(); }
+
+		//! Empties the block
+		void begin();
+
+		//! Appends one row, all or nothing
+		/*!
+		\param uint32_t time: time of the row
+		\param uint8_t count: number of fields
+		\param const char *const *keys: field keys, shorter than EHB_KEY_SIZE
+		\param const int32_t *values: field values in hundredths
+		\return	false if the row would not fit in the block
+		*/
+		bool add(uint32_t time, uint8_t count, const char *const *keys, const int32_t *values);
+
+		//! Exact size of the block once encoded
+		size_t size() const;
+
+		//! Encodes the block
+		/*!
+		\param uint8_t *buf: output buffer
+		\param size_t len: size of buf, EHB_MAX_BLOCK is always enough
+		\return	encoded length, 0 if buf is too small
+		*/
+		size_t encode(uint8_t *buf, size_t len) const;
+
+		//! Replaces the block with a decoded one
+		/*!
+		\return	false if the data is not a valid block; the block is
+		        then empty
+		*/
+		bool decode(const uint8_t *data, size_t len);
+
+		// Rows, oldest first, with their fields in dictionary order
+		uint8_t rows() const { return _rows; }
+		uint32_t time(uint8_t row) const { return _time[row]; }
+		uint8_t fields(uint8_t row) const { return row_end(row) - row_start(row); }
+		const char *key(uint8_t row, uint8_t i) const { return _key[_cell_key[row_start(row) + i]]; }
+		int32_t value(uint8_t row, uint8_t i) const { return _cell_value[row_start(row) + i]; }
+
+		//! Renders a row as "p1:120.50,t1:21.50"
+		/*!
+		\param uint8_t row: row to render
+		\param char *buf: output buffer
+		\param size_t size: size of buf
+		\return	number of characters written, not counting the '\0'
+		*/
+		size_t format(uint8_t row, char *buf, size_t size) const;
+
+	private:
+		uint16_t row_start(uint8_t row) const { return row == 0 ? 0 : _row_end[row - 1]; }
+		uint16_t row_end(uint8_t row) const { return _row_end[row]; }
+		int8_t find_key(const char *key) const;
+		size_t time_bytes(uint32_t time) const;
+
+		uint8_t _rows;
+		uint8_t _keys;
+		char _key[EHB_MAX_KEYS][EHB_KEY_SIZE];
+		uint32_t _time[EHB_MAX_ROWS];
+		uint16_t _row_end[EHB_MAX_ROWS];        // cells of each row end here
+		uint8_t _cell_key[EHB_MAX_CELLS];
+		int32_t _cell_value[EHB_MAX_CELLS];
+
+		// Running encoded sizes, so add() knows when the block is full
+		size_t _dict_bytes;
+		size_t _time_bytes;
+		int32_t _last[EHB_MAX_KEYS];            // last value of each column
+		uint8_t _present[EHB_MAX_KEYS];         // rows that have the key
+		uint16_t _value_bytes[EHB_MAX_KEYS];
+};
+
+#endif
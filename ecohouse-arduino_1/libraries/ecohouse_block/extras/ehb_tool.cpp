@@ -0,0 +1,343 @@
+// Host side tool for ecohouse_block
+//
+//   $ make
+//   $ ./ehb_tool decode <segment>            print the rows of a compacted
+//                                            EmonESP backlog segment
+//   $ ./ehb_tool encode <capture> <segment>  compact a capture the way the
+//                                            backlog does
+//   $ ./ehb_tool bench [capture]             compression and speed
+//
+// A capture is the serial output of the Nano, one sample set per line:
+//
+//   p1:120.50,p2:35.00,t1:21.50
+//
+// optionally preceded by its Unix time and a space. Lines without a time
+// are taken to be 10 s apart. Fields a block would not give back exactly
+// (see ehb_parse_exact()) are skipped and counted; the backlog does not
+// compact a segment that has any. Without a capture, bench generates a day
+// of readings shaped like an EcoHouse: slowly drifting powers with
+// noise, some channels idle at 0, and slow temperatures.
+//
+// No recorded capture is kept in the tree; on the generated day
+// (8640 sets of 16 fields, every 10 s) the host bench gives:
+//
+//   format                B/set      ratio days/300KB
+//   backlog record        204.0       1.00       0.17
+//   text line             160.0       1.28       0.22
+//   blocks                 29.4       6.95       1.21
+
+#include "ecohouse_block.h"
+#include "ecohouse_link.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#define SAMPLE_PERIOD   10          // s between lines without a time
+#define BACKLOG_RECORD  204         // EmonESP BacklogRecord, per sample set
+#define SPIFFS_BUDGET   (300 * 1024)
+
+struct Row {
+    uint32_t time;
+    uint8_t count;
+    char keys[EHB_MAX_KEYS][EHB_KEY_SIZE];
+    int32_t values[EHB_MAX_KEYS];
+    size_t text;                    // length of the line as text
+};
+
+static unsigned long skipped = 0;   // fields not stored exactly
+
+static bool parse_line(const char *line, uint32_t time, Row &row) {
+    const char *space = strchr(line, ' ');
+    row.time = time;
+    if (space != NULL) {
+        row.time = strtoul(line, NULL, 10);
+        line = space + 1;
+    }
+    row.count = 0;
+    row.text = strcspn(line, "\r\n");
+    const char *p = line;
+    while (row.count < EHB_MAX_KEYS && *p != '\0' && *p != '\r' && *p != '\n') {
+        const char *colon = strchr(p, ':');
+        if (colon == NULL) break;
+        const char *end = colon + 1 + strcspn(colon + 1, ",\r\n");
+        size_t len = colon - p;
+        if (len > 0 && len < EHB_KEY_SIZE &&
+            ehb_parse_exact(colon + 1, end - colon - 1, row.values[row.count])) {
+            memcpy(row.keys[row.count], p, len);
+            row.keys[row.count][len] = '\0';
+            row.count++;
+        } else {
+            skipped++;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return row.count > 0;
+}
+
+static bool load_capture(const char *path, std::vector<Row> &rows) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    char line[1024];
+    uint32_t time = 1700000000;
+    Row row;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (parse_line(line, time, row)) {
+            rows.push_back(row);
+            time = row.time + SAMPLE_PERIOD;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+// A day every 10 s: 12 powers, 4 of them mostly idle, and 4 temperatures
+static void generate(std::vector<Row> &rows) {
+    const int powers = 12, temps = 4;
+    double level[powers], temp[temps];
+    srand(1);
+    for (int i = 0; i < powers; i++) level[i] = i < 8 ? 50 + rand() % 2000 : 0;
+    for (int i = 0; i < temps; i++) temp[i] = 18 + rand() % 6;
+
+    for (uint32_t n = 0; n < 86400 / SAMPLE_PERIOD; n++) {
+        Row row;
+        row.time = 1700000000 + n * SAMPLE_PERIOD;
+        row.count = 0;
+        for (int i = 0; i < powers + temps; i++) {
+            double v;
+            if (i < powers) {
+                if (i >= 8) {
+                    // Appliances that switch on now and then
+                    level[i] = rand() % 500 == 0 ? (level[i] > 0 ? 0 : 800 + rand() % 1500) : level[i];
+                } else {
+                    level[i] += (rand() % 2001 - 1000) / 100.0;
+                    if (level[i] < 0) level[i] = 0;
+                }
+                v = level[i] > 0 ? level[i] + (rand() % 201 - 100) / 100.0 : 0;
+                snprintf(row.keys[row.count], EHB_KEY_SIZE, "p%d", i + 1);
+            } else {
+                temp[i - powers] += (rand() % 21 - 10) / 1000.0;
+                v = temp[i - powers];
+                snprintf(row.keys[row.count], EHB_KEY_SIZE, "t%d", i - powers + 1);
+            }
+            row.values[row.count++] = (int32_t)lround(v * 100);
+        }
+        char line[512];
+        size_t len = 0;
+        for (int i = 0; i < row.count; i++) {
+            char value[14];
+            ehl_format_value(row.values[i], value);
+            len += snprintf(line + len, sizeof(line) - len, "%s%s:%s", i ? "," : "", row.keys[i], value);
+        }
+        row.text = len;
+        rows.push_back(row);
+    }
+}
+
+// True if row r of block holds the same fields and values as row
+static bool same_row(const EcohouseBlock &block, uint8_t r, const Row &row) {
+    if (block.fields(r) != row.count) return false;
+    for (int i = 0; i < row.count; i++) {
+        int f = 0;
+        while (f < row.count && strcmp(block.key(r, f), row.keys[i]) != 0) f++;
+        if (f == row.count || block.value(r, f) != row.values[i]) return false;
+    }
+    return block.time(r) == row.time;
+}
+
+static bool add_row(EcohouseBlock &block, const Row &row) {
+    const char *keys[EHB_MAX_KEYS];
+    for (int i = 0; i < row.count; i++) keys[i] = row.keys[i];
+    return block.add(row.time, row.count, keys, row.values);
+}
+
+// Encodes rows into frames as the backlog does, returns the bytes
+static size_t encode_rows(const std::vector<Row> &rows, FILE *out, unsigned long *blocks) {
+    static EcohouseBlock block;
+    uint8_t data[EHB_MAX_BLOCK];
+    size_t bytes = 0;
+    block.begin();
+    for (size_t i = 0; i <= rows.size(); i++) {
+        if (i < rows.size() && add_row(block, rows[i])) continue;
+        if (block.rows() > 0) {
+            EcohouseBlockFrame frame;
+            size_t len = block.encode(data, sizeof(data));
+            ehb_frame(frame, 0, data, len, block.rows());
+            if (out != NULL) {
+                fwrite(&frame, sizeof(frame), 1, out);
+                fwrite(data, len, 1, out);
+            }
+            bytes += sizeof(frame) + len;
+            if (blocks != NULL) (*blocks)++;
+        }
+        block.begin();
+        if (i < rows.size() && !add_row(block, rows[i])) {
+            fprintf(stderr, "row %zu does not fit in a block, skipped\n", i);
+        }
+    }
+    return bytes;
+}
+
+static int decode(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    static EcohouseBlock block;
+    uint8_t data[EHB_MAX_BLOCK];
+    EcohouseBlockFrame frame;
+    unsigned long frames = 0, rows = 0, bad = 0;
+    while (fread(&frame, sizeof(frame), 1, f) == 1) {
+        if (frame.magic != EHB_FRAME_MAGIC || frame.length > EHB_MAX_BLOCK) {
+            fprintf(stderr, "frame %lu: bad header, not a compacted segment?\n", frames);
+            bad++;
+            break;
+        }
+        frames++;
+        if (fread(data, 1, frame.length, f) != frame.length ||
+            !ehb_frame_valid(frame, data) || !block.decode(data, frame.length)) {
+            fprintf(stderr, "frame %lu: %u rows lost, CRC or block invalid\n", frames - 1, frame.rows);
+            bad++;
+            continue;
+        }
+        for (uint8_t r = 0; r < block.rows(); r++) {
+            char line[1024];
+            block.format(r, line, sizeof(line));
+            printf("%lu %s\n", (unsigned long)block.time(r), line);
+        }
+        rows += block.rows();
+    }
+    fclose(f);
+    fprintf(stderr, "%lu frames, %lu rows, %lu bad\n", frames, rows, bad);
+    return bad > 0;
+}
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(const char *path) {
+    std::vector<Row> rows;
+    if (path == NULL) {
+        generate(rows);
+    } else if (!load_capture(path, rows)) {
+        return 1;
+    }
+    if (rows.empty()) {
+        fprintf(stderr, "no sample sets\n");
+        return 1;
+    }
+
+    size_t text = 0, fields = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        text += rows[i].text + 1;
+        fields += rows[i].count;
+    }
+    unsigned long blocks = 0;
+    size_t bytes = encode_rows(rows, NULL, &blocks);
+
+    // Encode and decode cost, block by block as the ESP does it
+    static EcohouseBlock block;
+    static EcohouseBlock decoded;
+    std::vector<std::vector<uint8_t> > encoded;
+    int rounds = 0;
+    double encode_time = 0, decode_time = 0;
+    do {
+        encoded.clear();
+        double start = seconds();
+        block.begin();
+        for (size_t i = 0; i <= rows.size(); i++) {
+            if (i < rows.size() && add_row(block, rows[i])) continue;
+            std::vector<uint8_t> data(EHB_MAX_BLOCK);
+            data.resize(block.encode(&data[0], data.size()));
+            encoded.push_back(data);
+            block.begin();
+            if (i < rows.size()) add_row(block, rows[i]);
+        }
+        encode_time += seconds() - start;
+
+        start = seconds();
+        for (size_t b = 0; b < encoded.size(); b++) {
+            if (!decoded.decode(&encoded[b][0], encoded[b].size())) {
+                fprintf(stderr, "block %zu does not decode\n", b);
+                return 1;
+            }
+        }
+        decode_time += seconds() - start;
+        rounds++;
+    } while (encode_time + decode_time < 1.0);
+
+    // Compaction must be lossless: every set comes back as it went in
+    size_t next = 0;
+    for (size_t b = 0; b < encoded.size(); b++) {
+        decoded.decode(&encoded[b][0], encoded[b].size());
+        for (uint8_t r = 0; r < decoded.rows(); r++, next++) {
+            if (next >= rows.size() || !same_row(decoded, r, rows[next])) {
+                fprintf(stderr, "set %zu does not come back from its block as it went in\n", next);
+                return 1;
+            }
+        }
+    }
+    if (next != rows.size()) {
+        fprintf(stderr, "%zu sets went in, %zu came back\n", rows.size(), next);
+        return 1;
+    }
+
+    double n = rows.size();
+    double span = rows.back().time > rows.front().time ? rows.back().time - rows.front().time : n * SAMPLE_PERIOD;
+    double period = span / (n > 1 ? n - 1 : 1);
+    printf("%s: %zu sample sets, %.1f fields each, every %.1f s\n\n",
+           path != NULL ? path : "generated", rows.size(), fields / n, period);
+    printf("%-16s %10s %10s %10s\n", "format", "B/set", "ratio", "days/300KB");
+    printf("%-16s %10.1f %10.2f %10.2f\n", "backlog record", (double)BACKLOG_RECORD, 1.0,
+           SPIFFS_BUDGET / (double)BACKLOG_RECORD * period / 86400);
+    printf("%-16s %10.1f %10.2f %10.2f\n", "text line", text / n, BACKLOG_RECORD / (text / n),
+           SPIFFS_BUDGET / (text / n) * period / 86400);
+    printf("%-16s %10.1f %10.2f %10.2f\n", "blocks", bytes / n, BACKLOG_RECORD / (bytes / n),
+           SPIFFS_BUDGET / (bytes / n) * period / 86400);
+    printf("\n%lu blocks, %.1f sets and %.0f bytes each with frame\n", blocks, n / blocks, (double)bytes / blocks);
+    printf("encode %.0f ns/set, decode %.0f ns/set (host, %d rounds)\n",
+           encode_time * 1e9 / (n * rounds), decode_time * 1e9 / (n * rounds), rounds);
+    if (skipped > 0) {
+        printf("%lu fields skipped: not stored exactly in hundredths\n", skipped);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && strcmp(argv[1], "decode") == 0) {
+        return decode(argv[2]);
+    }
+    if (argc >= 4 && strcmp(argv[1], "encode") == 0) {
+        std::vector<Row> rows;
+        if (!load_capture(argv[2], rows)) return 1;
+        FILE *out = fopen(argv[3], "wb");
+        if (out == NULL) {
+            perror(argv[3]);
+            return 1;
+        }
+        unsigned long blocks = 0;
+        size_t bytes = encode_rows(rows, out, &blocks);
+        fclose(out);
+        fprintf(stderr, "%zu sample sets in %lu blocks, %zu bytes\n", rows.size(), blocks, bytes);
+        if (skipped > 0) {
+            fprintf(stderr, "%lu fields skipped: not stored exactly in hundredths\n", skipped);
+        }
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return bench(argc >= 3 ? argv[2] : NULL);
+    }
+    fprintf(stderr, "usage: %s decode <segment> | encode <capture> <segment> | bench [capture]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,262 @@
+/*!
+ *  @file 		ecohouse_link.cpp
+ *  @version	1.0
+ *
+ * Framed binary protocol for the Nano -> EmonESP serial link
+ * GNU GPL
+*/
+
+#include "ecohouse_link.h"
+
+#include <string.h>
+
+static const char ehl_kind_letters[] = "ptcvfhex";
+
+// The CRC is Contiki's crc16.c as shipped with the UnoWiFiDevEd library.
+// That library only builds for AVR, so its source is compiled in here, in
+// a namespace of its own so both can be linked into the Nano sketch
+namespace contiki {
+#include "../Arduino_Uno_WiFi_Dev_Ed_Library/src/lib/crc16.c"
+}
+
+
+uint16_t ehl_crc16_data(const uint8_t *data, size_t len, uint16_t acc)
+{
+	return contiki::crc16_data(data, len, acc);
+}
+
+uint8_t ehl_channel_from_key(const char *key)
+{
+	const char *kind = strchr(ehl_kind_letters, key[0]);
+	if (key[0] == '\0' || kind == NULL) return 0xFF;
+
+	uint8_t index = 0;
+	const char *p = key + 1;
+	if (*p == '\0') return 0xFF;
+	while (*p != '\0') {
+		if (*p < '0' || *p > '9') return 0xFF;
+		index = index * 10 + (*p - '0');
+		if (index > 31) return 0xFF;
+		p++;
+	}
+	return EHL_CHANNEL(kind - ehl_kind_letters, index);
+}
+
+uint8_t ehl_key(uint8_t channel, char *buf)
+{
+	uint8_t index = EHL_CHANNEL_INDEX(channel);
+	uint8_t n = 0;
+
+	buf[n++] = ehl_kind_letters[EHL_CHANNEL_KIND(channel)];
+	if (index >= 10) buf[n++] = '0' + index / 10;
+	buf[n++] = '0' + index % 10;
+	buf[n] = '\0';
+	return n;
+}
+
+uint8_t ehl_format_value(int32_t value, char *buf)
+{
+	char digits[10];
+	uint8_t n = 0;
+	uint8_t len = 0;
+	uint32_t u = (value < 0) ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+
+	do {
+		digits[n++] = '0' + (u % 10);
+		u /= 10;
+	} while (u > 0 || n <= EHL_VALUE_DECIMALS);
+
+	if (value < 0) buf[len++] = '-';
+	while (n > 0) {
+		if (n == EHL_VALUE_DECIMALS) buf[len++] = '.';
+		buf[len++] = digits[--n];
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+
+/* Function: 	Starts a new frame
+ * Parameters:	seq: frame sequence number
+ * Return: 		nothing
+ */
+void EcohouseLinkEncoder::begin(uint8_t seq)
+{
+	_frame[0] = EHL_SYNC;
+	_frame[1] = 0;
+	_frame[2] = seq;
+	_len = EHL_HEADER_SIZE;
+}
+
+bool EcohouseLinkEncoder::add(uint8_t channel, int32_t value)
+{
+	if (_frame[1] + EHL_RECORD_SIZE > EHL_MAX_PAYLOAD) return false;
+
+	uint32_t u = (uint32_t)value;
+	_frame[_len++] = channel;
+	_frame[_len++] = u & 0xFF;
+	_frame[_len++] = (u >> 8) & 0xFF;
+	_frame[_len++] = (u >> 16) & 0xFF;
+	_frame[_len++] = (u >> 24) & 0xFF;
+	_frame[1] += EHL_RECORD_SIZE;
+	return true;
+}
+
+uint8_t EcohouseLinkEncoder::finish()
+{
+	uint16_t crc = ehl_crc16_data(_frame + 1, _len - 1, 0);
+	_frame[_len++] = crc & 0xFF;
+	_frame[_len++] = crc >> 8;
+	return _len;
+}
+
+
+EcohouseLinkDecoder::EcohouseLinkDecoder()
+{
+	bytes = 0;
+	frames = 0;
+	crc_errors = 0;
+	dropped = 0;
+	duplicates = 0;
+	_have_seq = false;
+	_last_seq = 0;
+	reset();
+}
+
+void EcohouseLinkDecoder::reset()
+{
+	_state = STATE_SYNC;
+	_pos = 0;
+	_need = 0;
+	_replay_pos = 0;
+	_replay_len = 0;
+}
+
+int8_t EcohouseLinkDecoder::push(uint8_t b)
+{
+	if (_replay_len == sizeof(_replay)) {
+		// Only when push() is called again before poll() has used up
+		// the bytes of a rejected frame
+		reset();
+	}
+	bytes++;
+	_replay[_replay_len++] = b;
+	return poll();
+}
+
+int8_t EcohouseLinkDecoder::poll()
+{
+	while (_replay_pos < _replay_len) {
+		int8_t result = scan(_replay[_replay_pos++]);
+		if (result != EHL_NEED_MORE) return result;
+	}
+	_replay_pos = 0;
+	_replay_len = 0;
+	return EHL_NEED_MORE;
+}
+
+/* Function: 	Puts the bytes of a rejected frame that followed its SYNC in
+ *				front of those still waiting, to be scanned for SYNC again
+ * Parameters:	bytes: the rejected bytes
+ *				len: their number
+ * Return: 		nothing
+ */
+void EcohouseLinkDecoder::rescan(const uint8_t *bytes, uint8_t len)
+{
+	uint8_t rest = _replay_len - _replay_pos;
+	memmove(_replay + len, _replay + _replay_pos, rest);
+	memcpy(_replay, bytes, len);
+	_replay_pos = 0;
+	_replay_len = len + rest;
+}
+
+/* Function: 	Feeds one byte to the frame state machine
+ * Parameters:	b: received byte
+ * Return: 		EHL_NEED_MORE while a frame is incomplete, EHL_FRAME_OK when
+ *				a new valid frame is available, EHL_FRAME_DUPLICATE for a
+ *				valid frame that repeats the last SEQ, EHL_FRAME_BAD when a
+ *				frame was rejected
+ */
+int8_t EcohouseLinkDecoder::scan(uint8_t b)
+{
+	switch (_state) {
+	case STATE_SYNC:
+		if (b == EHL_SYNC) _state = STATE_LEN;
+		return EHL_NEED_MORE;
+
+	case STATE_LEN:
+		if (b == 0 || b > EHL_MAX_PAYLOAD || (b % EHL_RECORD_SIZE) != 0) {
+			// The SYNC was a stray byte; b may be the real one
+			crc_errors++;
+			_state = STATE_SYNC;
+			rescan(&b, 1);
+			return EHL_FRAME_BAD;
+		}
+		_buf[0] = b;
+		_pos = 1;
+		_need = 1 + b + EHL_CRC_SIZE;    // SEQ + payload + CRC
+		_state = STATE_BODY;
+		return EHL_NEED_MORE;
+
+	case STATE_BODY:
+		_buf[_pos++] = b;
+		if (--_need > 0) return EHL_NEED_MORE;
+		break;
+	}
+
+	_state = STATE_SYNC;
+
+	uint8_t body = 2 + _buf[0];          // LEN + SEQ + payload
+	uint16_t crc = ehl_crc16_data(_buf, body, 0);
+	if (crc != (uint16_t)(_buf[body] | (_buf[body + 1] << 8))) {
+		// A frame may have started after a lost byte
+		crc_errors++;
+		rescan(_buf, _pos);
+		return EHL_FRAME_BAD;
+	}
+
+	uint8_t s = seq();
+	if (_have_seq) {
+		if (s == _last_seq) {
+			duplicates++;
+			return EHL_FRAME_DUPLICATE;
+		}
+		dropped += (uint8_t)(s - _last_seq - 1);
+	}
+	_have_seq = true;
+	_last_seq = s;
+	frames++;
+	return EHL_FRAME_OK;
+}
+
+uint8_t EcohouseLinkDecoder::channel(uint8_t i) const
+{
+	return _buf[2 + i * EHL_RECORD_SIZE];
+}
+
+int32_t EcohouseLinkDecoder::value(uint8_t i) const
+{
+	const uint8_t *p = &_buf[2 + i * EHL_RECORD_SIZE + 1];
+	return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	                 ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+size_t EcohouseLinkDecoder::format(char *buf, size_t size) const
+{
+	char item[EHL_KEY_SIZE + 14];
+	size_t len = 0;
+
+	for (uint8_t i = 0; i < count(); i++) {
+		uint8_t n = 0;
+		if (i > 0) item[n++] = ',';
+		n += ehl_key(channel(i), item + n);
+		item[n++] = ':';
+		n += ehl_format_value(value(i), item + n);
+
+		if (len + n >= size) break;
+		memcpy(buf + len, item, n);
+		len += n;
+	}
+	if (size > 0) buf[len] = '\0';
+	return len;
+}
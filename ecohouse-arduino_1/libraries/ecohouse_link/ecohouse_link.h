@@ -0,0 +1,180 @@
+/*!
+ *  @file 		ecohouse_link.h
+ *  @version	1.0
+ *
+ * Framed binary protocol for the Nano -> EmonESP serial link
+ * GNU GPL
+ *
+ * Frame layout (all multi-byte fields little endian):
+ *
+ *   SYNC | LEN | SEQ | LEN bytes of payload | CRC16
+ *
+ *   SYNC    0xA5, never a valid byte of a text line
+ *   LEN     payload length in bytes, a multiple of EHL_RECORD_SIZE
+ *   SEQ     frame sequence number, wraps at 255
+ *   payload N x { channel id (1 byte), value (int32, hundredths) }
+ *   CRC16   CCITT, same algorithm as Contiki's crc16.c shipped with the
+ *           UnoWiFiDevEd library, over LEN, SEQ and the payload
+ *
+ * A channel id packs a kind (upper 3 bits) and an index (lower 5 bits),
+ * so "p7" is EHL_CHANNEL(EHL_KIND_POWER, 7) and "t1" is
+ * EHL_CHANNEL(EHL_KIND_TEMPERATURE, 1).
+*/
+
+#ifndef ecohouse_link_h
+#define ecohouse_link_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EHL_SYNC            0xA5
+#define EHL_HEADER_SIZE     3       // SYNC, LEN, SEQ
+#define EHL_CRC_SIZE        2
+#define EHL_RECORD_SIZE     5       // channel id + int32 value
+#define EHL_MAX_CHANNELS    16
+#define EHL_MAX_PAYLOAD     (EHL_MAX_CHANNELS * EHL_RECORD_SIZE)
+#define EHL_MAX_FRAME       (EHL_HEADER_SIZE + EHL_MAX_PAYLOAD + EHL_CRC_SIZE)
+#define EHL_VALUE_DECIMALS  2       // values travel as hundredths
+
+// Channel kinds; the letter is the key prefix used by emoncms/MQTT
+#define EHL_KIND_POWER        0     // 'p'
+#define EHL_KIND_TEMPERATURE  1     // 't'
+#define EHL_KIND_CURRENT      2     // 'c'
+#define EHL_KIND_VOLTAGE      3     // 'v'
+#define EHL_KIND_FLOW         4     // 'f'
+#define EHL_KIND_HUMIDITY     5     // 'h'
+#define EHL_KIND_ENERGY       6     // 'e'
+#define EHL_KIND_OTHER        7     // 'x'
+
+#define EHL_CHANNEL(kind, index)  ((uint8_t)(((kind) << 5) | ((index) & 0x1F)))
+#define EHL_CHANNEL_KIND(ch)      ((uint8_t)((ch) >> 5))
+#define EHL_CHANNEL_INDEX(ch)     ((uint8_t)((ch) & 0x1F))
+
+// Longest key rendered by ehl_key(): letter + 2 digits + '\0'
+#define EHL_KEY_SIZE        4
+
+// Results of EcohouseLinkDecoder::push()
+#define EHL_NEED_MORE       0
+#define EHL_FRAME_OK        1
+#define EHL_FRAME_DUPLICATE 2
+#define EHL_FRAME_BAD       -1
+
+//! CCITT CRC16 over a buffer: Contiki's crc16_data()
+uint16_t ehl_crc16_data(const uint8_t *data, size_t len, uint16_t acc);
+
+//! Parses a key such as "p7" or "t1" into a channel id
+/*!
+\param const char *key: key text, letter followed by 1-31
+\return	channel id, or 0xFF if the key cannot be encoded
+*/
+uint8_t ehl_channel_from_key(const char *key);
+
+//! Renders the key of a channel id ("p7", "t1", ...)
+/*!
+\param uint8_t channel: channel id
+\param char *buf: output buffer of at least EHL_KEY_SIZE bytes
+\return	number of characters written, not counting the '\0'
+*/
+uint8_t ehl_key(uint8_t channel, char *buf);
+
+//! Renders a hundredths value as decimal text ("-12.30")
+/*!
+\param int32_t value: value in hundredths
+\param char *buf: output buffer of at least 13 bytes
+\return	number of characters written, not counting the '\0'
+*/
+uint8_t ehl_format_value(int32_t value, char *buf);
+
+
+class EcohouseLinkEncoder
+{
+	public:
+		//! Starts a new frame with the given sequence number
+		void begin(uint8_t seq);
+
+		//! Appends one reading. Returns false if the frame is full.
+		bool add(uint8_t channel, int32_t value);
+
+		//! Closes the frame and returns its total length in bytes
+		uint8_t finish();
+
+		const uint8_t *data() const { return _frame; }
+		uint8_t length() const { return _len; }
+		uint8_t count() const { return _frame[1] / EHL_RECORD_SIZE; }
+
+	private:
+		uint8_t _frame[EHL_MAX_FRAME];
+		uint8_t _len;
+};
+
+
+class EcohouseLinkDecoder
+{
+	public:
+		EcohouseLinkDecoder();
+
+		//! Discards any partially received frame
+		void reset();
+
+		//! True while a frame has been started but not completed, or
+		//! bytes wait to be scanned again
+		bool busy() const { return _state != STATE_SYNC || _replay_pos < _replay_len; }
+
+		//! Feeds one received byte
+		/*!
+		The bytes of a rejected frame are scanned again for SYNC, so a
+		frame that started inside it is not lost. That can complete a
+		frame before b is looked at: b then waits for the next push() or
+		poll().
+		\param uint8_t b: received byte
+		\return	EHL_NEED_MORE, EHL_FRAME_OK, EHL_FRAME_DUPLICATE or EHL_FRAME_BAD
+		*/
+		int8_t push(uint8_t b);
+
+		//! Goes on with bytes still waiting to be scanned, without a new one
+		/*!
+		\return	as push(); EHL_NEED_MORE once they have all been used
+		*/
+		int8_t poll();
+
+		//! Accessors for the frame just reported as EHL_FRAME_OK; they are
+		//! only meaningful until the next byte is pushed
+		uint8_t seq() const { return _buf[1]; }
+		uint8_t count() const { return _buf[0] / EHL_RECORD_SIZE; }
+		uint8_t channel(uint8_t i) const;
+		int32_t value(uint8_t i) const;
+
+		//! Renders the last frame as "p1:120.50,t1:21.50"
+		/*!
+		\param char *buf: output buffer
+		\param size_t size: size of buf
+		\return	number of characters written, not counting the '\0'
+		*/
+		size_t format(char *buf, size_t size) const;
+
+		// Link statistics
+		uint32_t bytes;         // bytes pushed, not counting rescans
+		uint32_t frames;        // valid frames received
+		uint32_t crc_errors;    // frames rejected by length or CRC
+		uint32_t dropped;       // frames missing according to SEQ
+		uint32_t duplicates;    // repeated SEQ, not forwarded
+
+	private:
+		enum { STATE_SYNC, STATE_LEN, STATE_BODY };
+
+		uint8_t _state;
+		uint8_t _pos;
+		uint8_t _need;
+		bool _have_seq;
+		uint8_t _last_seq;
+		uint8_t _buf[EHL_MAX_FRAME];     // LEN, SEQ, payload, CRC
+
+		// Received bytes not yet scanned: b, or a rejected frame to scan again
+		uint8_t _replay[EHL_MAX_FRAME];
+		uint8_t _replay_pos;
+		uint8_t _replay_len;
+		int8_t scan(uint8_t b);
+		void rescan(const uint8_t *bytes, uint8_t len);
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef memory_usage_h
+#define memory_usage_h
+
+// *******************************************************
+// ******** MARCA DE AGUA DE RAM (stack painting) ********
+// *******************************************************
+//
+// ramPaint() rellena la RAM libre entre el heap y la pila con un patron
+// conocido; ramMinFree() cuenta cuantos bytes siguen intactos, es decir,
+// la RAM libre minima alcanzada desde el arranque.
+
+#define RAM_CANARY 0xC5
+#define RAM_PAINT_MARGIN 32   // bytes de la pila actual que no se tocan
+
+// Function Prototypes
+void ramPaint();
+uint16_t ramMinFree();
+
+
+#if defined(__AVR__)
+
+extern uint8_t __heap_start;
+extern void *__brkval;
+
+static uint8_t *ramFreeStart()
+  {
+    return (__brkval != 0) ? (uint8_t *)__brkval : &__heap_start;
+  }
+
+void ramPaint()
+  {
+    uint8_t *p = ramFreeStart();
+    uint8_t *sp = (uint8_t *)SP;
+    while (p < sp - RAM_PAINT_MARGIN) *p++ = RAM_CANARY;
+  }
+
+uint16_t ramMinFree()
+  {
+    const uint8_t *p = ramFreeStart();
+    uint16_t free_bytes = 0;
+    while (p <= (const uint8_t *)RAMEND && *p == RAM_CANARY)
+      {
+        free_bytes++;
+        p++;
+      }
+    return free_bytes;
+  }
+
+#else
+
+void ramPaint() {}
+uint16_t ramMinFree() {return 0;}
+
+#endif
+
+#endif
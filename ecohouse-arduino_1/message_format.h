@@ -0,0 +1,200 @@
+#ifndef message_format_h
+#define message_format_h
+
+// *******************************************************
+// ******** FORMATO DE MENSAJES SIN String NI HEAP ********
+// *******************************************************
+//
+// Cada medida se renderiza una sola vez como "nombre:valor" en un buffer
+// fijo y los mismos bytes se envian a Serial, al LCD y al ESP.
+// Los valores se formatean en coma fija con aritmetica entera
+// (sin dtostrf ni String).
+
+#define MSG_RECORD_SIZE 32
+#define MSG_VALUE_SIZE 13   // ':' + "-21474836.47"
+
+#include <ecohouse_link.h>
+
+struct MsgRecord
+  {
+    char buf[MSG_RECORD_SIZE];
+    uint8_t len;        // longitud de "nombre:valor"
+    uint8_t value_at;   // posicion del primer caracter del valor
+  };
+
+// Linea unica por barrido hacia el ESP: "p1:..,p2:..,t1:.."
+// y, en paralelo, la misma informacion como trama binaria ecohouse_link
+// (sync, longitud, secuencia, canal/valor en centesimas y CRC16).
+#define MSG_SWEEP_SIZE 128
+
+struct MsgSweep
+  {
+    char buf[MSG_SWEEP_SIZE];
+    uint8_t len;
+    uint8_t dropped;    // medidas que no cupieron en la linea o en la trama
+    uint8_t seq;        // numero de secuencia de la trama binaria
+    EcohouseLinkEncoder frame;
+  };
+
+MsgSweep msg_sweep;
+
+// Tiempo de formateo (us) del ultimo registro y maximo desde el arranque
+uint16_t fmt_time_last=0;
+uint16_t fmt_time_max=0;
+
+// Function Prototypes
+int32_t toFixed(double value, uint8_t decimals);
+char *fmtFixed(char *p, char *end, int32_t scaled, uint8_t decimals);
+void renderRecord(MsgRecord &msg, PGM_P name, int32_t scaled, uint8_t decimals);
+void renderRecordRam(MsgRecord &msg, const char *name, int32_t scaled, uint8_t decimals);
+void renderValue(MsgRecord &msg, uint32_t t_start, int32_t scaled, uint8_t decimals);
+void sendRecord(Print &out, const MsgRecord &msg);
+void sweepBegin(MsgSweep &sweep);
+void sweepAppend(MsgSweep &sweep, PGM_P key, int32_t scaled, uint8_t decimals);
+void sendSweep(Print &out, const MsgSweep &sweep);
+void sendSweepFrame(Print &out, MsgSweep &sweep);
+int32_t toHundredths(int32_t scaled, uint8_t decimals);
+
+
+static const int32_t pow10_table[] PROGMEM = {1, 10, 100, 1000, 10000};
+
+// Convierte a coma fija redondeando al entero mas cercano
+int32_t toFixed(double value, uint8_t decimals)
+  {
+    double scaled = value * (double)pgm_read_dword(&pow10_table[decimals]);
+    if (scaled >= 2147483647.0) return INT32_MAX;
+    if (scaled <= -2147483647.0) return -INT32_MAX;
+    return (scaled >= 0) ? (int32_t)(scaled + 0.5) : -(int32_t)(-scaled + 0.5);
+  }
+
+// Escribe scaled / 10^decimals en [p, end). Devuelve el final de lo
+// escrito; si no cabe no escribe nada y devuelve p.
+char *fmtFixed(char *p, char *end, int32_t scaled, uint8_t decimals)
+  {
+    char digits[11];
+    uint8_t n = 0;
+    uint32_t u = (scaled < 0) ? (uint32_t)(-scaled) : (uint32_t)scaled;
+
+    do
+      {
+        digits[n++] = '0' + (u % 10);
+        u /= 10;
+      }
+    while (u > 0 || n <= decimals);
+
+    uint8_t needed = n + (decimals ? 1 : 0) + (scaled < 0 ? 1 : 0);
+    if ((end - p) < needed) return p;
+
+    if (scaled < 0) *p++ = '-';
+    while (n > 0)
+      {
+        if (n == decimals) *p++ = '.';
+        *p++ = digits[--n];
+      }
+    return p;
+  }
+
+// Nombre en flash (tablas PROGMEM)
+void renderRecord(MsgRecord &msg, PGM_P name, int32_t scaled, uint8_t decimals)
+  {
+    uint32_t t_start = micros();
+    strlcpy_P(msg.buf, name, MSG_RECORD_SIZE - MSG_VALUE_SIZE);
+    renderValue(msg, t_start, scaled, decimals);
+  }
+
+// Nombre en RAM (p.ej. direccion de un sensor desconocido)
+void renderRecordRam(MsgRecord &msg, const char *name, int32_t scaled, uint8_t decimals)
+  {
+    uint32_t t_start = micros();
+    strlcpy(msg.buf, name, MSG_RECORD_SIZE - MSG_VALUE_SIZE);
+    renderValue(msg, t_start, scaled, decimals);
+  }
+
+void renderValue(MsgRecord &msg, uint32_t t_start, int32_t scaled, uint8_t decimals)
+  {
+    char *p = msg.buf + strlen(msg.buf);
+    *p++ = ':';
+    msg.value_at = p - msg.buf;
+    p = fmtFixed(p, msg.buf + MSG_RECORD_SIZE - 1, scaled, decimals);
+    *p = '\0';
+    msg.len = p - msg.buf;
+
+    fmt_time_last = micros() - t_start;
+    if (fmt_time_last > fmt_time_max) fmt_time_max = fmt_time_last;
+  }
+
+void sendRecord(Print &out, const MsgRecord &msg)
+  {
+    out.write((const uint8_t *)msg.buf, msg.len);
+    out.println();
+  }
+
+void sweepBegin(MsgSweep &sweep)
+  {
+    sweep.buf[0] = '\0';
+    sweep.len = 0;
+    sweep.dropped = 0;
+    sweep.frame.begin(sweep.seq++);
+  }
+
+// Pasa un valor en coma fija con 'decimals' decimales a centesimas
+int32_t toHundredths(int32_t scaled, uint8_t decimals)
+  {
+    if (decimals <= EHL_VALUE_DECIMALS)
+      return scaled * (int32_t)pgm_read_dword(&pow10_table[EHL_VALUE_DECIMALS - decimals]);
+    int32_t div = pgm_read_dword(&pow10_table[decimals - EHL_VALUE_DECIMALS]);
+    return (scaled >= 0) ? (scaled + div / 2) / div : -((-scaled + div / 2) / div);
+  }
+
+// Anade "clave:valor" al barrido, a la linea de texto y a la trama
+// binaria a la vez: si no cabe en alguna de las dos (o la clave no tiene
+// canal) se descarta de ambas, y las dos llevan siempre los mismos canales
+void sweepAppend(MsgSweep &sweep, PGM_P key, int32_t scaled, uint8_t decimals)
+  {
+    char *start = sweep.buf + sweep.len;
+    char *end = sweep.buf + MSG_SWEEP_SIZE - 1;
+    char *p = start;
+
+    if (sweep.len > 0 && p < end) *p++ = ',';
+    uint8_t key_len = strlen_P(key);
+    if ((end - p) > key_len + 1)
+      {
+        memcpy_P(p, key, key_len);
+        p += key_len;
+        *p++ = ':';
+        char *value_end = fmtFixed(p, end, scaled, decimals);
+        if (value_end != p)
+          {
+            char key_ram[EHL_KEY_SIZE];
+            uint8_t channel = 0xFF;
+            if (key_len < sizeof(key_ram))
+              {
+                strlcpy_P(key_ram, key, sizeof(key_ram));
+                channel = ehl_channel_from_key(key_ram);
+              }
+            if (channel != 0xFF && sweep.frame.add(channel, toHundredths(scaled, decimals)))
+              {
+                *value_end = '\0';
+                sweep.len = value_end - sweep.buf;
+                return;
+              }
+          }
+      }
+
+    *start = '\0';
+    sweep.dropped++;
+  }
+
+void sendSweep(Print &out, const MsgSweep &sweep)
+  {
+    out.write((const uint8_t *)sweep.buf, sweep.len);
+    out.println();
+  }
+
+// Cierra la trama binaria del barrido y la envia entera (una vez por barrido)
+void sendSweepFrame(Print &out, MsgSweep &sweep)
+  {
+    out.write(sweep.frame.data(), sweep.frame.finish());
+  }
+
+#endif
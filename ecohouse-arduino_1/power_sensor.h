@@ -10,26 +10,32 @@
 
 #define NUMBER_OF_PWR_SENSORS 3
 
+#define KEY_PWR_1 "p1"
 #define MAME_PWR_1 "Pinza_1"
 #define ENTER_1 A0
 #define CURRENT_CONST_1 195
 
+#define KEY_PWR_2 "p2"
 #define MAME_PWR_2 "Pinza_2"
 #define ENTER_2 A1
 #define CURRENT_CONST_2 195
 
+#define KEY_PWR_3 "p3"
 #define MAME_PWR_3 "Pinza_3"
 #define ENTER_3 A2
 #define CURRENT_CONST_3 195
 
+#define KEY_PWR_4 "p4"
 #define MAME_PWR_4 "Pinza_4"
 #define ENTER_4 A3
 #define CURRENT_CONST_4 195
 
+#define KEY_PWR_5 "p7"
 #define MAME_PWR_5 "Pinza_7"
 #define ENTER_5 A6
 #define CURRENT_CONST_5 195
 
+#define KEY_PWR_6 "p8"
 #define MAME_PWR_6 "Pinza_8"
 #define ENTER_6 A7
 #define CURRENT_CONST_6 195
@@ -39,10 +45,13 @@
 
 #include "EmonLib.h"                   // Include Emon Library
 EnergyMonitor emon1;
+MsgRecord msg_pwr;
 
 // variable declaration
 
-String name_pwr[]=
+#define NAME_PWR_SIZE 16
+
+const char name_pwr[][NAME_PWR_SIZE] PROGMEM=
   {
     MAME_PWR_1,
     MAME_PWR_2,
@@ -52,6 +61,17 @@ String name_pwr[]=
     MAME_PWR_6
   };
 
+// Claves de cada canal en la linea enviada al ESP
+const char key_pwr[][4] PROGMEM=
+  {
+    KEY_PWR_1,
+    KEY_PWR_2,
+    KEY_PWR_3,
+    KEY_PWR_4,
+    KEY_PWR_5,
+    KEY_PWR_6
+  };
+
 int enter_pin[]=
   {
     ENTER_1,
@@ -92,27 +112,26 @@ void buildPowerMessage(uint8_t output)
         
         double Irms = emon1.calcIrms(1480);
         double Pwr=(Irms*230.0); 
-      
-        String value_pwr = String(Pwr,2);    
+
+        int32_t pwr_fixed = toFixed(Pwr,2);
+        renderRecord(msg_pwr, name_pwr[i], pwr_fixed, 2);
         if (output==0) 
           {
-            Serial.println("wifiSerialInit.println");
-            Serial.println (name_pwr[i] + ":" + value_pwr);
+            sendRecord(log_out, msg_pwr);
 
             lcd.clear();
-            lcd.setCursor(0, 0); lcd.print(name_pwr[i]+"  ->");
-            lcd.setCursor(0, 1);lcd.print(value_pwr + " W");
+            lcd.setCursor(0, 0); lcd.write((const uint8_t *)msg_pwr.buf, msg_pwr.value_at - 1); lcd.print(F("  ->"));
+            lcd.setCursor(0, 1); lcd.print(msg_pwr.buf + msg_pwr.value_at); lcd.print(F(" W"));
 
-            wifiSerialInit.println (name_pwr[i] + ":" + value_pwr);
+            sweepAppend(msg_sweep, key_pwr[i], pwr_fixed, 2);
           }
         if (output==1) 
           {
-            Serial.println("wifiSerialInit.println");
-            Serial.println (name_pwr[i] + ":" + value_pwr);
+            sendRecord(log_out, msg_pwr);
             
             lcd.clear();
-            lcd.setCursor(0, 0); lcd.print(name_pwr[i]);
-            lcd.setCursor(0, 1);lcd.print(value_pwr + " W");
+            lcd.setCursor(0, 0); lcd.write((const uint8_t *)msg_pwr.buf, msg_pwr.value_at - 1);
+            lcd.setCursor(0, 1); lcd.print(msg_pwr.buf + msg_pwr.value_at); lcd.print(F(" W"));
 
           }
       }
@@ -16,29 +16,28 @@
 //#define POSITION_1  {0x28,0xFF,0xFD,0x36,0x84,0x16,0x04,0x98}
 //#define POSITION_1  {0x28,0xA3,0x77,0x02,0x08,0x00,0x00,0x05}
 #define POSITION_1  {0x28,0xff,0xb6,0x39,0x84,0x16,0x04,0x9b}
+#define KEY_SENSOR_1 "t1"
 #define NAME_SENSOR_1 "Temp_Out" 
 #define POSITION_2  {0x28,0x7B,0x6B,0x02,0x08,0x00,0x00,0x3D}
+#define KEY_SENSOR_2 "t2"
 #define NAME_SENSOR_2 "Temp_In" 
 #define POSITION_3  {0x28,0x53,0x8E,0x01,0x08,0x00,0x00,0xAA}
+#define KEY_SENSOR_3 "t3"
 #define NAME_SENSOR_3 "Temp_Amb"
 #define POSITION_4  {0x28,0xFF,0x86,0x40,0x70,0x16,0x05,0x69}
+#define KEY_SENSOR_4 "t4"
 #define NAME_SENSOR_4 "Tra Planta 3" 
-#define POSITION_5  {0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE}
-#define NAME_SENSOR_5 " SENSOR POSITION" 
-#define POSITION_6  {0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE}
-#define NAME_SENSOR_6 " SENSOR POSITIONL" 
-#define POSITION_7  {0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE}
-#define NAME_SENSOR_7 " SENSOR POSITION" 
-#define POSITION_8  {0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE}
-#define NAME_SENSOR_8 " SENSOR POSITION" 
-#define POSITION_9  {0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE}
-#define NAME_SENSOR_9 " SENSOR POSITION"
-#define POSITION_10  {0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE}
-#define NAME_SENSOR_10 " SENSOR POSITION"
-#define POSITION_11  {0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE}
-#define NAME_SENSOR_11 " SENSOR POSITION" 
-#define POSITION_12  {0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE,0xEE}
-#define NAME_SENSOR_12 " SENSOR POSITION" 
+
+// Tabla de sensores conocidos. Las entradas deben ir ORDENADAS por
+// direccion ROM ascendente (byte a byte); el compilador lo comprueba.
+#define NUMBER_OF_TEMP_SENSORS 4
+#define TEMP_SENSOR_TABLE          \
+  {                                \
+    {POSITION_3, KEY_SENSOR_3, NAME_SENSOR_3},   \
+    {POSITION_2, KEY_SENSOR_2, NAME_SENSOR_2},   \
+    {POSITION_4, KEY_SENSOR_4, NAME_SENSOR_4},   \
+    {POSITION_1, KEY_SENSOR_1, NAME_SENSOR_1}    \
+  }
 
 
 // *******************************************************
@@ -46,11 +45,24 @@
 #include <OneWire.h>
 #include <DallasTemperature.h>
 
+#define TEMP_SENSOR_KEY_SIZE 4     // clave en la linea del ESP, p.ej. "t1"
+#define TEMP_SENSOR_NAME_SIZE 16   // 15 caracteres (ancho del LCD) + '\0'
+#define TEMP_SENSOR_ADDR_SIZE 17   // 8 bytes en hexadecimal + '\0'
+
+struct TempSensorEntry
+  {
+    uint8_t rom[8];
+    char key[TEMP_SENSOR_KEY_SIZE];
+    char name[TEMP_SENSOR_NAME_SIZE];
+  };
+
 void buildTemperatureMessage(uint8_t);
-String printName(DeviceAddress deviceAddress);
+const TempSensorEntry *findTempSensor(const uint8_t *deviceAddress);
+PGM_P findTempSensorName(const uint8_t *deviceAddress);
+void printName(Print &out, DeviceAddress deviceAddress);
+void renderTempRecord(MsgRecord &msg, DeviceAddress deviceAddress, float tempC);
 bool compareAddress(DeviceAddress deviceAddress_c_1, DeviceAddress deviceAddress_c_2);
-void printResoltion(DeviceAddress deviceAddressPr);
-String printAddress(DeviceAddress deviceAddressPa);
+char *printAddress(DeviceAddress deviceAddressPa, char *buf);
 void temperatureSensorsBegin();
 
 
@@ -59,31 +71,32 @@ OneWire oneWire(ONE_WIRE_BUS);
 DallasTemperature sensors_m(&oneWire);
 
 
- //DeviceAddress
-uint8_t deviceAddress_1[]=POSITION_1;
-uint8_t deviceAddress_2[]=POSITION_2;
-uint8_t deviceAddress_3[]=POSITION_3;
-uint8_t deviceAddress_4[]=POSITION_4;
-uint8_t deviceAddress_5[]=POSITION_5;
-uint8_t deviceAddress_6[]=POSITION_6;
-uint8_t deviceAddress_7[]=POSITION_7;
-uint8_t deviceAddress_8[]=POSITION_8;
-uint8_t deviceAddress_9[]=POSITION_9;
-uint8_t deviceAddress_10[]=POSITION_10;
-uint8_t deviceAddress_11[]=POSITION_11;
-uint8_t deviceAddress_12[]=POSITION_12;
+constexpr TempSensorEntry temp_sensor_table[NUMBER_OF_TEMP_SENSORS] PROGMEM = TEMP_SENSOR_TABLE;
+
+constexpr bool romLess(const uint8_t *a, const uint8_t *b, uint8_t i)
+  {
+    return (i == 8) ? false : ((a[i] != b[i]) ? (a[i] < b[i]) : romLess(a, b, i + 1));
+  }
+
+constexpr bool tempSensorTableSorted(const TempSensorEntry *t, uint8_t n)
+  {
+    return (n < 2) ? true : (romLess(t[0].rom, t[1].rom, 0) && tempSensorTableSorted(t + 1, n - 1));
+  }
+
+static_assert(tempSensorTableSorted(temp_sensor_table, NUMBER_OF_TEMP_SENSORS),
+              "TEMP_SENSOR_TABLE debe estar ordenada por direccion ROM ascendente y sin duplicados");
 
 
-String temperatureString = (""); 
+MsgRecord msg_temp;
 uint8_t numberOfDevices=0;
 
 
 void buildTemperatureMessage(uint8_t output) {
   
-    if (DEBUG) Serial.println(F("********buildTemperatureMessage()"));
+    if (DEBUG) log_out.println(F("********buildTemperatureMessage()"));
     numberOfDevices = sensors_m.getDeviceCount();
-    if (DEBUG) Serial.print(F("numberOfDevices = "));
-    if (DEBUG) Serial.println(numberOfDevices);
+    if (DEBUG) log_out.print(F("numberOfDevices = "));
+    if (DEBUG) log_out.println(numberOfDevices);
     sensors_m.requestTemperatures();
 
     
@@ -92,12 +105,10 @@ void buildTemperatureMessage(uint8_t output) {
         {
            if(sensors_m.getAddress(tempDeviceAddress, i))
            {
-             if (DEBUG) Serial.print(F("****device number= "));
-             if (DEBUG) Serial.println(i);
+             if (DEBUG) log_out.print(F("****device number= "));
+             if (DEBUG) log_out.println(i);
              float tempC = sensors_m.getTempC(tempDeviceAddress);
-             String value_18 = String(tempC,1);
-             String name_18 = printName(tempDeviceAddress);
-             if (DEBUG) Serial.println(name_18 + ":" + value_18);             
+             renderTempRecord(msg_temp, tempDeviceAddress, tempC);
 
              if (output==0) 
                  {
@@ -105,8 +116,10 @@ void buildTemperatureMessage(uint8_t output) {
                       // lcd.setCursor(0, 0); lcd.print(name_18);
                       // lcd.setCursor(0, 1);lcd.print(value_18);
                       // wifiBasic.enviarPost(name_18, value_18);
-		                  Serial.print("sensor_name:" + name_18);
-                      Serial.println(",sensor_value:" + value_18);
+                      sendRecord(log_out, msg_temp);
+
+                      const TempSensorEntry *entry = findTempSensor(tempDeviceAddress);
+                      if (entry != NULL) sweepAppend(msg_sweep, entry->key, toFixed(tempC, 1), 1);
                   }
 
 
@@ -116,7 +129,7 @@ void buildTemperatureMessage(uint8_t output) {
                      // lcd.setCursor(0, 0); lcd.print(name_18);
                      // lcd.setCursor(0, 1);lcd.print(value_18);
                      // delay(4000);
-                     Serial.println(name_18 + ": " + value_18);
+                     sendRecord(log_out, msg_temp);
                   }
 
              // if (output==2) wifiBasic.enviarPost(name_18, value_18);
@@ -128,60 +141,81 @@ void buildTemperatureMessage(uint8_t output) {
 }
 
 
-String printName(DeviceAddress deviceAddress)
+// Busqueda binaria en la tabla de flash. Devuelve un puntero a flash con
+// la entrada del sensor o NULL si la direccion no esta en la tabla.
+const TempSensorEntry *findTempSensor(const uint8_t *deviceAddress)
 {
+  uint8_t lo = 0;
+  uint8_t hi = NUMBER_OF_TEMP_SENSORS;
   
-  String temp_sensor_name;
-
-  // Incluye el nombre del sensor
-  if     (compareAddress(deviceAddress,deviceAddress_1))  {temp_sensor_name = F((NAME_SENSOR_1));}
-  else if(compareAddress(deviceAddress,deviceAddress_2))  {temp_sensor_name = F((NAME_SENSOR_2));} 
-  else if(compareAddress(deviceAddress,deviceAddress_3))  {temp_sensor_name = F((NAME_SENSOR_3));} 
-  else if(compareAddress(deviceAddress,deviceAddress_4))  {temp_sensor_name = F((NAME_SENSOR_4));} 
-  else if(compareAddress(deviceAddress,deviceAddress_5))  {temp_sensor_name = F((NAME_SENSOR_5));}  
-  else if(compareAddress(deviceAddress,deviceAddress_6))  {temp_sensor_name = F((NAME_SENSOR_6));} 
-  else if(compareAddress(deviceAddress,deviceAddress_7))  {temp_sensor_name = F((NAME_SENSOR_7));}  
-  else if(compareAddress(deviceAddress,deviceAddress_8))  {temp_sensor_name = F((NAME_SENSOR_8));}  
-  else if(compareAddress(deviceAddress,deviceAddress_9))  {temp_sensor_name = F((NAME_SENSOR_9));} 
-  else if(compareAddress(deviceAddress,deviceAddress_10)) {temp_sensor_name = F((NAME_SENSOR_10));} 
-  else if(compareAddress(deviceAddress,deviceAddress_11)) {temp_sensor_name = F((NAME_SENSOR_11));} 
-  else if(compareAddress(deviceAddress,deviceAddress_12)) {temp_sensor_name = F((NAME_SENSOR_12));}   
-
-  else temp_sensor_name = printAddress(deviceAddress);
-
- return temp_sensor_name;
- 
+  while (lo < hi)
+  {
+    uint8_t mid = (lo + hi) / 2;
+    int cmp = memcmp_P(deviceAddress, temp_sensor_table[mid].rom, 8);
+    if (cmp == 0) return &temp_sensor_table[mid];
+    if (cmp < 0) hi = mid;
+    else lo = mid + 1;
+  }
+  return NULL;
 }
 
-  
 
-bool compareAddress(DeviceAddress deviceAddress_c_1, DeviceAddress deviceAddress_c_2)
+PGM_P findTempSensorName(const uint8_t *deviceAddress)
+{
+  const TempSensorEntry *entry = findTempSensor(deviceAddress);
+  return (entry != NULL) ? entry->name : NULL;
+}
+
+
+void printName(Print &out, DeviceAddress deviceAddress)
+{
+  // Incluye el nombre del sensor, o su direccion si no esta en la tabla
+  PGM_P name = findTempSensorName(deviceAddress);
+  if (name != NULL)
   {
-    for(int i=0;i<7; i++)
-      {
-        if (deviceAddress_c_1[i] != deviceAddress_c_2[i]){return false;}
-      }
-    return true;
+    out.print((const __FlashStringHelper *)name);
   }
+  else
+  {
+    char addr[TEMP_SENSOR_ADDR_SIZE];
+    out.print(printAddress(deviceAddress, addr));
+  }
+}
+
+  
 
-void printResoltion(DeviceAddress deviceAddressPr)
+void renderTempRecord(MsgRecord &msg, DeviceAddress deviceAddress, float tempC)
 {
-  temperatureString += (sensors_m.getResolution(deviceAddressPr), DEC); 
+  PGM_P name = findTempSensorName(deviceAddress);
+  if (name != NULL)
+  {
+    renderRecord(msg, name, toFixed(tempC, 1), 1);
+  }
+  else
+  {
+    char addr[TEMP_SENSOR_ADDR_SIZE];
+    renderRecordRam(msg, printAddress(deviceAddress, addr), toFixed(tempC, 1), 1);
+  }
 }
 
 
 
-String printAddress(DeviceAddress deviceAddressPa)
+bool compareAddress(DeviceAddress deviceAddress_c_1, DeviceAddress deviceAddress_c_2)
+  {
+    return memcmp(deviceAddress_c_1, deviceAddress_c_2, 8) == 0;
+  }
+
+// Escribe la direccion en hexadecimal en buf (TEMP_SENSOR_ADDR_SIZE bytes)
+char *printAddress(DeviceAddress deviceAddressPa, char *buf)
 { 
-  String string_temp_r="";
+  static const char hex[] PROGMEM = "0123456789abcdef";
   for (uint8_t i = 0; i < 8; i++)
   {
-    if (deviceAddressPa[i] < 16) string_temp_r += ("0");
-    uint8_t temp= (deviceAddressPa[i]);
-    String stringTemp =  String(temp, HEX);  
-    string_temp_r = string_temp_r +stringTemp;
+    buf[2 * i]     = pgm_read_byte(&hex[deviceAddressPa[i] >> 4]);
+    buf[2 * i + 1] = pgm_read_byte(&hex[deviceAddressPa[i] & 0x0F]);
   }
-  return string_temp_r;
+  buf[16] = '\0';
+  return buf;
 }
 
 void temperatureSensorsBegin() {sensors_m.begin();}